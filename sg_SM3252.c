@@ -0,0 +1,598 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include "sg_SM3252_ops.h"
+#include "sg_SM3252_sched.h"
+#include "sg_SM3252_topo.h"
+#include "sg_SM3252_trace.h"
+#include "sg_SM3252_metrics.h"
+#include "sg_SM3252_board.h"
+
+/* Station tool for SM3252 eUSB modules: the steps of sg_read_SM325,
+   sg_read_SM3252_LED, sg_read_SM3252_Erase_Flash and
+   sg_read_SM3252_Print_Buffer as subcommands, run in the order given
+   against one open device.  The module is identified once and the
+   answers are shared by every subcommand (see sg_SM3252_ops.h), so
+   "scan led" costs one open and one INQUIRY, not two.
+
+   Given several devices, the commands run on all of them at once on -j
+   worker threads (see sg_SM3252_sched.h).  The work of a drive is cut
+   into steps: identify, each command, and for scan and erase each MU,
+   so a tray where some drives need a full scan and others only the LED
+   patch keeps every worker busy.  A drive never has more than one
+   command outstanding.  The report of each drive is printed in one piece
+   when it is done.
+
+   Drives are grouped by the USB hub they are on (see sg_SM3252_topo.h)
+   and -P caps the scan and erase steps running at once on each hub.
+   With -P auto the cap of each hub is found during the run, as the
+   number of drives at which the hub moves the most data per second.
+
+   Invocation: sg_SM3252 [-A] [-C <controller_file>] [-E] [-H <store_dir>] [-j <workers>]
+                         [-P <bulk_steps>|auto] [-R <retries>] [-T <profile_dir>]
+                         <sg_device> ... <command> ...
+
+   -A adds every sg device on USB to the drives given, so 'sg_SM3252 -A
+   ident' is an inventory of the chassis: four commands per drive (see
+   smo_ident()), all drives at once.  Not every sg device on USB is an
+   SM3252 module, so -A takes no command but ident, and a device found
+   that was also given is run once.
+
+   -C replaces the built in controller profiles (spare block totals,
+   reply offsets, how STEP 5 probes) with those of <controller_file>, see
+   sg_SM3252_prof.h.
+
+   -E has erase try the vendor erase 0xF0 0x0C before WRITE SAME.  The
+   command is not documented, see enum smo_erase_method.
+
+   Commands:
+     ident   identification, chip and capacity only, without the geometry
+     info    identification, capacity and geometry
+     scan    bad and spare blocks of each MU (STEP 5 and STEP 6)
+     led     set the LED byte of the CID table to 0x82
+     erase   fast erase of each MU
+     dump    VID, PID and the CID table
+
+   A drive is reset once, after its last command, when led changed the
+   CID table.  The exit status is 0 only when every command succeeded on
+   every drive.
+*/
+
+#define EBUFF_SZ    256
+#define MAX_CMDS    16
+
+enum sm_cmd {cmd_ident, cmd_info, cmd_scan, cmd_led, cmd_erase, cmd_dump};
+
+static const char * cmd_names[] = {"ident", "info", "scan", "led", "erase", "dump", NULL};
+
+/* What was asked for on the command line, the same for every drive */
+static struct {
+    int cmds[MAX_CMDS];
+    unsigned int n_cmds;
+    int ident_only;                 /* every command is ident: no STEP 4 */
+    int max_retries;
+    int vendor_erase;               /* -E */
+    unsigned int probe_window;
+    char * health_dir;
+    char * profile_dir;
+    char * trace_file;
+    char * metrics_file;
+    struct smb_board * board;       /* -S: scans published in shared memory */
+    int buffered;                   /* several drives: print reports whole */
+} opts;
+
+struct drive {
+    const char * name;
+    struct smo_session s;
+    int opened;
+    int identified;
+    unsigned int cmd;               /* next command */
+    unsigned int mu;                /* next MU of scan and erase */
+    int mu_ok;                      /* MUs scanned / sampled blocks not erased */
+    unsigned int failed;
+    char profile_name[EBUFF_SZ];
+    struct smm_drive * metrics;     /* rendered by drive_finish() with -M */
+    char * report;
+    size_t report_len;
+};
+
+static int cmd_lookup(const char * name)
+{
+    int c;
+
+    for (c=0; cmd_names[c]; c++) {
+        if (0 == strcmp(cmd_names[c], name))
+            return c;
+    }
+    return -1;
+}
+
+static void usage(void)
+{
+    printf("Usage: 'sg_SM3252 [-A] [-C <controller_file>] [-E] [-H <store_dir>] [-j <workers>]\n");
+    printf("                  [-P <bulk_steps>|auto] [-R <retries>] [-M <metrics_file>] [-S <board>]\n");
+    printf("                  [-T <profile_dir>] [-t <trace_file>] [-W <window>]\n");
+    printf("                  <sg_device> ... <command> ...'\n");
+    printf("  -A    also every sg device on USB (ident only)\n");
+    printf("  -C    controller profiles from <controller_file> instead of the built in ones\n");
+    printf("  -E    erase tries the vendor erase 0xF0 0x0C first; experimental: the\n");
+    printf("        command is not documented and the MU going in CDB byte 6 is a guess\n");
+    printf("  -H    append each scan to the health history in <store_dir>\n");
+    printf("  -j    worker threads (default: one per drive)\n");
+    printf("  -P    scan and erase steps running at once per USB hub (default: no limit),\n");
+    printf("        'auto' to find the number that gives each hub the most throughput\n");
+    printf("  -M    write bad and spare blocks, LED setting and SG_IO counters of each\n");
+    printf("        drive to <metrics_file> for the node_exporter textfile collector\n");
+    printf("  -R    retries of a failed SG_IO command (default: depends on the command)\n");
+    printf("  -S    publish each scan in the shared memory results board <board>,\n");
+    printf("        e.g. %s\n", SMB_DEFAULT_NAME);
+    printf("  -T    learn command timeouts from observed latencies, kept per product\n");
+    printf("        and firmware in <profile_dir>\n");
+    printf("  -t    write every SG_IO command to <trace_file> as a Chrome trace\n");
+    printf("        (chrome://tracing, ui.perfetto.dev), one lane per drive\n");
+    printf("  -W    keep <window> bad block probes of a scan queued on each drive\n");
+    printf("        (at most %d) instead of waiting for each one (default: as the\n",
+           SMD_PROBE_WINDOW_MAX);
+    printf("        controller profile says)\n");
+    printf("Commands, run in the order given on each drive:\n");
+    printf("  ident identification, chip and capacity with four commands\n");
+    printf("  info  identification, capacity and geometry\n");
+    printf("  scan  bad and spare blocks of each MU\n");
+    printf("  led   set the LED byte of the CID table to 0x82\n");
+    printf("  erase fast erase of each MU\n");
+    printf("  dump  VID, PID and the CID table\n");
+}
+
+/* Drops the drives that name a device already on the list, as a
+   /dev/sgN given and found again by -A: one module opened twice would
+   get its commands interleaved.  Names are compared by realpath(), or
+   as given when that fails (smo_open() reports those).  Returns the
+   number of drives left. */
+static unsigned int drive_dedup(struct drive * drives, unsigned int n_drives)
+{
+    char ** real;
+    unsigned int i, j, n = 0;
+
+    if ((real = calloc(n_drives, sizeof(*real))) == NULL)
+        return n_drives;
+    for (i=0; i<n_drives; i++) {
+        real[n] = realpath(drives[i].name, NULL);
+        for (j=0; j<n; j++) {
+            if (0 == strcmp(real[j] ? real[j] : drives[j].name,
+                            real[n] ? real[n] : drives[i].name))
+                break;
+        }
+        if (j < n) {
+            printf("sg_SM3252: %s is %s, skipped\n", drives[i].name, drives[j].name);
+            free(real[n]);
+            real[n] = NULL;
+            continue;
+        }
+        drives[n++] = drives[i];
+    }
+    for (i=0; i<n; i++)
+        free(real[i]);
+    free(real);
+    return n;
+}
+
+/* Last step of a drive: save what was learned and print its report */
+static void drive_finish(struct drive * d)
+{
+    struct smo_session * s = &d->s;
+
+    if (!d->opened)
+        return;
+    flockfile(stdout);
+    if (opts.buffered) {
+        fclose(s->out);
+        s->out = stdout;
+        if (d->report_len)
+            fwrite(d->report, 1, d->report_len, stdout);
+        free(d->report);
+        d->report = NULL;
+    }
+    if (d->profile_name[0]) {
+        smd_lat_print(&s->dev);
+        if (smd_lat_save(&s->dev, d->profile_name) < 0)
+            perror("sg_SM3252: error saving timeout profile");
+    }
+    smd_print_stats(&s->dev, d->name);
+    smd_print_errors(&s->dev, d->name);
+    if (d->metrics && (smm_render_drive(d->metrics, s, d->failed) < 0))
+        printf("sg_SM3252: out of memory for the metrics of %s\n", d->name);
+    smo_close(s);
+    d->opened = 0;
+    funlockfile(stdout);
+}
+
+/* Kind of the next step of a drive */
+static enum sms_next drive_next(struct drive * d)
+{
+    if (d->cmd >= opts.n_cmds) {
+        drive_finish(d);
+        return sms_done;
+    }
+    return ((opts.cmds[d->cmd] == cmd_scan) || (opts.cmds[d->cmd] == cmd_erase)) ?
+           sms_next_bulk : sms_next_step;
+}
+
+/* Run one step of a drive, see sg_SM3252_sched.h */
+static enum sms_next drive_step(void * arg)
+{
+    struct drive * d = (struct drive *)arg;
+    struct smo_session * s = &d->s;
+    struct smv_inquiry inq;
+    char serial[SMH_SERIAL_LEN + 1];
+    struct smh_scan scan;
+    FILE * out;
+    int res;
+
+    if (!d->identified) {
+        res = opts.ident_only ? smo_ident(s) : smo_identify(s);
+        if (res < 0) {
+            fprintf(s->out, "sg_SM3252: can't identify %s\n", d->name);
+            d->failed++;
+            d->cmd = opts.n_cmds;
+            return drive_next(d);
+        }
+        d->identified = 1;
+        /* Timeouts learned on earlier runs with this product and firmware */
+        inq = smv_inquiry_view(s->inq);
+        if (opts.profile_dir &&
+            (smd_lat_profile_name(opts.profile_dir, smv_inq_vendor(inq),
+                                  smv_inq_product(inq), smv_inq_revision(inq),
+                                  d->profile_name, sizeof(d->profile_name)) == 0)) {
+            smd_lat_load(&s->dev, d->profile_name);
+            s->dev.adaptive = 1;
+        }
+        return drive_next(d);
+    }
+
+    out = s->out;
+    if (0 == d->mu)
+        fprintf(out, "\n  %s %s\n", d->name, cmd_names[opts.cmds[d->cmd]]);
+    switch (opts.cmds[d->cmd]) {
+    case cmd_ident:
+        if (smo_ident(s) < 0) {
+            d->failed++;
+            break;
+        }
+        smo_print_ident(s);
+        break;
+    case cmd_info:
+        smo_print_info(s);
+        break;
+    case cmd_scan:
+        if (0 == d->mu)
+            d->mu_ok = 0;
+        if ((res = smo_scan_mu(s, d->mu)) < 0) {
+            d->failed++;
+            break;
+        }
+        d->mu_ok += res;
+        if (++d->mu < s->geom.total_mu)
+            return sms_next_bulk;
+        s->scanned = 1;
+        smo_print_scan(s);
+        if (d->mu_ok < (int)s->geom.total_mu) {
+            fprintf(out, "%d of %u MUs not read completely\n",
+                    (int)s->geom.total_mu - d->mu_ok, s->geom.total_mu);
+            d->failed++;
+        }
+        if (opts.health_dir) {
+            if (smo_health_append(s, opts.health_dir) < 0) {
+                fprintf(out, "sg_SM3252: error appending health history of %s\n", d->name);
+                d->failed++;
+            }
+            else
+                fprintf(out, "Health history updated in %s\n", opts.health_dir);
+        }
+        if (opts.board) {
+            smo_health_scan(s, serial, &scan);
+            if (smb_publish(opts.board, serial, &scan) < 0) {
+                fprintf(out, "sg_SM3252: results board %s, %s not published\n",
+                        (EBUSY == errno) ? "slot busy" : "full", d->name);
+                d->failed++;
+            }
+        }
+        break;
+    case cmd_led:
+        res = smo_led_config(s);
+        if ((res < 0) || (res == smo_led_failed))
+            d->failed++;
+        break;
+    case cmd_erase:
+        if (0 == d->mu)
+            d->mu_ok = 0;
+        if ((res = smo_erase_mu(s, d->mu)) < 0) {
+            d->failed++;
+            break;
+        }
+        d->mu_ok += res;
+        if (++d->mu < s->geom.total_mu)
+            return sms_next_bulk;
+        if (d->mu_ok > 0) {
+            fprintf(out, "%d of the sampled blocks not erased\n", d->mu_ok);
+            d->failed++;
+        }
+        break;
+    case cmd_dump:
+        if (smo_read_cid(s) < 0) {
+            d->failed++;
+            break;
+        }
+        smo_print_cid(s);
+        break;
+    }
+    d->mu = 0;
+    d->cmd++;
+    return drive_next(d);
+}
+
+int main(int argc, char * argv[])
+{
+    int k, res, n_workers = 0, bulk_limit = 0, adaptive = 0, discover = 0, bad = 0;
+    int n_found = 0;
+    unsigned int n_drives = 0, n_groups = 1, i, g, failed = 0;
+    struct drive * drives, * more;
+    char ** found = NULL;
+    struct sms_job * jobs;
+    struct sms_group * groups;
+    struct smm_drive * metrics = NULL;
+    char * board_name = NULL;
+    char * controller_file = NULL;
+    unsigned int line;
+    char ebuff[EBUFF_SZ];
+    char ** hubs;
+    char hub[PATH_MAX];
+    struct sms_stats stats;
+
+    opts.max_retries = -1;
+    drives = calloc(argc, sizeof(*drives));
+    if (NULL == drives) {
+        printf("sg_SM3252: out of memory\n");
+        return 1;
+    }
+    for (k = 1; k < argc; ++k) {
+        if (0 == strcmp("-A", argv[k]))
+            discover = 1;
+        else if ((0 == strcmp("-C", argv[k])) && (k + 1 < argc))
+            controller_file = argv[++k];
+        else if (0 == strcmp("-E", argv[k]))
+            opts.vendor_erase = 1;
+        else if ((0 == strcmp("-H", argv[k])) && (k + 1 < argc))
+            opts.health_dir = argv[++k];
+        else if ((0 == strcmp("-j", argv[k])) && (k + 1 < argc))
+            n_workers = atoi(argv[++k]);
+        else if ((0 == strcmp("-P", argv[k])) && (k + 1 < argc)) {
+            if (0 == strcmp("auto", argv[++k]))
+                adaptive = 1;
+            else
+                bulk_limit = atoi(argv[k]);
+        }
+        else if ((0 == strcmp("-M", argv[k])) && (k + 1 < argc))
+            opts.metrics_file = argv[++k];
+        else if ((0 == strcmp("-S", argv[k])) && (k + 1 < argc))
+            board_name = argv[++k];
+        else if ((0 == strcmp("-R", argv[k])) && (k + 1 < argc))
+            opts.max_retries = atoi(argv[++k]);
+        else if ((0 == strcmp("-T", argv[k])) && (k + 1 < argc))
+            opts.profile_dir = argv[++k];
+        else if ((0 == strcmp("-t", argv[k])) && (k + 1 < argc))
+            opts.trace_file = argv[++k];
+        else if ((0 == strcmp("-W", argv[k])) && (k + 1 < argc))
+            opts.probe_window = (unsigned int)atoi(argv[++k]);
+        else if (*argv[k] == '-') {
+            printf("Unrecognized switch: %s\n", argv[k]);
+            bad = 1;
+            break;
+        }
+        else if ((res = cmd_lookup(argv[k])) >= 0) {
+            if (opts.n_cmds >= MAX_CMDS) {
+                printf("too many commands\n");
+                bad = 1;
+                break;
+            }
+            opts.cmds[opts.n_cmds++] = res;
+        }
+        else if (opts.n_cmds > 0) {
+            printf("Unknown command: %s\n", argv[k]);
+            bad = 1;
+            break;
+        }
+        else
+            drives[n_drives++].name = argv[k];
+    }
+    if (bad || ((0 == n_drives) && !discover) || (0 == opts.n_cmds) || (bulk_limit < 0)) {
+        usage();
+        free(drives);
+        return 1;
+    }
+    opts.ident_only = 1;
+    for (i=0; i<opts.n_cmds; i++) {
+        if (opts.cmds[i] != cmd_ident)
+            opts.ident_only = 0;
+    }
+    /* What -A finds is any sg device on USB, not only SM3252 modules:
+       nothing but the read only ident is sent to those */
+    if (discover && !opts.ident_only) {
+        printf("sg_SM3252: -A only runs the ident command\n");
+        free(drives);
+        return 1;
+    }
+    if (discover) {
+        if ((n_found = smt_usb_sg_devices(&found)) < 0) {
+            perror("sg_SM3252: error listing /sys/class/scsi_generic");
+            free(drives);
+            return 1;
+        }
+        if ((more = realloc(drives, (n_drives + n_found + 1) * sizeof(*drives))) == NULL) {
+            printf("sg_SM3252: out of memory\n");
+            free(drives);
+            return 1;
+        }
+        drives = more;
+        memset(drives + n_drives, 0, (n_found + 1) * sizeof(*drives));
+        for (k = 0; k < n_found; k++)
+            drives[n_drives++].name = found[k];
+        if (0 == n_drives) {
+            printf("sg_SM3252: no sg devices on USB\n");
+            free(drives);
+            return 1;
+        }
+    }
+    n_drives = drive_dedup(drives, n_drives);
+    if (controller_file && (smp_load(controller_file, &line) < 0)) {
+        if ((EINVAL == errno) && line)
+            printf("sg_SM3252: %s line %u is not a controller profile\n",
+                   controller_file, line);
+        else if (EINVAL == errno)
+            printf("sg_SM3252: no controller profile in %s\n", controller_file);
+        else {
+            snprintf(ebuff, EBUFF_SZ, "sg_SM3252: error reading %s", controller_file);
+            perror(ebuff);
+        }
+        free(drives);
+        return 1;
+    }
+    if (board_name && ((opts.board = smb_open(board_name, 1)) == NULL)) {
+        snprintf(ebuff, EBUFF_SZ, "sg_SM3252: error opening results board %s", board_name);
+        perror(ebuff);
+        free(drives);
+        return 1;
+    }
+    if (n_workers <= 0)
+        n_workers = n_drives;
+    opts.buffered = (n_drives > 1);
+    if (opts.trace_file)
+        smtr_start_file(opts.trace_file);
+
+    /* Group 0 holds the drives not found on a USB hub */
+    jobs = calloc(n_drives, sizeof(*jobs));
+    groups = calloc(n_drives + 1, sizeof(*groups));
+    hubs = calloc(n_drives + 1, sizeof(*hubs));
+    if (opts.metrics_file)
+        metrics = calloc(n_drives, sizeof(*metrics));
+    if ((NULL == jobs) || (NULL == groups) || (NULL == hubs) ||
+        (opts.metrics_file && (NULL == metrics))) {
+        printf("sg_SM3252: out of memory\n");
+        free(metrics);
+        free(jobs);
+        free(groups);
+        free(hubs);
+        free(drives);
+        return 1;
+    }
+    for (i=0; i<n_drives; i++) {
+        jobs[i].arg = &drives[i];
+        if (metrics)
+            drives[i].metrics = &metrics[i];
+        jobs[i].step = drive_step;
+        jobs[i].bytes = &drives[i].s.dev.stats.bytes;
+        jobs[i].group = 0;
+        if (smt_usb_hub(drives[i].name, hub, sizeof(hub)) == 0) {
+            for (g=1; (g<n_groups) && strcmp(hubs[g], hub); g++)
+                ;
+            if ((g == n_groups) && ((hubs[g] = strdup(hub)) != NULL))
+                n_groups++;
+            if (g < n_groups)
+                jobs[i].group = g;
+        }
+        if (smo_open(&drives[i].s, drives[i].name) < 0) {
+            drives[i].failed++;
+            /* Never opened, so drive_finish() won't render it: the
+               failure still goes into the metrics, under its device */
+            if (drives[i].metrics &&
+                (smm_render_drive(drives[i].metrics, &drives[i].s, 1) < 0))
+                printf("sg_SM3252: out of memory for the metrics of %s\n", drives[i].name);
+            jobs[i].next = sms_done;
+            continue;
+        }
+        drives[i].opened = 1;
+        smtr_name(drives[i].s.dev.fd, drives[i].name);
+        drives[i].s.dev.max_retries = opts.max_retries;
+        drives[i].s.probe_window = opts.probe_window;
+        if (opts.vendor_erase)
+            drives[i].s.erase_method = smo_erase_vendor;
+        if (opts.buffered &&
+            ((drives[i].s.out = open_memstream(&drives[i].report,
+                                               &drives[i].report_len)) == NULL))
+            drives[i].s.out = stdout;
+        jobs[i].next = sms_next_step;
+    }
+    if (opts.buffered) {
+        /* A drive that couldn't get a report buffer prints as it goes */
+        for (i=0; i<n_drives; i++) {
+            if (drives[i].opened && (drives[i].s.out == stdout)) {
+                opts.buffered = 0;
+                break;
+            }
+        }
+        if (!opts.buffered) {
+            for (i=0; i<n_drives; i++) {
+                if (drives[i].opened && (drives[i].s.out != stdout)) {
+                    fclose(drives[i].s.out);
+                    free(drives[i].report);
+                    drives[i].report = NULL;
+                    drives[i].s.out = stdout;
+                }
+            }
+        }
+    }
+
+    for (g=0; g<n_groups; g++) {
+        groups[g].limit = bulk_limit;
+        groups[g].adaptive = adaptive;
+    }
+    if (sms_run(jobs, n_drives, groups, n_groups, n_workers, &stats) < 0) {
+        printf("sg_SM3252: out of memory for the scheduler\n");
+        for (i=0; i<n_drives; i++) {
+            /* Failed first, drive_finish() renders the metrics */
+            drives[i].failed++;
+            drive_finish(&drives[i]);
+        }
+    }
+
+    if (n_drives > 1) {
+        printf("\n%u drives, %lu steps on %u workers, %lu stolen\n",
+               n_drives, stats.steps, stats.workers, stats.steals);
+        for (g=0; g<n_groups; g++) {
+            if (0 == groups[g].jobs)
+                continue;
+            printf("  hub %-14s %u drives, %lu scan/erase steps, %lu held back",
+                   g ? smt_hub_name(hubs[g]) : "(not USB)", groups[g].jobs,
+                   groups[g].bulk_steps, groups[g].held);
+            if (adaptive)
+                printf(", settled at %u at once, %.2f MB/s",
+                       groups[g].best_limit, groups[g].best_rate / 1e6);
+            printf("\n");
+        }
+        for (i=0; i<n_drives; i++)
+            printf("  %-20s %s\n", drives[i].name, drives[i].failed ? "FAILED" : "ok");
+    }
+    for (i=0; i<n_drives; i++)
+        failed += (drives[i].failed > 0);
+    if (metrics) {
+        if (smm_write(opts.metrics_file, metrics, n_drives) < 0) {
+            perror("sg_SM3252: error writing the metrics file");
+            failed++;
+        }
+        for (i=0; i<n_drives; i++)
+            smm_drive_release(&metrics[i]);
+        free(metrics);
+    }
+    for (g=1; g<n_groups; g++)
+        free(hubs[g]);
+    free(hubs);
+    free(groups);
+    free(jobs);
+    free(drives);
+    for (k = 0; k < n_found; k++)
+        free(found[k]);
+    free(found);
+    smb_close(opts.board);
+    return failed ? 1 : 0;
+}
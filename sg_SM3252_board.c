@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sg_SM3252_board.h"
+
+/* Results board in shared memory, see sg_SM3252_board.h */
+
+static int smb_reclaim(struct smb_slot * s);
+
+struct smb_board * smb_open(const char * name, int create)
+{
+    struct smb_board * b;
+    struct stat st;
+    unsigned int i;
+    int fd, err;
+
+    if ((fd = shm_open(name, create ? (O_RDWR | O_CREAT) : O_RDWR, 0644)) < 0)
+        return NULL;
+    if ((fstat(fd, &st) < 0) ||
+        (create && (st.st_size < (off_t)sizeof(*b)) &&
+         (ftruncate(fd, sizeof(*b)) < 0))) {
+        err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    if (!create && (st.st_size < (off_t)sizeof(*b))) {
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+    b = mmap(NULL, sizeof(*b), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    err = errno;
+    close(fd);
+    if (MAP_FAILED == b) {
+        errno = err;
+        return NULL;
+    }
+    /* A new segment is all zeroes; whoever gets here first with it fills
+       in the header, the same values in any case */
+    if (create && (0 == b->magic)) {
+        b->version = SMB_VERSION;
+        b->n_slots = SMB_SLOTS;
+        b->slot_size = sizeof(struct smb_slot);
+        __sync_synchronize();
+        b->magic = SMB_MAGIC;
+    }
+    if ((b->magic != SMB_MAGIC) || (b->version != SMB_VERSION) ||
+        (b->n_slots != SMB_SLOTS) || (b->slot_size != sizeof(struct smb_slot))) {
+        munmap(b, sizeof(*b));
+        errno = EPROTO;
+        return NULL;
+    }
+    for (i = 0; i < SMB_SLOTS; i++)
+        smb_reclaim(&b->slot[i]);
+    return b;
+}
+
+void smb_close(struct smb_board * b)
+{
+    if (b)
+        munmap(b, sizeof(*b));
+}
+
+/* Milliseconds since the first call, which zeroed 'since' */
+static long smb_waited(struct timespec * since)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((0 == since->tv_sec) && (0 == since->tv_nsec)) {
+        *since = now;
+        return 0;
+    }
+    sched_yield();
+    return (now.tv_sec - since->tv_sec) * 1000 +
+           (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/* Take over slot 's' when the process in 'writer' is gone.  When it
+   died claiming the slot or with 'seq' odd the scan there is torn: it is
+   dropped and the slot freed.  Returns 1 when the slot was taken over. */
+static int smb_reclaim(struct smb_slot * s)
+{
+    uint32_t pid = s->writer;
+
+    if ((0 == pid) || (kill((pid_t)pid, 0) == 0) || (errno != ESRCH) ||
+        !__sync_bool_compare_and_swap(&s->writer, pid, (uint32_t)getpid()))
+        return 0;
+    if ((s->seq & 1) || (smb_claimed == s->state)) {
+        s->state = smb_claimed;
+        __sync_synchronize();
+        memset(s->serial, 0, sizeof(s->serial));
+        memset(&s->scan, 0, sizeof(s->scan));
+        s->scans = 0;
+        __sync_synchronize();
+        if (s->seq & 1)
+            s->seq++;
+        s->writer = 0;
+        __sync_synchronize();
+        s->state = smb_free;
+    }
+    else
+        s->writer = 0;
+    return 1;
+}
+
+/* The slot of 'serial', or a free one claimed for it */
+static struct smb_slot * smb_slot_of(struct smb_board * b, const char * serial)
+{
+    struct smb_slot * s;
+    unsigned int i;
+
+    for (i = 0; i < SMB_SLOTS; i++) {
+        s = &b->slot[i];
+        if ((smb_used == s->state) && (0 == strcmp(s->serial, serial)))
+            return s;
+    }
+    for (i = 0; i < SMB_SLOTS; i++) {
+        s = &b->slot[i];
+        if (__sync_bool_compare_and_swap(&s->state, smb_free, smb_claimed)) {
+            s->writer = getpid();
+            snprintf(s->serial, sizeof(s->serial), "%s", serial);
+            __sync_synchronize();
+            s->state = smb_used;
+            s->writer = 0;
+            return s;
+        }
+    }
+    errno = ENOSPC;
+    return NULL;
+}
+
+int smb_publish(struct smb_board * b, const char * serial,
+                const struct smh_scan * scan)
+{
+    struct smb_slot * s;
+    struct timespec since = {0, 0};
+    uint32_t seq;
+
+    for (;;) {
+        if ((s = smb_slot_of(b, serial)) == NULL)
+            return -1;
+        /* 'writer' keeps out a second publisher of the same module; the
+           slot may have been reclaimed in the meantime */
+        if (__sync_bool_compare_and_swap(&s->writer, 0, (uint32_t)getpid())) {
+            if ((smb_used == s->state) && (0 == strcmp(s->serial, serial)))
+                break;
+            s->writer = 0;
+        }
+        else if (smb_waited(&since) >= SMB_BUSY_MS) {
+            if (!smb_reclaim(s)) {
+                errno = EBUSY;
+                return -1;
+            }
+            since.tv_sec = since.tv_nsec = 0;
+        }
+    }
+    seq = s->seq;
+    s->seq = seq + 1;
+    __sync_synchronize();
+    memcpy(&s->scan, scan, sizeof(s->scan));
+    s->scans++;
+    __sync_synchronize();
+    s->seq = seq + 2;
+    __sync_synchronize();
+    s->writer = 0;
+    return s - b->slot;
+}
+
+int smb_read(struct smb_board * b, unsigned int i, char * serial,
+             struct smh_scan * scan)
+{
+    struct smb_slot * s;
+    struct timespec since = {0, 0};
+    uint32_t seq;
+
+    if (i >= SMB_SLOTS)
+        return 0;
+    s = &b->slot[i];
+    for (;;) {
+        if (s->state != smb_used)
+            return 0;
+        seq = s->seq;
+        if (seq & 1) {
+            if (smb_waited(&since) < SMB_BUSY_MS)
+                continue;
+            if (!smb_reclaim(s)) {
+                errno = EBUSY;
+                return -1;
+            }
+            since.tv_sec = since.tv_nsec = 0;
+            continue;
+        }
+        __sync_synchronize();
+        memcpy(serial, s->serial, sizeof(s->serial));
+        memcpy(scan, &s->scan, sizeof(*scan));
+        __sync_synchronize();
+        if (s->seq == seq)
+            break;
+    }
+    return (seq != 0);
+}
@@ -0,0 +1,76 @@
+#ifndef SG_SM3252_BOARD_H
+#define SG_SM3252_BOARD_H
+
+#include <stdint.h>
+#include "sg_SM3252_health.h"
+
+/* Results board: the latest scan of each module in a POSIX shared memory
+   segment, for agents on the same host.
+
+   A slot per module holds its serial number and the counters of STEP 5
+   and STEP 6, in the same struct smh_scan the health history stores.
+   Slots are claimed with a compare and swap on 'state', so the tools can
+   publish from several processes and threads at once, and every slot is
+   a seqlock: the publisher makes 'seq' odd, writes the scan and makes it
+   even again.  A reader copies the slot and keeps it when 'seq' was even
+   and the same before and after the copy, so it gets a consistent scan
+   without a lock, and after smb_open() without a single system call.
+
+   A publisher that dies with 'seq' odd (or a slot claimed) would leave
+   the others spinning on it for good, so the pid of the publisher is
+   kept in 'writer' while it holds the slot.  Nobody waits on a slot for
+   more than SMB_BUSY_MS: then a slot whose writer is gone is reclaimed
+   (its torn scan dropped and the slot freed), and one whose writer is
+   still alive is reported busy.  smb_open() reclaims whatever dead
+   publishers left behind.
+
+   A reader in another language maps /dev/shm/<name> and follows the same
+   protocol over the layout below; SMB_MAGIC and SMB_VERSION in the
+   header tell it the layout is the one it expects. */
+
+#define SMB_MAGIC       0x534D3342
+#define SMB_VERSION     2
+#define SMB_SLOTS       128
+#define SMB_DEFAULT_NAME    "/sg_SM3252"
+#define SMB_BUSY_MS     100         /* longest wait on another publisher */
+
+enum smb_state {smb_free, smb_claimed, smb_used};
+
+struct smb_slot {
+    volatile uint32_t state;        /* enum smb_state */
+    volatile uint32_t seq;          /* odd while the slot is written */
+    volatile uint32_t writer;       /* pid claiming or writing the slot, or 0 */
+    char serial[SMH_SERIAL_LEN + 1];
+    uint32_t scans;                 /* published since the segment was made */
+    struct smh_scan scan;
+};
+
+struct smb_board {
+    volatile uint32_t magic;        /* set last, once the header is valid */
+    uint32_t version;
+    uint32_t n_slots;
+    uint32_t slot_size;
+    struct smb_slot slot[SMB_SLOTS];
+};
+
+/* Map the board 'name' (e.g. SMB_DEFAULT_NAME), creating it when
+   'create' is set.  Returns NULL with errno set, EPROTO when the segment
+   holds another layout. */
+extern struct smb_board * smb_open(const char * name, int create);
+
+extern void smb_close(struct smb_board * b);
+
+/* Publish the scan of 'serial', in its slot or a free one.  Returns the
+   slot, or -1 with errno ENOSPC when all slots are taken, or EBUSY when
+   another publisher held the slot for SMB_BUSY_MS. */
+extern int smb_publish(struct smb_board * b, const char * serial,
+                       const struct smh_scan * scan);
+
+/* Consistent copy of slot 'i'; 'serial' has room for SMH_SERIAL_LEN + 1
+   characters.  Returns 1, 0 when nothing was published there yet (or a
+   torn scan was dropped), or -1 with errno EBUSY when a live publisher
+   held the slot for SMB_BUSY_MS. */
+extern int smb_read(struct smb_board * b, unsigned int i,
+                    char * serial, struct smh_scan * scan);
+
+#endif
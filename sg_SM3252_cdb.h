@@ -0,0 +1,81 @@
+#ifndef SG_SM3252_CDB_H
+#define SG_SM3252_CDB_H
+
+#include <stdint.h>
+
+/* Field packers for the command blocks the SM3252 tools patch per command,
+   and loads for the big endian fields of the replies.  They are static
+   inline byte stores and shifts, so building a command in the STEP 5 and
+   write sweep loops costs a few stores, with no staging array, memcpy or
+   punned (and possibly unaligned) integer load. */
+
+static inline void smc_put_be16(unsigned char * p, unsigned int v)
+{
+    p[0] = (v >> 8) & 0xFF;
+    p[1] = v & 0xFF;
+}
+
+static inline void smc_put_be32(unsigned char * p, uint32_t v)
+{
+    p[0] = (v >> 24) & 0xFF;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+static inline unsigned int smc_get_be16(const unsigned char * p)
+{
+    return ((unsigned int)p[0] << 8) | p[1];
+}
+
+static inline uint32_t smc_get_be32(const unsigned char * p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline unsigned int smc_get_le16(const unsigned char * p)
+{
+    return p[0] | ((unsigned int)p[1] << 8);
+}
+
+/* 0xF0 0x0A: system block of flash block 'fblk' (10 bits) of 'mu' */
+static inline void smc_bad_block_probe(unsigned char * cdb, unsigned int fblk,
+                                       unsigned int mu)
+{
+    smc_put_be16(cdb + 2, fblk & 0x3FF);
+    cdb[6] = mu & 0xFF;
+}
+
+/* READ(10) */
+static inline void smc_read10_lba(unsigned char * cdb, uint32_t lba)
+{
+    smc_put_be32(cdb + 2, lba);
+}
+
+/* READ(16), WRITE(16) and WRITE SAME(16); the modules are far below 2^32
+   blocks, so the high half of the LBA stays 0 */
+static inline void smc_rw16_lba(unsigned char * cdb, uint32_t lba)
+{
+    smc_put_be32(cdb + 6, lba);
+}
+
+static inline void smc_rw16(unsigned char * cdb, uint32_t lba, uint32_t nblk)
+{
+    smc_put_be32(cdb + 2, 0);
+    smc_put_be32(cdb + 6, lba);
+    smc_put_be32(cdb + 10, nblk);
+}
+
+/* READ CAPACITY(10) reply */
+static inline uint32_t smc_readcap_last_lba(const unsigned char * reply)
+{
+    return smc_get_be32(reply);
+}
+
+static inline uint32_t smc_readcap_block_size(const unsigned char * reply)
+{
+    return smc_get_be32(reply + 4);
+}
+
+#endif
@@ -0,0 +1,1001 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "sg_SM3252_dev.h"
+#include "sg_SM3252_cdb.h"
+#include "sg_SM3252_trace.h"
+
+/* Per-device state shared by the SM3252 tools, see sg_SM3252_dev.h */
+
+#define SMD_ALIGN       8
+#define SMD_ROUND(n)    (((n) + SMD_ALIGN - 1) & ~(size_t)(SMD_ALIGN - 1))
+#define SMD_MU_COLUMNS  5
+
+#define SMD_BACKOFF_MAX 2000        /* millisecs */
+
+/* Retry policy of one opcode; subop -1 matches any second CDB byte */
+struct smd_policy {
+    int opcode;
+    int subop;
+    int max_retries;
+    unsigned int backoff;           /* millisecs before the first retry */
+    unsigned int timeout_max;       /* millisecs a timeout may grow to */
+    int did_error_ok;
+};
+
+/* The bad block probe is issued up to 1024 times per MU, so it gets a
+   single quick retry.  DID_ERROR on WRITE(16) is how these bridges report
+   some completed writes.  A reset is never repeated. */
+static const struct smd_policy smd_policies[] = {
+    {0xF0, 0x0A, 1,  20,  40000, 0},   /* bad block probe */
+    {0xF0, 0x0C, 1, 500, 240000, 0},   /* vendor erase */
+    {0xF0, 0x2C, 0,   0,  20000, 0},   /* reset */
+    {0x8A,   -1, 2,  50,  60000, 1},   /* WRITE(16) */
+    {  -1,   -1, 3,  50,  60000, 0},   /* everything else */
+};
+
+static const struct smd_policy * smd_policy_find(const unsigned char * cdb)
+{
+    const struct smd_policy * p;
+
+    for (p = smd_policies; p->opcode >= 0; p++) {
+        if ((p->opcode == cdb[0]) && ((p->subop < 0) || (p->subop == cdb[1])))
+            break;
+    }
+    return p;
+}
+
+int smd_arena_init(struct smd_arena * a, size_t size)
+{
+    a->used = 0;
+    a->size = SMD_ROUND(size);
+    a->base = calloc(1, a->size ? a->size : SMD_ALIGN);
+    if (NULL == a->base) {
+        a->size = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void * smd_arena_alloc(struct smd_arena * a, size_t n)
+{
+    void * p;
+
+    n = SMD_ROUND(n);
+    if ((NULL == a->base) || (n > a->size - a->used))
+        return NULL;
+    p = a->base + a->used;
+    a->used += n;
+    return p;
+}
+
+void smd_arena_release(struct smd_arena * a)
+{
+    free(a->base);
+    a->base = NULL;
+    a->size = 0;
+    a->used = 0;
+}
+
+int smd_geometry_decode(const unsigned char * basic_info,
+                        struct smd_geometry * g)
+{
+    unsigned int total_mu, total_lba;
+
+    memset(g, 0, sizeof(*g));
+    total_mu  = basic_info[1];
+    total_lba = smc_get_be32(&basic_info[0x14]);
+    if ((0 == total_mu) || (total_lba < total_mu))
+        return -1;
+    g->total_mu = total_mu;
+    g->total_lba = total_lba;
+    g->lba_per_mu = total_lba / total_mu;
+    g->half_lba_per_mu = g->lba_per_mu / 2;
+    return 0;
+}
+
+size_t smd_mu_table_size(unsigned int count)
+{
+    return SMD_MU_COLUMNS * SMD_ROUND(count * sizeof(unsigned short));
+}
+
+int smd_mu_table_alloc(struct smd_arena * a, unsigned int count,
+                       struct smd_mu_table * t)
+{
+    size_t col = count * sizeof(unsigned short);
+
+    memset(t, 0, sizeof(*t));
+    if ((0 == count) || (count > SMD_MAX_MU) ||
+        (smd_mu_table_size(count) > a->size - a->used))
+        return -1;
+    t->count = count;
+    t->current_badblock   = smd_arena_alloc(a, col);
+    t->initial_badblock   = smd_arena_alloc(a, col);
+    t->total_datablock    = smd_arena_alloc(a, col);
+    t->initial_spareblock = smd_arena_alloc(a, col);
+    t->current_spareblock = smd_arena_alloc(a, col);
+    return 0;
+}
+
+/* Size class of a transfer of 'len' bytes */
+static unsigned int smd_lat_size(unsigned int len)
+{
+    unsigned int s;
+
+    if (0 == len)
+        return 0;
+    for (s = 1; (s < SMD_LAT_SIZES - 1) && (smd_lat_size_max(s) < len); s++)
+        ;
+    return s;
+}
+
+unsigned int smd_lat_size_max(unsigned int s)
+{
+    return s ? (512U << (s - 1)) : 0;
+}
+
+/* Vendor specific opcodes carry the actual command in byte 1 */
+static struct smd_latency * smd_lat_find(const struct smd_dev * dev,
+                                         unsigned char opcode,
+                                         unsigned char subop,
+                                         unsigned int size)
+{
+    unsigned int i;
+
+    if (opcode < 0xC0)
+        subop = 0;
+    for (i = 0; i < dev->n_lat; i++) {
+        if ((dev->lat[i].opcode == opcode) && (dev->lat[i].subop == subop) &&
+            (dev->lat[i].size == size))
+            return (struct smd_latency *)&dev->lat[i];
+    }
+    return NULL;
+}
+
+static struct smd_latency * smd_lat_get(struct smd_dev * dev,
+                                        unsigned char opcode,
+                                        unsigned char subop,
+                                        unsigned int size)
+{
+    struct smd_latency * l = smd_lat_find(dev, opcode, subop, size);
+
+    if ((NULL == l) && (dev->n_lat < SMD_LAT_KEYS)) {
+        l = &dev->lat[dev->n_lat++];
+        memset(l, 0, sizeof(*l));
+        l->opcode = opcode;
+        l->subop = (opcode < 0xC0) ? 0 : subop;
+        l->size = size;
+    }
+    return l;
+}
+
+static unsigned int smd_lat_bucket(unsigned int ms)
+{
+    unsigned int e = 3, b;
+
+    if (ms < 8)
+        return ms;
+    while ((ms >> (e + 1)) != 0)
+        e++;
+    b = 8 + (e - 3) * 4 + ((ms >> (e - 2)) & 3);
+    return (b < SMD_LAT_BUCKETS) ? b : SMD_LAT_BUCKETS - 1;
+}
+
+unsigned int smd_lat_bucket_max(unsigned int b)
+{
+    unsigned int e;
+
+    if (b < 8)
+        return b;
+    e = (b - 8) / 4 + 3;
+    return ((4 + (b - 8) % 4 + 1) << (e - 2)) - 1;
+}
+
+static void smd_lat_add(struct smd_dev * dev, const unsigned char * cdb,
+                        unsigned int len, unsigned int ms)
+{
+    struct smd_latency * l = smd_lat_get(dev, cdb[0], cdb[1], smd_lat_size(len));
+    unsigned int b = smd_lat_bucket(ms);
+
+    if (l) {
+        l->hist[b]++;
+        l->count++;
+        l->run_hist[b]++;
+        l->run_count++;
+        l->run_ms += ms;
+    }
+}
+
+static unsigned int smd_lat_p99(const struct smd_latency * l)
+{
+    unsigned int b, sum = 0, rank = l->count - l->count / 100;
+
+    for (b = 0; b < SMD_LAT_BUCKETS; b++) {
+        sum += l->hist[b];
+        if (sum >= rank)
+            break;
+    }
+    return smd_lat_bucket_max((b < SMD_LAT_BUCKETS) ? b : SMD_LAT_BUCKETS - 1);
+}
+
+unsigned int smd_lat_timeout(const struct smd_dev * dev,
+                             const unsigned char * cdb, unsigned int dxfer_len,
+                             unsigned int dflt)
+{
+    const struct smd_latency * l;
+    unsigned int t;
+
+    if (!dev->adaptive)
+        return dflt;
+    l = smd_lat_find(dev, cdb[0], cdb[1], smd_lat_size(dxfer_len));
+    if ((NULL == l) || (l->count < SMD_LAT_MIN_SAMPLES))
+        return dflt;
+    t = smd_lat_p99(l) * SMD_LAT_FACTOR;
+    if (t < SMD_LAT_FLOOR)
+        t = SMD_LAT_FLOOR;
+    return (t < dflt) ? t : dflt;
+}
+
+int smd_lat_profile_name(const char * dir, const unsigned char * vendor,
+                         const unsigned char * product,
+                         const unsigned char * revision,
+                         char * name, int name_len)
+{
+    const unsigned char * field[3] = {vendor, product, revision};
+    const int field_len[3] = {8, 16, 4};
+    char key[8 + 16 + 4 + 3];
+    int f, i, j = 0;
+
+    for (f = 0; f < 3; f++) {
+        if (f)
+            key[j++] = '_';
+        for (i = 0; i < field_len[f]; i++) {
+            if (((field[f][i] >= '0') && (field[f][i] <= '9')) ||
+                ((field[f][i] >= 'A') && (field[f][i] <= 'Z')) ||
+                ((field[f][i] >= 'a') && (field[f][i] <= 'z')) ||
+                (field[f][i] == '-') || (field[f][i] == '.'))
+                key[j++] = field[f][i];
+        }
+    }
+    key[j] = '\0';
+    if (snprintf(name, name_len, "%s/%s.lat", dir, key) >= name_len)
+        return -1;
+    return 0;
+}
+
+/* Text file, one line per opcode and size class:
+       <opcode> <subop> s<size> <bucket>:<count> ...
+   Old samples are scaled down on load so a profile adapts to drifting
+   firmware instead of being frozen by years of history. */
+int smd_lat_load(struct smd_dev * dev, const char * name)
+{
+    struct smd_latency * l;
+    unsigned int opcode, subop, size, b, n, i;
+    int c;
+    FILE * fp;
+
+    if ((fp = fopen(name, "r")) == NULL)
+        return -1;
+    while (fscanf(fp, "%x %x s%u", &opcode, &subop, &size) == 3) {
+        l = NULL;
+        if (size < SMD_LAT_SIZES)
+            l = smd_lat_get(dev, (unsigned char)opcode, (unsigned char)subop, size);
+        while (fscanf(fp, "%u:%u", &b, &n) == 2) {
+            if (l && (b < SMD_LAT_BUCKETS)) {
+                l->hist[b] += n;
+                l->count += n;
+            }
+            while (((c = getc(fp)) == ' ') || (c == '\t'))
+                ;
+            if ((c == '\n') || (c == EOF))
+                break;
+            ungetc(c, fp);
+        }
+        while (l && (l->count > SMD_LAT_HISTORY)) {
+            l->count = 0;
+            for (i = 0; i < SMD_LAT_BUCKETS; i++) {
+                l->hist[i] /= 2;
+                l->count += l->hist[i];
+            }
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+int smd_lat_save(const struct smd_dev * dev, const char * name)
+{
+    char tmp_name[512];
+    unsigned int i, b;
+    FILE * fp;
+
+    if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", name) >= (int)sizeof(tmp_name)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if ((fp = fopen(tmp_name, "w")) == NULL)
+        return -1;
+    for (i = 0; i < dev->n_lat; i++) {
+        fprintf(fp, "%02X %02X s%u", dev->lat[i].opcode, dev->lat[i].subop,
+                dev->lat[i].size);
+        for (b = 0; b < SMD_LAT_BUCKETS; b++) {
+            if (dev->lat[i].hist[b])
+                fprintf(fp, " %u:%u", b, dev->lat[i].hist[b]);
+        }
+        fprintf(fp, "\n");
+    }
+    if (fclose(fp) != 0)
+        return -1;
+    return rename(tmp_name, name);
+}
+
+void smd_lat_print(const struct smd_dev * dev)
+{
+    const struct smd_latency * l;
+    unsigned char cdb[2];
+    unsigned int i;
+
+    for (i = 0; i < dev->n_lat; i++) {
+        l = &dev->lat[i];
+        cdb[0] = l->opcode;
+        cdb[1] = l->subop;
+        printf("opcode %02X %02X, up to %u bytes: %u samples, p99 %u ms, timeout %u ms\n",
+               l->opcode, l->subop, smd_lat_size_max(l->size), l->count,
+               smd_lat_p99(l),
+               smd_lat_timeout(dev, cdb, smd_lat_size_max(l->size), 0xFFFFFFFF));
+    }
+}
+
+void smd_dev_init(struct smd_dev * dev, int fd)
+{
+    memset(dev, 0, sizeof(*dev));
+    dev->fd = fd;
+    dev->max_retries = -1;
+    dev->cache = 1;
+}
+
+void smd_dev_release(struct smd_dev * dev)
+{
+    smd_cache_flush(dev);
+    dev->stats.cache_flushes = 0;
+}
+
+enum smd_cdb_kind {smd_cdb_mutates, smd_cdb_reads, smd_cdb_cacheable};
+
+/* Commands not listed here are assumed to change the module */
+static enum smd_cdb_kind smd_cdb_kind(const unsigned char * cdb)
+{
+    switch (cdb[0]) {
+    case 0x12:          /* INQUIRY */
+    case 0x25:          /* READ CAPACITY(10) */
+        return smd_cdb_cacheable;
+    case 0x28:          /* READ(10), also selects the MU for 0xF0 0xAA */
+    case 0x88:          /* READ(16) */
+        return smd_cdb_reads;
+    case 0xF0:
+        switch (cdb[1]) {
+        case 0x20:      /* basic information */
+        case 0x02:      /* CID and LED block */
+            return smd_cdb_cacheable;
+        case 0x0A:      /* system block probe */
+        case 0xAA:      /* spare blocks of the selected MU */
+            return smd_cdb_reads;
+        }
+        break;
+    }
+    return smd_cdb_mutates;
+}
+
+void smd_cache_flush(struct smd_dev * dev)
+{
+    unsigned int i;
+
+    for (i = 0; i < dev->n_cache; i++)
+        free(dev->cached[i].data);
+    if (dev->n_cache)
+        dev->stats.cache_flushes++;
+    dev->n_cache = 0;
+}
+
+static struct smd_cache_entry * smd_cache_find(struct smd_dev * dev,
+                                               const sg_io_hdr_t * io_hdr)
+{
+    unsigned int i;
+
+    for (i = 0; i < dev->n_cache; i++) {
+        if ((dev->cached[i].cdb_len == io_hdr->cmd_len) &&
+            (dev->cached[i].dxfer_len == io_hdr->dxfer_len) &&
+            (memcmp(dev->cached[i].cdb, io_hdr->cmdp, io_hdr->cmd_len) == 0))
+            return &dev->cached[i];
+    }
+    return NULL;
+}
+
+static void smd_cache_store(struct smd_dev * dev, const sg_io_hdr_t * io_hdr)
+{
+    struct smd_cache_entry * e;
+
+    if ((io_hdr->dxfer_len > SMD_CACHE_MAX_LEN) || (io_hdr->cmd_len > 16) ||
+        (smd_cache_find(dev, io_hdr) != NULL) ||
+        (dev->n_cache >= SMD_CACHE_ENTRIES))
+        return;
+    e = &dev->cached[dev->n_cache];
+    if ((e->data = malloc(io_hdr->dxfer_len ? io_hdr->dxfer_len : 1)) == NULL)
+        return;
+    memcpy(e->cdb, io_hdr->cmdp, io_hdr->cmd_len);
+    e->cdb_len = io_hdr->cmd_len;
+    e->dxfer_len = io_hdr->dxfer_len;
+    e->resid = io_hdr->resid;
+    memcpy(e->data, io_hdr->dxferp, io_hdr->dxfer_len);
+    dev->n_cache++;
+}
+
+/* Complete 'io_hdr' from the cache as the device would have */
+static int smd_cache_answer(struct smd_dev * dev, sg_io_hdr_t * io_hdr)
+{
+    const struct smd_cache_entry * e = smd_cache_find(dev, io_hdr);
+
+    if (NULL == e)
+        return 0;
+    memcpy(io_hdr->dxferp, e->data, e->dxfer_len);
+    io_hdr->status = 0;
+    io_hdr->masked_status = 0;
+    io_hdr->msg_status = 0;
+    io_hdr->host_status = 0;
+    io_hdr->driver_status = 0;
+    io_hdr->sb_len_wr = 0;
+    io_hdr->resid = e->resid;
+    io_hdr->duration = 0;
+    io_hdr->info = 0;
+    dev->stats.cache_hits++;
+    return 1;
+}
+
+enum smd_io_class smd_io_classify(const sg_io_hdr_t * io_hdr, int ioctl_res,
+                                  int ioctl_errno)
+{
+    struct smd_status st;
+    int key = -1;
+
+    if (ioctl_res < 0) {
+        if ((EINTR == ioctl_errno) || (EAGAIN == ioctl_errno) ||
+            (EBUSY == ioctl_errno) || (ENOMEM == ioctl_errno))
+            return smd_io_transient;
+        return smd_io_fatal;
+    }
+
+    switch (io_hdr->host_status) {
+    case 0x00:          /* DID_OK */
+        break;
+    case 0x03:          /* DID_TIME_OUT */
+        return smd_io_timeout;
+    case 0x02:          /* DID_BUS_BUSY */
+    case 0x05:          /* DID_ABORT */
+    case 0x07:          /* DID_ERROR */
+    case 0x08:          /* DID_RESET */
+    case 0x0B:          /* DID_SOFT_ERROR */
+    case 0x0C:          /* DID_IMM_RETRY */
+    case 0x0D:          /* DID_REQUEUE */
+    case 0x0E:          /* DID_TRANSPORT_DISRUPTED */
+        return smd_io_transient;
+    default:            /* DID_NO_CONNECT, DID_BAD_TARGET, ... */
+        return smd_io_fatal;
+    }
+
+    switch (io_hdr->driver_status & 0x0F) {
+    case 0x00:          /* DRIVER_OK */
+    case 0x08:          /* DRIVER_SENSE */
+        break;
+    case 0x02:          /* DRIVER_BUSY */
+    case 0x03:          /* DRIVER_SOFT */
+        return smd_io_transient;
+    case 0x06:          /* DRIVER_TIMEOUT */
+        return smd_io_timeout;
+    default:
+        return smd_io_fatal;
+    }
+
+    switch (io_hdr->masked_status) {
+    case 0x00:          /* GOOD */
+    case 0x02:          /* CONDITION MET */
+        if (0 == (io_hdr->driver_status & 0x08))
+            return smd_io_ok;
+        break;
+    case 0x01:          /* CHECK CONDITION */
+        break;
+    case 0x04:          /* BUSY */
+    case 0x14:          /* TASK SET FULL */
+        return smd_io_transient;
+    default:            /* RESERVATION CONFLICT, ... */
+        return smd_io_fatal;
+    }
+
+    if (smd_sense_decode(io_hdr->sbp, io_hdr->sb_len_wr, &st))
+        key = st.key;
+    switch (key) {
+    case 0x00:          /* NO SENSE */
+        return smd_io_ok;
+    case 0x01:          /* RECOVERED ERROR */
+        return smd_io_recovered;
+    case 0x02:          /* NOT READY */
+    case 0x06:          /* UNIT ATTENTION */
+    case 0x0B:          /* ABORTED COMMAND */
+        return smd_io_transient;
+    default:            /* medium, hardware, illegal request, ... */
+        return smd_io_fatal;
+    }
+}
+
+int smd_sense_decode(const unsigned char * sb, int sb_len,
+                     struct smd_status * st)
+{
+    if ((NULL == sb) || (sb_len < 3))
+        return 0;
+    switch (sb[0] & 0x7F) {
+    case 0x70:          /* fixed, current */
+    case 0x71:          /* fixed, deferred */
+        st->key = sb[2] & 0x0F;
+        st->asc = (sb_len > 12) ? sb[12] : 0;
+        st->ascq = (sb_len > 13) ? sb[13] : 0;
+        return 1;
+    case 0x72:          /* descriptor, current */
+    case 0x73:          /* descriptor, deferred */
+        st->key = sb[1] & 0x0F;
+        st->asc = sb[2];
+        st->ascq = (sb_len > 3) ? sb[3] : 0;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+void smd_status_decode(const sg_io_hdr_t * io_hdr, int ioctl_res,
+                       struct smd_status * st)
+{
+    memset(st, 0, sizeof(*st));
+    if (ioctl_res < 0) {
+        st->err = smd_err_ioctl;
+        return;
+    }
+    st->status = io_hdr->masked_status;
+    st->host = io_hdr->host_status;
+    st->driver = io_hdr->driver_status;
+    if ((0x03 == st->host) || (0x06 == (st->driver & 0x0F))) {
+        st->err = smd_err_timeout;
+        return;
+    }
+    if ((st->host != 0) ||
+        ((st->driver & 0x0F) != 0x00 && (st->driver & 0x0F) != 0x08)) {
+        st->err = smd_err_transport;
+        return;
+    }
+    if (!smd_sense_decode(io_hdr->sbp, io_hdr->sb_len_wr, st)) {
+        /* GOOD and CONDITION MET, or a status without sense data */
+        st->err = ((0x00 == st->status) || (0x02 == st->status)) ?
+                  smd_err_none : smd_err_status;
+        return;
+    }
+    switch (st->key) {
+    case 0x00:          /* NO SENSE */
+        st->err = smd_err_none;
+        break;
+    case 0x01:
+        st->err = smd_err_recovered;
+        break;
+    case 0x02:
+        st->err = smd_err_not_ready;
+        break;
+    case 0x03:
+        st->err = smd_err_medium;
+        break;
+    case 0x04:
+        st->err = smd_err_hardware;
+        break;
+    case 0x05:
+        st->err = smd_err_illegal_request;
+        break;
+    case 0x06:
+        st->err = smd_err_unit_attention;
+        break;
+    case 0x0B:
+        st->err = smd_err_aborted;
+        break;
+    default:
+        st->err = smd_err_other_sense;
+        break;
+    }
+}
+
+static const char * const smd_err_names[SMD_ERR_KINDS] = {
+    "ok", "recovered error", "not ready", "medium error", "hardware error",
+    "illegal request", "unit attention", "aborted command", "other sense",
+    "bad status", "transport error", "timeout", "ioctl error"
+};
+
+const char * smd_err_name(enum smd_err err)
+{
+    return ((unsigned int)err < SMD_ERR_KINDS) ? smd_err_names[err] : "?";
+}
+
+/* The additional sense codes these modules and their bridges report */
+static const struct {
+    unsigned char asc, ascq;
+    const char * text;
+} smd_asc_names[] = {
+    {0x04, 0x00, "not ready, cause not reportable"},
+    {0x04, 0x01, "becoming ready"},
+    {0x0C, 0x00, "write error"},
+    {0x11, 0x00, "unrecovered read error"},
+    {0x20, 0x00, "invalid command operation code"},
+    {0x21, 0x00, "LBA out of range"},
+    {0x24, 0x00, "invalid field in CDB"},
+    {0x28, 0x00, "not ready to ready change"},
+    {0x29, 0x00, "power on or reset"},
+    {0x3A, 0x00, "medium not present"},
+    {0x44, 0x00, "internal target failure"},
+};
+
+static const char * smd_asc_name(unsigned char asc, unsigned char ascq)
+{
+    unsigned int i;
+
+    for (i=0; i<sizeof(smd_asc_names)/sizeof(smd_asc_names[0]); i++) {
+        if ((smd_asc_names[i].asc == asc) && (smd_asc_names[i].ascq == ascq))
+            return smd_asc_names[i].text;
+    }
+    return NULL;
+}
+
+const char * smd_status_str(const struct smd_status * st, char * buf,
+                            int buf_len)
+{
+    const char * text;
+    int n;
+
+    switch (st->err) {
+    case smd_err_status:
+        snprintf(buf, buf_len, "%s 0x%02X", smd_err_name(st->err), st->status);
+        break;
+    case smd_err_transport:
+    case smd_err_timeout:
+        snprintf(buf, buf_len, "%s, host 0x%02X driver 0x%02X",
+                 smd_err_name(st->err), st->host, st->driver);
+        break;
+    case smd_err_none:
+    case smd_err_ioctl:
+        snprintf(buf, buf_len, "%s", smd_err_name(st->err));
+        break;
+    default:
+        n = snprintf(buf, buf_len, "%s, sense %02X/%02X/%02X",
+                     smd_err_name(st->err), st->key, st->asc, st->ascq);
+        text = smd_asc_name(st->asc, st->ascq);
+        if (text && (n >= 0) && (n < buf_len))
+            snprintf(buf + n, buf_len - n, " (%s)", text);
+        break;
+    }
+    return buf;
+}
+
+/* Count a failed or recovered attempt */
+static void smd_err_add(struct smd_err_stats * e, const struct smd_status * st)
+{
+    unsigned int i;
+
+    e->kind[st->err]++;
+    if ((0 == st->key) && (0 == st->asc) && (0 == st->ascq))
+        return;
+    for (i=0; i<e->n_codes; i++) {
+        if ((e->codes[i].key == st->key) && (e->codes[i].asc == st->asc) &&
+            (e->codes[i].ascq == st->ascq)) {
+            e->codes[i].count++;
+            return;
+        }
+    }
+    if (e->n_codes < SMD_SENSE_CODES) {
+        e->codes[e->n_codes].key = st->key;
+        e->codes[e->n_codes].asc = st->asc;
+        e->codes[e->n_codes].ascq = st->ascq;
+        e->codes[e->n_codes].count = 1;
+        e->n_codes++;
+    }
+    else
+        e->codes_other++;
+}
+
+static void smd_sleep_ms(unsigned int ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    while ((nanosleep(&ts, &ts) < 0) && (EINTR == errno))
+        ;
+}
+
+/* Latency, bytes and outcome of one completed attempt */
+static void smd_io_count(struct smd_dev * dev, const sg_io_hdr_t * io_hdr,
+                         enum smd_io_class cls)
+{
+    if ((smd_io_ok == cls) || (smd_io_recovered == cls)) {
+        smd_lat_add(dev, io_hdr->cmdp, io_hdr->dxfer_len, io_hdr->duration);
+        if ((io_hdr->resid >= 0) && ((unsigned int)io_hdr->resid < io_hdr->dxfer_len))
+            dev->stats.bytes += io_hdr->dxfer_len - io_hdr->resid;
+    }
+    switch (cls) {
+    case smd_io_ok:
+        break;
+    case smd_io_recovered:
+        dev->stats.recovered++;
+        break;
+    case smd_io_transient:
+        dev->stats.transient++;
+        break;
+    case smd_io_timeout:
+        dev->stats.timeouts++;
+        break;
+    case smd_io_fatal:
+        dev->stats.fatal++;
+        break;
+    }
+}
+
+/* DID_ERROR on an opcode whose policy accepts it counts as done */
+static enum smd_io_class smd_io_accept(struct smd_dev * dev,
+                                       const struct smd_policy * p,
+                                       const sg_io_hdr_t * io_hdr, int res,
+                                       enum smd_io_class cls)
+{
+    if ((smd_io_transient == cls) && p->did_error_ok && (res >= 0) &&
+        (SMD_DID_ERROR == io_hdr->host_status)) {
+        dev->stats.did_error_ok++;
+        cls = smd_io_ok;
+    }
+    return cls;
+}
+
+int smd_io(struct smd_dev * dev, sg_io_hdr_t * io_hdr)
+{
+    const struct smd_policy * p = smd_policy_find(io_hdr->cmdp);
+    unsigned int timeout = io_hdr->timeout, backoff = p->backoff;
+    int res, err, attempt, max_retries;
+    enum smd_io_class cls;
+    enum smd_cdb_kind kind;
+    uint64_t t_submit = 0;
+
+    kind = smd_cdb_kind(io_hdr->cmdp);
+    if (smd_cdb_mutates == kind)
+        smd_cache_flush(dev);
+    else if ((smd_cdb_cacheable == kind) && dev->cache &&
+             (SG_DXFER_FROM_DEV == io_hdr->dxfer_direction) &&
+             smd_cache_answer(dev, io_hdr)) {
+        memset(&dev->last, 0, sizeof(dev->last));
+        return 0;
+    }
+
+    max_retries = (dev->max_retries >= 0) ? dev->max_retries : p->max_retries;
+    io_hdr->timeout = smd_lat_timeout(dev, io_hdr->cmdp, io_hdr->dxfer_len, timeout);
+    for (attempt = 0; ; attempt++) {
+        dev->stats.commands++;
+        if (smtr_on)
+            t_submit = smtr_now();
+        res = ioctl(dev->fd, SG_IO, io_hdr);
+        err = errno;
+        smd_status_decode(io_hdr, res, &dev->last);
+        if (dev->last.err != smd_err_none)
+            smd_err_add(&dev->errors, &dev->last);
+        if (smtr_on)
+            smtr_record(dev->fd, io_hdr, t_submit, attempt, dev->last.err);
+        cls = smd_io_accept(dev, p, io_hdr, res, smd_io_classify(io_hdr, res, err));
+        smd_io_count(dev, io_hdr, cls);
+        if ((smd_io_ok == cls) || (smd_io_recovered == cls) ||
+            (smd_io_fatal == cls))
+            break;
+        if (attempt >= max_retries) {
+            dev->stats.fatal++;
+            break;
+        }
+
+        dev->stats.retries++;
+        if (smd_io_timeout == cls) {
+            /* A slow module, not a busy one: give it longer, no wait */
+            io_hdr->timeout = (io_hdr->timeout * 2 > p->timeout_max) ?
+                              p->timeout_max : io_hdr->timeout * 2;
+        }
+        else {
+            smd_sleep_ms(backoff);
+            backoff = (backoff * 2 > SMD_BACKOFF_MAX) ? SMD_BACKOFF_MAX : backoff * 2;
+        }
+    }
+    io_hdr->timeout = timeout;
+    if ((smd_cdb_cacheable == kind) && dev->cache &&
+        (SG_DXFER_FROM_DEV == io_hdr->dxfer_direction) &&
+        ((smd_io_ok == cls) || (smd_io_recovered == cls)))
+        smd_cache_store(dev, io_hdr);
+    errno = err;
+    return res;
+}
+
+int smd_queue_submit(struct smd_dev * dev, sg_io_hdr_t * io_hdr,
+                     uint64_t * t_submit)
+{
+    if (smd_cdb_mutates == smd_cdb_kind(io_hdr->cmdp))
+        smd_cache_flush(dev);
+    io_hdr->flags |= SG_FLAG_Q_AT_TAIL;
+    io_hdr->timeout = smd_lat_timeout(dev, io_hdr->cmdp, io_hdr->dxfer_len,
+                                      io_hdr->timeout);
+    *t_submit = smtr_on ? smtr_now() : 0;
+    if (write(dev->fd, io_hdr, sizeof(*io_hdr)) < 0)
+        return -1;
+    dev->stats.commands++;
+    return 0;
+}
+
+int smd_queue_read(struct smd_dev * dev, sg_io_hdr_t * io_hdr)
+{
+    int res;
+
+    while (((res = read(dev->fd, io_hdr, sizeof(*io_hdr))) < 0) && (EINTR == errno))
+        ;
+    return res;
+}
+
+enum smd_io_class smd_queue_done(struct smd_dev * dev, const sg_io_hdr_t * io_hdr,
+                                 uint64_t t_submit)
+{
+    enum smd_io_class cls;
+
+    smd_status_decode(io_hdr, 0, &dev->last);
+    if (dev->last.err != smd_err_none)
+        smd_err_add(&dev->errors, &dev->last);
+    if (smtr_on)
+        smtr_record(dev->fd, io_hdr, t_submit, 0, dev->last.err);
+    cls = smd_io_accept(dev, smd_policy_find(io_hdr->cmdp), io_hdr, 0,
+                        smd_io_classify(io_hdr, 0, 0));
+    smd_io_count(dev, io_hdr, cls);
+    return cls;
+}
+
+/* One queued probe of smd_probe_window() */
+struct smd_probe_slot {
+    sg_io_hdr_t hdr;
+    unsigned char cdb[16];
+    unsigned char sense[32];
+    uint64_t t_submit;
+};
+
+int smd_probe_window(struct smd_dev * dev, const unsigned char * cdb,
+                     unsigned int mu, int top, unsigned int window, unsigned int timeout,
+                     smd_probe_match_fn match, unsigned char * reply,
+                     unsigned int reply_len, struct smd_probe_stats * st)
+{
+    struct smd_probe_slot * slot, * sp;
+    int free_slot[SMD_PROBE_WINDOW_MAX], n_free, fblk = top, best = -1;
+    unsigned int k, in_flight = 0, sent = 0;
+    unsigned char * replies;
+    int failed = 0;
+    sg_io_hdr_t hdr;
+
+    if (window > SMD_PROBE_WINDOW_MAX)
+        window = SMD_PROBE_WINDOW_MAX;
+    if (window < 1)
+        return -2;
+    /* The driver writes the sense data and the reply of a queued probe
+       back at read() time, so neither may live on the stack */
+    slot = calloc(window, sizeof(*slot));
+    replies = malloc(window * reply_len);
+    if ((NULL == slot) || (NULL == replies)) {
+        free(slot);
+        free(replies);
+        return -2;
+    }
+    for (k = 0; k < window; k++)
+        free_slot[k] = k;
+    n_free = window;
+
+    for (;;) {
+        /* Keep the window full until a probe matched; nothing below the
+           match is sent any more */
+        while ((best < 0) && !failed && (fblk >= 0) && (n_free > 0)) {
+            k = free_slot[--n_free];
+            sp = &slot[k];
+            memcpy(sp->cdb, cdb, sizeof(sp->cdb));
+            smc_bad_block_probe(sp->cdb, fblk, mu);
+            memset(&sp->hdr, 0, sizeof(sp->hdr));
+            sp->hdr.interface_id = 'S';
+            sp->hdr.cmd_len = sizeof(sp->cdb);
+            sp->hdr.mx_sb_len = sizeof(sp->sense);
+            sp->hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+            sp->hdr.dxfer_len = reply_len;
+            sp->hdr.dxferp = replies + (k * reply_len);
+            sp->hdr.cmdp = sp->cdb;
+            sp->hdr.sbp = sp->sense;
+            sp->hdr.timeout = timeout;
+            sp->hdr.pack_id = fblk;
+            sp->hdr.usr_ptr = sp;
+            if (smd_queue_submit(dev, &sp->hdr, &sp->t_submit) < 0) {
+                free_slot[n_free++] = k;
+                failed = 1;
+                break;
+            }
+            in_flight++;
+            sent++;
+            fblk--;
+        }
+        if (0 == in_flight)
+            break;
+        /* What is still in flight after a match is read and dropped; the
+           sg driver can't take a queued command back */
+        if (smd_queue_read(dev, &hdr) < 0) {
+            /* The probes still queued would land in freed memory: leave
+               the slots to the driver and give up on the fd */
+            st->probes += sent;
+            memset(&dev->last, 0, sizeof(dev->last));
+            return -3;
+        }
+        in_flight--;
+        sp = (struct smd_probe_slot *)hdr.usr_ptr;
+        smd_queue_done(dev, &hdr, sp->t_submit);
+        /* The probes are queued at the tail and should come back in
+           order, but keep the highest match whatever the order */
+        if (smd_status_ok(&dev->last) && match(hdr.dxferp) && (hdr.pack_id > best)) {
+            best = hdr.pack_id;
+            memcpy(reply, hdr.dxferp, reply_len);
+        }
+        free_slot[n_free++] = sp - slot;
+    }
+    free(replies);
+    free(slot);
+
+    st->probes += sent;
+    if (best >= 0)
+        st->wasted += sent - (top - best + 1);
+    memset(&dev->last, 0, sizeof(dev->last));
+    if (failed && (best < 0))
+        return -2;
+    return best;
+}
+
+void smd_print_stats(const struct smd_dev * dev, const char * leadin)
+{
+    printf("%s: %lu SG_IO commands, %lu retries, %lu recovered, %lu transient, "
+           "%lu timeouts, %lu failed", leadin, dev->stats.commands,
+           dev->stats.retries, dev->stats.recovered, dev->stats.transient,
+           dev->stats.timeouts, dev->stats.fatal);
+    if (dev->stats.did_error_ok)
+        printf(", %lu DID_ERROR accepted", dev->stats.did_error_ok);
+    if (dev->stats.cache_hits)
+        printf(", %lu answered from cache", dev->stats.cache_hits);
+    printf("\n");
+}
+
+void smd_print_errors(const struct smd_dev * dev, const char * leadin)
+{
+    const struct smd_err_stats * e = &dev->errors;
+    const char * text;
+    const char * sep = "";
+    unsigned int i;
+
+    for (i=1; i<SMD_ERR_KINDS; i++) {
+        if (e->kind[i] == 0)
+            continue;
+        if ('\0' == *sep)
+            printf("%s: errors:", leadin);
+        printf("%s %lu %s", sep, e->kind[i], smd_err_name((enum smd_err)i));
+        sep = ",";
+    }
+    if ('\0' == *sep)
+        return;
+    printf("\n");
+    for (i=0; i<e->n_codes; i++) {
+        text = smd_asc_name(e->codes[i].asc, e->codes[i].ascq);
+        printf("    sense %02X/%02X/%02X  %8lu%s%s\n", e->codes[i].key,
+               e->codes[i].asc, e->codes[i].ascq, e->codes[i].count,
+               text ? "  " : "", text ? text : "");
+    }
+    if (e->codes_other)
+        printf("    other sense codes %lu\n", e->codes_other);
+}
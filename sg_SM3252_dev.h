@@ -0,0 +1,316 @@
+#ifndef SG_SM3252_DEV_H
+#define SG_SM3252_DEV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <scsi/sg.h>
+
+/* Per-device state shared by the SM3252 tools.
+
+   The MU count of a module is only known once the basic information
+   (0xF0 0x20) has been read, so the per-MU counters live in a table that
+   is carved out of a small arena sized from that count instead of in
+   fixed MAX_MU arrays.  A tool, or a daemon handling many modules, then
+   needs memory in proportion to the MUs a module really has, and
+   releasing a device is a single free.
+*/
+
+/* Total_MU is a single byte of the basic information */
+#define SMD_MAX_MU      255
+
+/* Fixed size bump allocator; everything it hands out is zeroed and goes
+   away with smd_arena_release() */
+struct smd_arena {
+    unsigned char * base;
+    size_t size;
+    size_t used;
+};
+
+/* Module geometry from the basic information reply */
+struct smd_geometry {
+    unsigned int total_mu;
+    unsigned int total_lba;
+    unsigned int lba_per_mu;
+    unsigned int half_lba_per_mu;
+};
+
+/* Per-MU counters of STEP 5 and STEP 6, one column per counter */
+struct smd_mu_table {
+    unsigned int count;
+    unsigned short * current_badblock;
+    unsigned short * initial_badblock;
+    unsigned short * total_datablock;
+    unsigned short * initial_spareblock;
+    unsigned short * current_spareblock;
+};
+
+/* Linux host byte of sg_io_hdr_t.host_status */
+#define SMD_DID_ERROR   0x07
+
+/* Commands written to an sg fd go to the head of the device queue
+   unless they carry this flag; older headers lack it */
+#ifndef SG_FLAG_Q_AT_TAIL
+#define SG_FLAG_Q_AT_TAIL   0x10
+#endif
+
+/* Outcome of one SG_IO, from the ioctl errno, host, driver and SCSI status
+   and the sense key */
+enum smd_io_class {smd_io_ok, smd_io_recovered, smd_io_transient,
+                   smd_io_timeout, smd_io_fatal};
+
+/* What went wrong with one attempt, decoded from the ioctl result, the
+   host, driver and SCSI status and the sense data (fixed or descriptor
+   format).  Decoding only picks bytes out of io_hdr and its sense buffer;
+   nothing is formatted until smd_status_str() is asked for the text. */
+enum smd_err {smd_err_none, smd_err_recovered, smd_err_not_ready,
+              smd_err_medium, smd_err_hardware, smd_err_illegal_request,
+              smd_err_unit_attention, smd_err_aborted, smd_err_other_sense,
+              smd_err_status, smd_err_transport, smd_err_timeout,
+              smd_err_ioctl};
+#define SMD_ERR_KINDS   (smd_err_ioctl + 1)
+
+struct smd_status {
+    enum smd_err err;
+    unsigned char key, asc, ascq;   /* all 0 without sense data */
+    unsigned char status;           /* masked_status */
+    unsigned char host, driver;
+};
+
+/* Per-device error counts: one per smd_err, and one per distinct sense
+   key/ASC/ASCQ up to SMD_SENSE_CODES of them */
+#define SMD_SENSE_CODES     16
+
+struct smd_sense_count {
+    unsigned char key, asc, ascq;
+    unsigned long count;
+};
+
+struct smd_err_stats {
+    unsigned long kind[SMD_ERR_KINDS];
+    unsigned int n_codes;
+    struct smd_sense_count codes[SMD_SENSE_CODES];
+    unsigned long codes_other;      /* sense codes beyond the table */
+};
+
+struct smd_io_stats {
+    unsigned long commands;         /* SG_IO submissions, retries included */
+    unsigned long retries;
+    unsigned long recovered;
+    unsigned long transient;        /* busy, unit attention, USB resets ... */
+    unsigned long timeouts;
+    unsigned long fatal;            /* given up on, or not worth a retry */
+    unsigned long did_error_ok;     /* DID_ERROR accepted by the policy */
+    unsigned long cache_hits;       /* answered without a command */
+    unsigned long cache_flushes;
+    unsigned long long bytes;       /* data moved by completed commands */
+};
+
+/* Command latencies, see smd_lat_timeout().  Durations go into
+   logarithmic buckets, four per power of two above 8 ms.  They are kept
+   per opcode and size class of the transfer, a power of two of 512 byte
+   blocks: a WRITE(16) of 128 blocks doesn't take as long as one of 1. */
+#define SMD_LAT_BUCKETS     64
+#define SMD_LAT_SIZES       24      /* 0: no data, s: up to 512 << (s - 1) */
+#define SMD_LAT_KEYS        32      /* distinct opcodes and sizes per device */
+#define SMD_LAT_MIN_SAMPLES 32      /* before the learned timeout is used */
+#define SMD_LAT_FACTOR      4       /* timeout = p99 * factor ... */
+#define SMD_LAT_FLOOR       500     /* ... but at least this many millisecs */
+#define SMD_LAT_HISTORY     4096    /* samples a loaded profile is worth */
+
+struct smd_latency {
+    unsigned char opcode;
+    unsigned char subop;            /* second CDB byte of vendor opcodes */
+    unsigned char size;             /* size class of the transfer */
+    unsigned int count;
+    unsigned int hist[SMD_LAT_BUCKETS];
+    /* The samples of this run alone; hist and count also hold the
+       history of a loaded profile */
+    unsigned int run_count;
+    unsigned long long run_ms;
+    unsigned int run_hist[SMD_LAT_BUCKETS];
+};
+
+/* Replies of the idempotent reads (INQUIRY, READ CAPACITY, 0xF0 0x20
+   basic information and 0xF0 0x02 CID/LED block), keyed by the whole CDB.
+   Anything that may change the module flushes the lot. */
+#define SMD_CACHE_ENTRIES   8
+#define SMD_CACHE_MAX_LEN   1024
+
+struct smd_cache_entry {
+    unsigned char cdb[16];
+    unsigned int cdb_len;
+    unsigned int dxfer_len;
+    int resid;
+    unsigned char * data;
+};
+
+/* An open sg device and what it has cost so far */
+struct smd_dev {
+    int fd;
+    int max_retries;                /* -1: per opcode default */
+    int adaptive;                   /* use learned timeouts */
+    int cache;                      /* answer repeated reads from memory */
+    struct smd_io_stats stats;
+    struct smd_status last;         /* of the last attempt smd_io() made */
+    struct smd_err_stats errors;    /* every attempt, retries included */
+    unsigned int n_cache;
+    struct smd_cache_entry cached[SMD_CACHE_ENTRIES];
+    unsigned int n_lat;
+    struct smd_latency lat[SMD_LAT_KEYS];
+};
+
+/* Returns 0, or -1 when 'size' bytes can't be allocated */
+extern int smd_arena_init(struct smd_arena * a, size_t size);
+
+/* Returns 'n' zeroed bytes aligned for any counter type, or NULL when
+   the arena is full */
+extern void * smd_arena_alloc(struct smd_arena * a, size_t n);
+
+extern void smd_arena_release(struct smd_arena * a);
+
+/* Decode and check the geometry in a basic information reply.  Returns 0,
+   or -1 when the module reports no MUs or fewer LBAs than MUs; 'g' is
+   zeroed in that case so nothing divides by the bad MU count. */
+extern int smd_geometry_decode(const unsigned char * basic_info,
+                               struct smd_geometry * g);
+
+/* Arena bytes taken by a table of 'count' MUs */
+extern size_t smd_mu_table_size(unsigned int count);
+
+/* Carve a zeroed table of 'count' MUs out of 'a'.  Returns 0, or -1 when
+   count is 0 or above SMD_MAX_MU or the arena is too small. */
+extern int smd_mu_table_alloc(struct smd_arena * a, unsigned int count,
+                              struct smd_mu_table * t);
+
+/* The cache is on after smd_dev_init() */
+extern void smd_dev_init(struct smd_dev * dev, int fd);
+
+/* Free what smd_io() allocated; the fd is left to the caller */
+extern void smd_dev_release(struct smd_dev * dev);
+
+/* Forget all cached replies, e.g. after talking to the device some other
+   way than smd_io() */
+extern void smd_cache_flush(struct smd_dev * dev);
+
+/* Issue 'io_hdr' on the device, retrying under the policy of its opcode.
+   Transient errors are retried after an exponential backoff; timeouts are
+   retried with a longer timeout.  Bad devices and commands the device
+   rejects are not retried.  On return io_hdr holds the last attempt, with
+   the caller's timeout restored, for the usual sg_err_category3() check.
+   A cached read is answered without a command, as a clean completion.
+   Returns the result of the last ioctl(), i.e. -1 with errno set when the
+   command could not be issued at all. */
+extern int smd_io(struct smd_dev * dev, sg_io_hdr_t * io_hdr);
+
+extern enum smd_io_class smd_io_classify(const sg_io_hdr_t * io_hdr,
+                                         int ioctl_res, int ioctl_errno);
+
+/* Commands queued through the sg v3 write() and read() interface
+   instead of one SG_IO after the other.  smd_queue_submit() writes
+   'io_hdr' at the tail of the queue, so the module runs queued commands
+   in the order they were submitted, with the learned timeout of its
+   opcode; 't_submit' gets the time for the trace.  smd_queue_read()
+   waits for the next completion.  Both return the result of write() or
+   read().  smd_queue_done() then accounts for the completion like an
+   attempt of smd_io(): dev->last, the error counts, the trace, the
+   counters and the latencies, with a DID_ERROR the policy of the opcode
+   accepts counted as done.  Queued commands are not retried. */
+extern int smd_queue_submit(struct smd_dev * dev, sg_io_hdr_t * io_hdr,
+                            uint64_t * t_submit);
+extern int smd_queue_read(struct smd_dev * dev, sg_io_hdr_t * io_hdr);
+extern enum smd_io_class smd_queue_done(struct smd_dev * dev,
+                                        const sg_io_hdr_t * io_hdr,
+                                        uint64_t t_submit);
+
+/* Sense key, ASC and ASCQ of fixed (0x70/0x71) or descriptor (0x72/0x73)
+   sense data.  Returns 1, or 0 with 'st' untouched when 'sb' holds no
+   sense data of either format. */
+extern int smd_sense_decode(const unsigned char * sb, int sb_len,
+                            struct smd_status * st);
+
+/* Decode the outcome of one SG_IO into 'st' */
+extern void smd_status_decode(const sg_io_hdr_t * io_hdr, int ioctl_res,
+                              struct smd_status * st);
+
+/* smd_err_none and smd_err_recovered: the command did its job */
+static inline int smd_status_ok(const struct smd_status * st)
+{
+    return (smd_err_none == st->err) || (smd_err_recovered == st->err);
+}
+
+extern const char * smd_err_name(enum smd_err err);
+
+/* Render 'st' as text, e.g. "medium error, sense 03/11/00 (unrecovered
+   read error)".  Returns 'buf'. */
+extern const char * smd_status_str(const struct smd_status * st, char * buf,
+                                   int buf_len);
+
+/* Timeout for 'cdb' moving 'dxfer_len' bytes: SMD_LAT_FACTOR times the
+   p99 latency seen for its opcode and size class, no less than
+   SMD_LAT_FLOOR and no more than 'dflt', the timeout the caller asked
+   for.  'dflt' until SMD_LAT_MIN_SAMPLES were seen or when adaptive
+   timeouts are off. */
+extern unsigned int smd_lat_timeout(const struct smd_dev * dev,
+                                    const unsigned char * cdb,
+                                    unsigned int dxfer_len,
+                                    unsigned int dflt);
+
+/* Largest duration in millisecs that falls in latency bucket 'b' */
+extern unsigned int smd_lat_bucket_max(unsigned int b);
+
+/* Largest transfer in bytes of size class 's' */
+extern unsigned int smd_lat_size_max(unsigned int s);
+
+/* Latency profiles are kept per product and firmware revision, as
+   <dir>/<vendor>_<product>_<revision>.lat, using the INQUIRY fields.
+   Returns 0, or -1 when the name does not fit. */
+extern int smd_lat_profile_name(const char * dir, const unsigned char * vendor,
+                                const unsigned char * product,
+                                const unsigned char * revision,
+                                char * name, int name_len);
+
+/* Merge a saved profile into the device's latencies.  Returns 0 or -1 */
+extern int smd_lat_load(struct smd_dev * dev, const char * name);
+
+/* Returns 0 or -1 (errno set) */
+extern int smd_lat_save(const struct smd_dev * dev, const char * name);
+
+/* p99 latency and timeout in use per opcode and size class */
+extern void smd_lat_print(const struct smd_dev * dev);
+
+/* STEP 5 with a window of bad block probes (0xF0 0x0A, 'cdb' with the
+   FBlk and MU filled in) queued on the device through the sg v3 write()
+   and read() interface.  FBlks are probed downwards from 'top' with
+   'window' probes in flight, so a system block deep down is found in
+   about 1/window of the round trips of probing one FBlk at a time.  Once
+   a reply satisfies 'match' nothing further down is sent; the probes
+   already queued below it can't be called back, they are read and
+   dropped and counted as wasted.  The matching reply is copied to
+   'reply'.  Returns the FBlk, -1 when no FBlk matched, -2 when the
+   queue can't be used (probe one at a time with smd_io() then), or -3
+   when a read() of the replies failed: the probes still queued can't be
+   accounted for and the fd must be closed.  Probes are queued at the
+   tail (see smd_queue_submit()) and not retried; they go into the
+   counters and the trace like the commands of smd_io(). */
+#define SMD_PROBE_WINDOW_MAX    16  /* commands the sg driver queues per fd */
+
+struct smd_probe_stats {
+    unsigned long probes;           /* probes sent */
+    unsigned long wasted;           /* sent below the FBlk that matched */
+};
+
+typedef int (*smd_probe_match_fn)(const unsigned char * reply);
+
+extern int smd_probe_window(struct smd_dev * dev, const unsigned char * cdb,
+                            unsigned int mu, int top, unsigned int window,
+                            unsigned int timeout, smd_probe_match_fn match,
+                            unsigned char * reply, unsigned int reply_len,
+                            struct smd_probe_stats * st);
+
+/* One line summary of the SG_IO counters */
+extern void smd_print_stats(const struct smd_dev * dev, const char * leadin);
+
+/* Errors per kind and per sense code; prints nothing without errors */
+extern void smd_print_errors(const struct smd_dev * dev, const char * leadin);
+
+#endif
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <dirent.h>
+#include "sg_SM3252_health.h"
+
+/* Rank eUSB modules by how soon they run out of spare blocks.
+
+   Every history file in the store (see sg_SM3252_health.h) is streamed
+   once.  For each MU a least squares line is fitted to Current_SpareBlock
+   over time with running sums only, and the drive's time to exhaustion is
+   that of its fastest depleting MU.  Only the worst -n drives are kept, in
+   a bounded heap, so memory does not grow with the number of drives.
+
+   Invocation: sg_SM3252_forecast [-d <store_dir>] [-n <count>] [-s <min_spare>]
+*/
+
+#define EBUFF_SZ        512
+#define TOP_DEFAULT     20
+#define SECS_PER_DAY    86400.0
+
+/* Running least squares sums of one MU, t in days since the first scan */
+struct mu_fit {
+    double n, st, sy, stt, sty;
+    unsigned int last_spare;
+};
+
+struct drive_fit {
+    char serial[SMH_SERIAL_LEN + 1];
+    uint32_t t0, t_last;
+    unsigned int mu_count, scans;
+    struct mu_fit mu[SMH_MAX_MU];
+};
+
+struct drive_rank {
+    char serial[SMH_SERIAL_LEN + 1];
+    double days_left;           /* HUGE_VAL when no MU is depleting */
+    double rate;                /* spare blocks lost per day, worst MU */
+    unsigned int worst_mu, spare, scans;
+    uint32_t t_last;
+};
+
+static int add_scan(const char * serial, const struct smh_scan * scan, void * arg)
+{
+    struct drive_fit * df = (struct drive_fit *)arg;
+    unsigned int mu;
+    double t, y;
+
+    if (df->scans == 0) {
+        memcpy(df->serial, serial, SMH_SERIAL_LEN);
+        df->t0 = scan->timestamp;
+    }
+    /* A different MU count means a different geometry, restart the fit */
+    if ((df->scans > 0) && (scan->mu_count != df->mu_count)) {
+        memset(df->mu, 0, sizeof(df->mu));
+        df->t0 = scan->timestamp;
+        df->scans = 0;
+    }
+    df->mu_count = scan->mu_count;
+    df->t_last = scan->timestamp;
+    df->scans++;
+    t = (scan->timestamp - df->t0) / SECS_PER_DAY;
+    for (mu=0; mu<scan->mu_count; mu++) {
+        y = scan->col[smh_current_spareblock][mu];
+        df->mu[mu].n   += 1.0;
+        df->mu[mu].st  += t;
+        df->mu[mu].sy  += y;
+        df->mu[mu].stt += t * t;
+        df->mu[mu].sty += t * y;
+        df->mu[mu].last_spare = scan->col[smh_current_spareblock][mu];
+    }
+    return 0;
+}
+
+/* Max-heap on days_left: the root is the healthiest of the kept drives
+   and is the one replaced when a worse drive turns up */
+static void heap_sift_down(struct drive_rank * h, int n, int i)
+{
+    struct drive_rank tmp;
+    int c;
+
+    while ((c = 2 * i + 1) < n) {
+        if ((c + 1 < n) && (h[c + 1].days_left > h[c].days_left))
+            c++;
+        if (h[i].days_left >= h[c].days_left)
+            break;
+        tmp = h[i];
+        h[i] = h[c];
+        h[c] = tmp;
+        i = c;
+    }
+}
+
+static void heap_sift_up(struct drive_rank * h, int i)
+{
+    struct drive_rank tmp;
+    int p;
+
+    while (i > 0) {
+        p = (i - 1) / 2;
+        if (h[p].days_left >= h[i].days_left)
+            break;
+        tmp = h[i];
+        h[i] = h[p];
+        h[p] = tmp;
+        i = p;
+    }
+}
+
+static int cmp_rank(const void * a, const void * b)
+{
+    const struct drive_rank * ra = (const struct drive_rank *)a;
+    const struct drive_rank * rb = (const struct drive_rank *)b;
+
+    if (ra->days_left < rb->days_left)
+        return -1;
+    return (ra->days_left > rb->days_left) ? 1 : 0;
+}
+
+int main(int argc, char * argv[])
+{
+    int k, top = TOP_DEFAULT, kept = 0, len, suffix_len;
+    unsigned int mu, min_spare = 0, drives = 0, skipped = 0;
+    char * store_dir = ".";
+    char name[EBUFF_SZ];
+    double denom, slope, days;
+    DIR *dir;
+    struct dirent *de;
+    struct drive_fit *df;
+    struct drive_rank *heap, cur;
+    time_t t;
+    char date[32];
+
+    for (k = 1; k < argc; ++k) {
+        if ((0 == strcmp("-d", argv[k])) && (k + 1 < argc))
+            store_dir = argv[++k];
+        else if ((0 == strcmp("-n", argv[k])) && (k + 1 < argc))
+            top = atoi(argv[++k]);
+        else if ((0 == strcmp("-s", argv[k])) && (k + 1 < argc))
+            min_spare = (unsigned int)atoi(argv[++k]);
+        else {
+            printf("Unrecognized argument: %s\n", argv[k]);
+            top = 0;
+            break;
+        }
+    }
+    if (top < 1) {
+        printf("Usage: 'sg_SM3252_forecast [-d <store_dir>] [-n <count>] [-s <min_spare>]'\n");
+        printf("  -d    health history store written by 'sg_read_SM325 -H' (default .)\n");
+        printf("  -n    number of drives to list, soonest exhaustion first (default %d)\n", TOP_DEFAULT);
+        printf("  -s    count a MU as exhausted at this many spare blocks (default 0)\n");
+        return 1;
+    }
+
+    if ((dir = opendir(store_dir)) == NULL) {
+        snprintf(name, EBUFF_SZ, "sg_SM3252_forecast: can't open %s", store_dir);
+        perror(name);
+        return 1;
+    }
+    df = malloc(sizeof(*df));
+    heap = calloc(top, sizeof(*heap));
+    if ((NULL == df) || (NULL == heap)) {
+        printf("sg_SM3252_forecast: out of memory\n");
+        closedir(dir);
+        return 1;
+    }
+
+    suffix_len = strlen(SMH_FILE_SUFFIX);
+    while ((de = readdir(dir)) != NULL) {
+        len = strlen(de->d_name);
+        if ((len <= suffix_len) ||
+            (strcmp(de->d_name + len - suffix_len, SMH_FILE_SUFFIX) != 0))
+            continue;
+        snprintf(name, EBUFF_SZ, "%s/%s", store_dir, de->d_name);
+        memset(df, 0, sizeof(*df));
+        if (smh_query_file(name, 0, 0xFFFFFFFF, add_scan, df) < 0) {
+            printf("Skipping unreadable history %s\n", name);
+            skipped++;
+            continue;
+        }
+        drives++;
+        if (df->scans < 2) {
+            skipped++;
+            continue;
+        }
+
+        memset(&cur, 0, sizeof(cur));
+        memcpy(cur.serial, df->serial, sizeof(cur.serial));
+        cur.days_left = HUGE_VAL;
+        cur.scans = df->scans;
+        cur.t_last = df->t_last;
+        for (mu=0; mu<df->mu_count; mu++) {
+            struct mu_fit * f = &df->mu[mu];
+
+            denom = f->n * f->stt - f->st * f->st;
+            if (denom <= 0.0)
+                continue;
+            slope = (f->n * f->sty - f->st * f->sy) / denom;
+            if (slope >= 0.0)
+                continue;
+            days = (f->last_spare > min_spare) ?
+                   (f->last_spare - min_spare) / -slope : 0.0;
+            if (days < cur.days_left) {
+                cur.days_left = days;
+                cur.rate = -slope;
+                cur.worst_mu = mu;
+                cur.spare = f->last_spare;
+            }
+        }
+
+        if (kept < top) {
+            heap[kept] = cur;
+            heap_sift_up(heap, kept++);
+        }
+        else if (cur.days_left < heap[0].days_left) {
+            heap[0] = cur;
+            heap_sift_down(heap, kept, 0);
+        }
+    }
+    closedir(dir);
+
+    qsort(heap, kept, sizeof(*heap), cmp_rank);
+    printf("%d of %u drives (%u without enough history)\n\n", kept, drives, skipped);
+    printf("Rank  Serial                Scans  Worst MU  Spare  Lost/day  Days left  Exhausted by\n");
+    for (k=0; k<kept; k++) {
+        if (heap[k].days_left == HUGE_VAL) {
+            printf("%4d  %-20s  %5u         -      -         -          -  not depleting\n",
+                   k + 1, heap[k].serial, heap[k].scans);
+            continue;
+        }
+        t = heap[k].t_last + (time_t)(heap[k].days_left * SECS_PER_DAY);
+        strftime(date, sizeof(date), "%Y-%m-%d", localtime(&t));
+        printf("%4d  %-20s  %5u  %8u  %5u  %8.3f  %9.1f  %s\n", k + 1,
+               heap[k].serial, heap[k].scans, heap[k].worst_mu, heap[k].spare,
+               heap[k].rate, heap[k].days_left, date);
+    }
+    free(heap);
+    free(df);
+    return 0;
+}
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include "sg_SM3252_health.h"
+
+/* Per-MU health history store shared by sg_read_SM325 and the history
+   and forecast tools, see sg_SM3252_health.h for the layout.
+
+   File:    "SMH1"  serial[SMH_SERIAL_LEN]  record ...
+   Record:  u16 length of the rest of the record
+            u8  flags (SMH_KEYFRAME)
+            u8  reserved
+            u16 mu_count
+            u32 timestamp
+            zigzag varint deltas, column by column
+   All multi byte fields are little endian.
+*/
+
+#define SMH_MAGIC       "SMH1"
+#define SMH_HDR_LEN     (4 + SMH_SERIAL_LEN)
+#define SMH_REC_HDR_LEN 10
+#define SMH_KEYFRAME    0x01
+#define SMH_MAX_PAYLOAD (SMH_COLUMNS * SMH_MAX_MU * 3)
+
+struct smh_rec {
+    long offset;
+    unsigned int length;        /* bytes after the length field */
+    unsigned int flags;
+    unsigned int mu_count;
+    uint32_t timestamp;
+};
+
+int smh_file_name(const char * dir, const char * serial, char * name,
+                  int name_len)
+{
+    char clean[SMH_SERIAL_LEN + 1];
+    int i, j;
+
+    for (i=0, j=0; serial[i] && (j < SMH_SERIAL_LEN); i++) {
+        if (((serial[i] >= '0') && (serial[i] <= '9')) ||
+            ((serial[i] >= 'A') && (serial[i] <= 'Z')) ||
+            ((serial[i] >= 'a') && (serial[i] <= 'z')) ||
+            (serial[i] == '-') || (serial[i] == '_'))
+            clean[j++] = serial[i];
+    }
+    clean[j] = '\0';
+    if (j == 0)
+        return -1;
+    if (snprintf(name, name_len, "%s/%s%s", dir, clean, SMH_FILE_SUFFIX) >= name_len)
+        return -1;
+    return 0;
+}
+
+/* Read the fixed part of the record at the current position, the file
+   is left at the start of the payload.  Returns 1, 0 at the end of the
+   file, or -1 on a truncated or damaged record. */
+static int read_rec_hdr(FILE * fp, struct smh_rec * rec)
+{
+    unsigned char b[SMH_REC_HDR_LEN];
+    size_t n;
+
+    rec->offset = ftell(fp);
+    n = fread(b, 1, sizeof(b), fp);
+    if (n == 0)
+        return 0;
+    if (n != sizeof(b))
+        return -1;
+    rec->length = b[0] | (b[1] << 8);
+    rec->flags = b[2];
+    rec->mu_count = b[4] | (b[5] << 8);
+    rec->timestamp = (uint32_t)b[6] | ((uint32_t)b[7] << 8) |
+                     ((uint32_t)b[8] << 16) | ((uint32_t)b[9] << 24);
+    if ((rec->length < SMH_REC_HDR_LEN - 2) ||
+        (rec->length - (SMH_REC_HDR_LEN - 2) > SMH_MAX_PAYLOAD) ||
+        (rec->mu_count > SMH_MAX_MU))
+        return -1;
+    return 1;
+}
+
+static int skip_payload(FILE * fp, const struct smh_rec * rec)
+{
+    return fseek(fp, rec->offset + 2 + rec->length, SEEK_SET);
+}
+
+/* Apply the payload of 'rec' to 'vals', which holds the previous record's
+   values (or zeros for a keyframe) */
+static int read_payload(FILE * fp, const struct smh_rec * rec,
+                        uint16_t vals[SMH_COLUMNS][SMH_MAX_MU])
+{
+    unsigned char buf[SMH_MAX_PAYLOAD];
+    unsigned int len = rec->length - (SMH_REC_HDR_LEN - 2);
+    unsigned int pos = 0, c, mu, shift;
+    uint32_t z;
+
+    if (fread(buf, 1, len, fp) != len)
+        return -1;
+    if (rec->flags & SMH_KEYFRAME)
+        memset(vals, 0, sizeof(uint16_t) * SMH_COLUMNS * SMH_MAX_MU);
+    for (c=0; c<SMH_COLUMNS; c++) {
+        for (mu=0; mu<rec->mu_count; mu++) {
+            z = 0;
+            shift = 0;
+            do {
+                if ((pos >= len) || (shift > 14))
+                    return -1;
+                z |= (uint32_t)(buf[pos] & 0x7F) << shift;
+                shift += 7;
+            } while (buf[pos++] & 0x80);
+            vals[c][mu] = (uint16_t)(vals[c][mu] + ((z >> 1) ^ (0U - (z & 1))));
+        }
+    }
+    return (pos == len) ? 0 : -1;
+}
+
+static int check_file_hdr(FILE * fp, char * serial)
+{
+    unsigned char b[SMH_HDR_LEN];
+
+    if (fread(b, 1, sizeof(b), fp) != sizeof(b))
+        return -1;
+    if (memcmp(b, SMH_MAGIC, 4) != 0)
+        return -1;
+    if (serial) {
+        memcpy(serial, b + 4, SMH_SERIAL_LEN);
+        serial[SMH_SERIAL_LEN] = '\0';
+    }
+    return 0;
+}
+
+int smh_append(const char * dir, const char * serial,
+               const struct smh_scan * scan)
+{
+    char name[512];
+    unsigned char hdr[SMH_HDR_LEN];
+    unsigned char rec[SMH_REC_HDR_LEN + SMH_MAX_PAYLOAD];
+    uint16_t prev[SMH_COLUMNS][SMH_MAX_MU];
+    struct smh_rec r, key;
+    unsigned int c, mu, len, n_since_key = 0, last_mu_count = 0;
+    int have_key = 0, res, keyframe, d, fd;
+    long size, good;
+    uint32_t z;
+    FILE *fp;
+
+    if ((scan->mu_count > SMH_MAX_MU) ||
+        (smh_file_name(dir, serial, name, sizeof(name)) < 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* Created but never truncated here: another station may be appending */
+    if ((fd = open(name, O_RDWR | O_CREAT, 0644)) < 0)
+        return -1;
+    if ((fp = fdopen(fd, "r+b")) == NULL) {
+        res = errno;
+        close(fd);
+        errno = res;
+        return -1;
+    }
+    /* Several stations may scan into one shared store; the size only
+       means something once the lock is held */
+    if (flock(fd, LOCK_EX) < 0)
+        goto err_out;
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    if (size < SMH_HDR_LEN) {
+        /* Empty, or a header torn by a station that died writing it */
+        if ((size > 0) && ((ftruncate(fd, 0) < 0) || (fseek(fp, 0, SEEK_SET) < 0)))
+            goto err_out;
+        memset(hdr, 0, sizeof(hdr));
+        memcpy(hdr, SMH_MAGIC, 4);
+        len = strlen(serial);
+        memcpy(hdr + 4, serial, (len < SMH_SERIAL_LEN) ? len : SMH_SERIAL_LEN);
+        if (fwrite(hdr, 1, sizeof(hdr), fp) != sizeof(hdr))
+            goto err_out;
+    }
+    else {
+        rewind(fp);
+        if (check_file_hdr(fp, NULL) < 0) {
+            errno = EINVAL;
+            goto err_out;
+        }
+        /* Walk the record headers to find the last keyframe ... */
+        good = ftell(fp);
+        while ((res = read_rec_hdr(fp, &r)) > 0) {
+            if (r.offset + 2 + (long)r.length > size) {
+                res = -1;
+                break;
+            }
+            good = r.offset + 2 + r.length;
+            if (r.flags & SMH_KEYFRAME) {
+                key = r;
+                have_key = 1;
+                n_since_key = 0;
+            }
+            n_since_key++;
+            last_mu_count = r.mu_count;
+            if (skip_payload(fp, &r) < 0)
+                break;
+        }
+        /* A station that died appending leaves a torn record behind:
+           drop it, or whatever is appended after it can't be read */
+        if ((res < 0) && (ftruncate(fd, good) < 0))
+            goto err_out;
+        /* ... and decode from it to get the values to delta against.  The
+           stream may still buffer the dropped bytes, so stop at 'good'. */
+        if (have_key) {
+            fseek(fp, key.offset, SEEK_SET);
+            while ((ftell(fp) < good) && (read_rec_hdr(fp, &r) > 0)) {
+                if (read_payload(fp, &r, prev) < 0) {
+                    errno = EINVAL;
+                    goto err_out;
+                }
+            }
+        }
+        fseek(fp, good, SEEK_SET);
+    }
+
+    keyframe = !have_key || (n_since_key >= SMH_KEYFRAME_INTERVAL) ||
+               (last_mu_count != scan->mu_count);
+    if (keyframe)
+        memset(prev, 0, sizeof(prev));
+
+    len = SMH_REC_HDR_LEN;
+    for (c=0; c<SMH_COLUMNS; c++) {
+        for (mu=0; mu<scan->mu_count; mu++) {
+            d = (int16_t)(uint16_t)(scan->col[c][mu] - prev[c][mu]);
+            z = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+            while (z >= 0x80) {
+                rec[len++] = (z & 0x7F) | 0x80;
+                z >>= 7;
+            }
+            rec[len++] = z;
+        }
+    }
+    rec[0] = (len - 2) & 0xFF;
+    rec[1] = ((len - 2) >> 8) & 0xFF;
+    rec[2] = keyframe ? SMH_KEYFRAME : 0;
+    rec[3] = 0;
+    rec[4] = scan->mu_count & 0xFF;
+    rec[5] = (scan->mu_count >> 8) & 0xFF;
+    rec[6] = scan->timestamp & 0xFF;
+    rec[7] = (scan->timestamp >> 8) & 0xFF;
+    rec[8] = (scan->timestamp >> 16) & 0xFF;
+    rec[9] = (scan->timestamp >> 24) & 0xFF;
+    if ((fwrite(rec, 1, len, fp) != len) || (fflush(fp) != 0))
+        goto err_out;
+    fclose(fp);
+    return 0;
+
+err_out:
+    res = errno;
+    fclose(fp);
+    errno = res;
+    return -1;
+}
+
+int smh_query_file(const char * name, uint32_t t_from, uint32_t t_to,
+                   smh_visit_fn fn, void * arg)
+{
+    char serial[SMH_SERIAL_LEN + 1];
+    struct smh_scan scan;
+    struct smh_rec r;
+    long start, size;
+    int res, count = 0;
+    FILE *fp;
+
+    if ((fp = fopen(name, "rb")) == NULL)
+        return -1;
+    /* smh_append() holds LOCK_EX while it writes, so this sees whole
+       records only */
+    if (flock(fileno(fp), LOCK_SH) < 0) {
+        res = errno;
+        fclose(fp);
+        errno = res;
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    if (check_file_hdr(fp, serial) < 0) {
+        fclose(fp);
+        errno = EINVAL;
+        return -1;
+    }
+    /* Start decoding at the last keyframe at or before t_from */
+    start = ftell(fp);
+    while ((res = read_rec_hdr(fp, &r)) > 0) {
+        if (r.timestamp > t_from)
+            break;
+        if (r.flags & SMH_KEYFRAME)
+            start = r.offset;
+        if (skip_payload(fp, &r) < 0)
+            break;
+    }
+    fseek(fp, start, SEEK_SET);
+    memset(&scan, 0, sizeof(scan));
+    while ((res = read_rec_hdr(fp, &r)) > 0) {
+        if (r.timestamp > t_to)
+            break;
+        /* A record torn by a station that died appending stays until the
+           next append drops it: it ends the data, it doesn't damage it */
+        if (r.offset + 2 + (long)r.length > size)
+            break;
+        if (read_payload(fp, &r, scan.col) < 0) {
+            res = -1;
+            break;
+        }
+        if (r.timestamp < t_from)
+            continue;
+        scan.timestamp = r.timestamp;
+        scan.mu_count = r.mu_count;
+        count++;
+        if (fn && fn(serial, &scan, arg))
+            break;
+    }
+    if ((res < 0) && (r.offset + SMH_REC_HDR_LEN > size))
+        res = 0;
+    fclose(fp);
+    if (res < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return count;
+}
+
+int smh_query(const char * dir, const char * serial, uint32_t t_from,
+              uint32_t t_to, smh_visit_fn fn, void * arg)
+{
+    char name[512];
+
+    if (smh_file_name(dir, serial, name, sizeof(name)) < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return smh_query_file(name, t_from, t_to, fn, arg);
+}
@@ -0,0 +1,56 @@
+#ifndef SG_SM3252_HEALTH_H
+#define SG_SM3252_HEALTH_H
+
+#include <stdint.h>
+
+/* Per-MU health history of SM3252 eUSB modules.
+
+   Every scan by sg_read_SM325 can be appended to a store directory that
+   holds one file per unit serial number.  A file is a short header and a
+   sequence of records, one per scan.  Each record stores its five
+   per-MU counters column by column (all MUs of one counter, then the
+   next counter), as the difference to the previous record of the same
+   file in zigzag varint form.  Counters rarely change between scans, so
+   most values take one byte.  Every SMH_KEYFRAME_INTERVAL records (and
+   whenever the MU count changes) a keyframe stores the difference to
+   zero, so a time range query only decodes from the keyframe before it.
+*/
+
+#define SMH_MAX_MU              256
+#define SMH_SERIAL_LEN          20
+#define SMH_KEYFRAME_INTERVAL   32
+#define SMH_FILE_SUFFIX         ".smh"
+
+enum smh_columns {smh_current_badblock, smh_initial_badblock, smh_total_datablock,
+                  smh_initial_spareblock, smh_current_spareblock, SMH_COLUMNS};
+
+struct smh_scan {
+    uint32_t timestamp;             /* seconds since the epoch */
+    unsigned int mu_count;
+    uint16_t col[SMH_COLUMNS][SMH_MAX_MU];
+};
+
+/* Called for each scan of a query, a non-zero return stops the query */
+typedef int (*smh_visit_fn)(const char * serial, const struct smh_scan * scan,
+                            void * arg);
+
+/* Build the file name of 'serial' in 'dir'; the serial is reduced to the
+   characters that are safe in a file name.  Returns 0, or -1 when the
+   name does not fit or the serial is empty. */
+extern int smh_file_name(const char * dir, const char * serial, char * name,
+                         int name_len);
+
+/* Append one scan to the history of 'serial'.  Returns 0 or -1 (errno set) */
+extern int smh_append(const char * dir, const char * serial,
+                      const struct smh_scan * scan);
+
+/* Visit the scans of 'serial' with t_from <= timestamp <= t_to in time
+   order.  Returns the number of scans visited or -1 on error. */
+extern int smh_query(const char * dir, const char * serial, uint32_t t_from,
+                     uint32_t t_to, smh_visit_fn fn, void * arg);
+
+/* Read a single history file by name, see smh_query() */
+extern int smh_query_file(const char * name, uint32_t t_from, uint32_t t_to,
+                          smh_visit_fn fn, void * arg);
+
+#endif
@@ -0,0 +1,156 @@
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sg_SM3252_health.h"
+#include "sg_SM3252_board.h"
+
+/* Print the per-MU health history that sg_read_SM325 -H stored for one
+   eUSB module, optionally limited to a time range.
+
+   Invocation: sg_SM3252_hist [-d <store_dir>] [-f <from>] [-t <to>] <serial>
+               sg_SM3252_hist -S <board> [<serial>]
+
+   <from> and <to> are either seconds since the epoch or YYYY-MM-DD.
+   With -S the latest scan of the module, or of every module, is read
+   from the shared memory results board that -S of sg_read_SM325 and
+   sg_SM3252 publish to.
+*/
+
+#define EBUFF_SZ 256
+
+static const char * col_name[SMH_COLUMNS] =
+    {"Current_BadBlock", "Initial_BadBlock", "Total_DataBlock",
+     "Initial_SpareBlock", "Current_SpareBlock"};
+
+static int parse_time(const char * arg, uint32_t * t)
+{
+    struct tm tm;
+    char * end;
+
+    if (strchr(arg, '-')) {
+        memset(&tm, 0, sizeof(tm));
+        end = strptime(arg, "%Y-%m-%d", &tm);
+        if ((end == NULL) || (*end != '\0'))
+            return -1;
+        tm.tm_isdst = -1;
+        *t = (uint32_t)mktime(&tm);
+        return 0;
+    }
+    *t = (uint32_t)strtoul(arg, &end, 10);
+    return (*end == '\0') ? 0 : -1;
+}
+
+static int print_scan(const char * serial, const struct smh_scan * scan, void * arg)
+{
+    time_t t = scan->timestamp;
+    unsigned int mu;
+    int c;
+
+    (void)arg;
+    printf("%.20s  %u  %s", serial, scan->timestamp, ctime(&t));
+    printf("     MU");
+    for (c=0; c<SMH_COLUMNS; c++)
+        printf(" %19s", col_name[c]);
+    printf("\n");
+    for (mu=0; mu<scan->mu_count; mu++) {
+        printf("    %3u", mu);
+        for (c=0; c<SMH_COLUMNS; c++)
+            printf(" %19u", scan->col[c][mu]);
+        printf("\n");
+    }
+    printf("\n");
+    return 0;
+}
+
+/* Latest scans on the results board, of 'serial' or all modules */
+static int print_board(const char * board_name, const char * serial)
+{
+    struct smb_board * b;
+    struct smh_scan scan;
+    char slot_serial[SMH_SERIAL_LEN + 1];
+    char ebuff[EBUFF_SZ];
+    unsigned int i;
+    int n = 0, res;
+
+    if ((b = smb_open(board_name, 0)) == NULL) {
+        snprintf(ebuff, EBUFF_SZ, "sg_SM3252_hist: error opening results board %s",
+                 board_name);
+        perror(ebuff);
+        return 1;
+    }
+    for (i=0; i<SMB_SLOTS; i++) {
+        if ((res = smb_read(b, i, slot_serial, &scan)) < 0)
+            printf("Slot %u busy, skipped\n", i);
+        else if (res && ((0 == serial) || (0 == strcmp(serial, slot_serial)))) {
+            print_scan(slot_serial, &scan, NULL);
+            n++;
+        }
+    }
+    smb_close(b);
+    printf("%d modules\n", n);
+    return ((0 == n) && serial) ? 1 : 0;
+}
+
+int main(int argc, char * argv[])
+{
+    int k, n, bad = 0;
+    char * serial = 0;
+    char * board_name = 0;
+    char * store_dir = ".";
+    char ebuff[EBUFF_SZ];
+    uint32_t t_from = 0, t_to = 0xFFFFFFFF;
+
+    for (k = 1; k < argc; ++k) {
+        if ((0 == strcmp("-d", argv[k])) && (k + 1 < argc))
+            store_dir = argv[++k];
+        else if ((0 == strcmp("-S", argv[k])) && (k + 1 < argc))
+            board_name = argv[++k];
+        else if ((0 == strcmp("-f", argv[k])) && (k + 1 < argc)) {
+            if (parse_time(argv[++k], &t_from) < 0) {
+                printf("Bad time: %s\n", argv[k]);
+                bad = 1;
+                break;
+            }
+        }
+        else if ((0 == strcmp("-t", argv[k])) && (k + 1 < argc)) {
+            if (parse_time(argv[++k], &t_to) < 0) {
+                printf("Bad time: %s\n", argv[k]);
+                bad = 1;
+                break;
+            }
+        }
+        else if (*argv[k] == '-') {
+            printf("Unrecognized switch: %s\n", argv[k]);
+            bad = 1;
+            break;
+        }
+        else if (0 == serial)
+            serial = argv[k];
+        else {
+            printf("too many arguments\n");
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || ((0 == serial) && (0 == board_name))) {
+        printf("Usage: 'sg_SM3252_hist [-d <store_dir>] [-f <from>] [-t <to>] <serial>'\n");
+        printf("       'sg_SM3252_hist -S <board> [<serial>]'\n");
+        printf("  <from> and <to> are seconds since the epoch or YYYY-MM-DD\n");
+        printf("  -S    latest scan on the shared memory results board <board>\n");
+        return 1;
+    }
+    if (board_name)
+        return print_board(board_name, serial);
+
+    n = smh_query(store_dir, serial, t_from, t_to, print_scan, NULL);
+    if (n < 0) {
+        snprintf(ebuff, EBUFF_SZ, "sg_SM3252_hist: no history for %s in %s",
+                 serial, store_dir);
+        perror(ebuff);
+        return 1;
+    }
+    printf("%d scans\n", n);
+    return 0;
+}
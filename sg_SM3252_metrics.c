@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "sg_SM3252_metrics.h"
+
+/* Prometheus text file of sg_SM3252, see sg_SM3252_metrics.h */
+
+static const struct {
+    const char * name;
+    const char * type;
+    const char * help;
+} smm_metrics[SMM_METRICS] = {
+    {"sm3252_disk_size_bytes", "gauge", "Capacity from READ CAPACITY"},
+    {"sm3252_mu_count", "gauge", "MUs in the basic information"},
+    {"sm3252_badblock_current", "gauge", "Current bad blocks of the MU"},
+    {"sm3252_badblock_initial", "gauge", "Factory bad blocks of the MU"},
+    {"sm3252_spareblock_initial", "gauge", "Spare blocks of the MU when it left the factory"},
+    {"sm3252_spareblock_current", "gauge", "Spare blocks of the MU left now"},
+    {"sm3252_led_setting", "gauge", "LED byte of the CID table"},
+    {"sm3252_drive_failed", "gauge", "1 when a step of the drive failed in this run"},
+    {"sm3252_sg_io_commands_total", "counter", "SG_IO submissions, retries included"},
+    {"sm3252_sg_io_retries_total", "counter", "SG_IO commands retried"},
+    {"sm3252_sg_io_timeouts_total", "counter", "SG_IO commands that timed out"},
+    {"sm3252_sg_io_failures_total", "counter", "SG_IO commands given up on"},
+    {"sm3252_sg_io_errors_total", "counter", "Failed or recovered SG_IO attempts by kind"},
+    {"sm3252_sg_io_duration_seconds", "histogram", "Command duration the device reported, by opcode and transfer size"},
+};
+
+/* Label value: backslash, double quote and newline escaped, trailing
+   INQUIRY padding dropped */
+static void smm_label(FILE * f, const char * v, int len)
+{
+    while ((len > 0) && ((' ' == v[len - 1]) || ('\0' == v[len - 1])))
+        len--;
+    for (; len > 0; v++, len--) {
+        if ('\0' == *v)
+            break;
+        if (('\\' == *v) || ('"' == *v))
+            fputc('\\', f);
+        if ('\n' == *v)
+            fputs("\\n", f);
+        else
+            fputc(*v, f);
+    }
+}
+
+/* The labels every sample of the drive starts with */
+static void smm_labels(FILE * f, const struct smo_session * s)
+{
+    fputs("{device=\"", f);
+    smm_label(f, s->name, strlen(s->name));
+    fputs("\",serial=\"", f);
+    smm_label(f, (const char *)smv_serial_number(smv_serial_view(s->inq_sn)),
+              SMV_SERIAL_LEN);
+    fputc('"', f);
+}
+
+static void smm_sample(FILE * f, const struct smo_session * s, enum smm_metric m,
+                       unsigned long long v)
+{
+    fputs(smm_metrics[m].name, f);
+    smm_labels(f, s);
+    fprintf(f, "} %llu\n", v);
+}
+
+static void smm_sample_mu(FILE * f, const struct smo_session * s, enum smm_metric m,
+                          unsigned int mu, unsigned int v)
+{
+    fputs(smm_metrics[m].name, f);
+    smm_labels(f, s);
+    fprintf(f, ",mu=\"%u\"} %u\n", mu, v);
+}
+
+static void smm_render_latency(FILE * f, const struct smo_session * s)
+{
+    const struct smd_latency * l;
+    unsigned long cum;
+    unsigned int i, b, top;
+    char op[8];
+
+    for (i = 0; i < s->dev.n_lat; i++) {
+        l = &s->dev.lat[i];
+        if (0 == l->run_count)
+            continue;
+        if (l->opcode < 0xC0)
+            snprintf(op, sizeof(op), "%02X", l->opcode);
+        else
+            snprintf(op, sizeof(op), "%02X %02X", l->opcode, l->subop);
+        /* Buckets up to the last one used; the device reports whole
+           millisecs, so bucket b holds durations up to its maximum */
+        for (top = SMD_LAT_BUCKETS - 1; (top > 0) && (0 == l->run_hist[top]); top--)
+            ;
+        for (b = 0, cum = 0; b <= top; b++) {
+            cum += l->run_hist[b];
+            fprintf(f, "sm3252_sg_io_duration_seconds_bucket");
+            smm_labels(f, s);
+            fprintf(f, ",opcode=\"%s\",bytes=\"%u\",le=\"%g\"} %lu\n", op,
+                    smd_lat_size_max(l->size),
+                    smd_lat_bucket_max(b) / 1000.0, cum);
+        }
+        fprintf(f, "sm3252_sg_io_duration_seconds_bucket");
+        smm_labels(f, s);
+        fprintf(f, ",opcode=\"%s\",bytes=\"%u\",le=\"+Inf\"} %u\n", op,
+                smd_lat_size_max(l->size), l->run_count);
+        fprintf(f, "sm3252_sg_io_duration_seconds_sum");
+        smm_labels(f, s);
+        fprintf(f, ",opcode=\"%s\",bytes=\"%u\"} %g\n", op,
+                smd_lat_size_max(l->size), l->run_ms / 1000.0);
+        fprintf(f, "sm3252_sg_io_duration_seconds_count");
+        smm_labels(f, s);
+        fprintf(f, ",opcode=\"%s\",bytes=\"%u\"} %u\n", op,
+                smd_lat_size_max(l->size), l->run_count);
+    }
+}
+
+static void smm_render(FILE * f, const struct smo_session * s, int failed,
+                       enum smm_metric m)
+{
+    const struct smd_dev * dev = &s->dev;
+    unsigned int mu, k;
+
+    switch (m) {
+    case smm_disk_size:
+        if (s->identified)
+            smm_sample(f, s, m, (unsigned long long)(s->last_lba + 1ULL) * s->block_size);
+        break;
+    case smm_mu_count:
+        if (s->identified)
+            smm_sample(f, s, m, s->geom.total_mu);
+        break;
+    case smm_badblock_current:
+    case smm_badblock_initial:
+    case smm_spareblock_initial:
+        for (mu = 0; s->mu_found && (mu < s->mu.count); mu++) {
+            if (!s->mu_found[mu])
+                continue;
+            smm_sample_mu(f, s, m, mu,
+                          (m == smm_badblock_current) ? s->mu.current_badblock[mu] :
+                          (m == smm_badblock_initial) ? s->mu.initial_badblock[mu] :
+                          s->mu.initial_spareblock[mu]);
+        }
+        break;
+    case smm_spareblock_current:
+        for (mu = 0; s->mu_spare_ok && (mu < s->mu.count); mu++) {
+            if (s->mu_spare_ok[mu])
+                smm_sample_mu(f, s, m, mu, s->mu.current_spareblock[mu]);
+        }
+        break;
+    case smm_led:
+        if (s->have_cid)
+            smm_sample(f, s, m, smv_cid_led(smv_cid_view(s->cid),
+                                                s->profile->led_offset));
+        break;
+    case smm_drive_failed:
+        smm_sample(f, s, m, failed ? 1 : 0);
+        break;
+    case smm_commands:
+        smm_sample(f, s, m, dev->stats.commands);
+        break;
+    case smm_retries:
+        smm_sample(f, s, m, dev->stats.retries);
+        break;
+    case smm_timeouts:
+        smm_sample(f, s, m, dev->stats.timeouts);
+        break;
+    case smm_failures:
+        smm_sample(f, s, m, dev->stats.fatal);
+        break;
+    case smm_errors:
+        for (k = smd_err_none + 1; k < SMD_ERR_KINDS; k++) {
+            if (0 == dev->errors.kind[k])
+                continue;
+            fputs(smm_metrics[m].name, f);
+            smm_labels(f, s);
+            fprintf(f, ",kind=\"%s\"} %lu\n", smd_err_name((enum smd_err)k),
+                    dev->errors.kind[k]);
+        }
+        break;
+    case smm_latency:
+        smm_render_latency(f, s);
+        break;
+    }
+}
+
+int smm_render_drive(struct smm_drive * m, const struct smo_session * s,
+                     int failed)
+{
+    unsigned int i;
+    FILE * f;
+
+    memset(m, 0, sizeof(*m));
+    for (i = 0; i < SMM_METRICS; i++) {
+        if ((f = open_memstream(&m->text[i], &m->len[i])) == NULL) {
+            smm_drive_release(m);
+            return -1;
+        }
+        smm_render(f, s, failed, (enum smm_metric)i);
+        if (fclose(f) != 0) {
+            smm_drive_release(m);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void smm_drive_release(struct smm_drive * m)
+{
+    unsigned int i;
+
+    for (i = 0; i < SMM_METRICS; i++) {
+        free(m->text[i]);
+        m->text[i] = NULL;
+        m->len[i] = 0;
+    }
+}
+
+int smm_write(const char * file_name, const struct smm_drive * drives,
+              unsigned int n)
+{
+    char tmp_name[512];
+    unsigned int i, d;
+    int res;
+    FILE * fp;
+
+    if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", file_name) >= (int)sizeof(tmp_name)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if ((fp = fopen(tmp_name, "w")) == NULL)
+        return -1;
+    for (i = 0; i < SMM_METRICS; i++) {
+        fprintf(fp, "# HELP %s %s\n", smm_metrics[i].name, smm_metrics[i].help);
+        fprintf(fp, "# TYPE %s %s\n", smm_metrics[i].name, smm_metrics[i].type);
+        for (d = 0; d < n; d++) {
+            if (drives[d].len[i])
+                fwrite(drives[d].text[i], 1, drives[d].len[i], fp);
+        }
+    }
+    res = ferror(fp) ? -1 : 0;
+    if ((fclose(fp) != 0) || (res < 0)) {
+        remove(tmp_name);
+        return -1;
+    }
+    return rename(tmp_name, file_name);
+}
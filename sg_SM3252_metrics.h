@@ -0,0 +1,46 @@
+#ifndef SG_SM3252_METRICS_H
+#define SG_SM3252_METRICS_H
+
+#include <stddef.h>
+#include "sg_SM3252_ops.h"
+
+/* Drive health and SG_IO counters of sg_SM3252 as a Prometheus text
+   file, for the textfile collector of node_exporter.
+
+   The exposition format wants all samples of a metric together under its
+   HELP and TYPE lines, while the drives of a station finish one by one.
+   So each drive renders its samples once, when it is done with, into one
+   fragment per metric, and smm_write() only concatenates the fragments
+   metric by metric.  Writing the file for 500 drives sends no command and
+   formats no number twice.  The file is replaced with a rename, so the
+   collector never reads half of it. */
+
+/* The metrics, in the order they are written */
+enum smm_metric {smm_disk_size, smm_mu_count, smm_badblock_current,
+                 smm_badblock_initial, smm_spareblock_initial,
+                 smm_spareblock_current, smm_led, smm_drive_failed,
+                 smm_commands, smm_retries, smm_timeouts, smm_failures,
+                 smm_errors, smm_latency};
+#define SMM_METRICS     (smm_latency + 1)
+
+/* What one drive contributes to each metric */
+struct smm_drive {
+    char * text[SMM_METRICS];
+    size_t len[SMM_METRICS];
+};
+
+/* Render the samples of session 's', labelled with its device and serial
+   number.  Only what the session has read is rendered: no bad blocks
+   without a scan, no LED setting without the CID table.  Call it before
+   smo_close().  Returns 0, or -1 when out of memory. */
+extern int smm_render_drive(struct smm_drive * m, const struct smo_session * s,
+                            int failed);
+
+extern void smm_drive_release(struct smm_drive * m);
+
+/* Write the fragments of 'n' drives to 'file_name'.  Returns 0, or -1
+   with errno set. */
+extern int smm_write(const char * file_name, const struct smm_drive * drives,
+                     unsigned int n);
+
+#endif
@@ -0,0 +1,675 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "sg_lib.h"
+#include "sg_io_linux.h"
+#include "sg_SM3252_health.h"
+#include "sg_SM3252_cdb.h"
+#include "sg_SM3252_ops.h"
+
+/* Steps of the SM3252 tools over one session, see sg_SM3252_ops.h */
+
+#define READCAP_REPLY_LEN   8
+#define SMO_LED_OLD         0x80
+#define SMO_LED_NEW         0x82
+
+static const unsigned char inq_cdb[6] = {0x12, 0, 0, 0, SMO_INQ_REPLY_LEN, 0};
+static const unsigned char inq_sn_cdb[6] = {0x12, 0, 0x80, 0, SMO_INQ_REPLY_LEN, 0};
+static const unsigned char readcap_cdb[10] = {0x25, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+static const unsigned char basic_info_cdb[16] =
+        {0xF0, 0x20, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0};
+static const unsigned char bad_block_cdb[16] =
+        {0xF0, 0x0A, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0};
+static const unsigned char spare_1_cdb[16] =
+        {0x28, 0x00, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0};
+static const unsigned char spare_2_cdb[16] =
+        {0xF0, 0xAA, 0, 0, 0, 0, 0, 0x10, 0, 0, 0, 1, 0, 0, 0, 0};
+static const unsigned char read_led_cdb[16] =
+        {0xF0, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0};
+static const unsigned char write_led_cdb[16] =
+        {0xF1, 0x03, 0, 0, 0, 0, 0, 0, 0x20, 0, 0, 1, 0, 0, 0, 0};
+static const unsigned char reset_cdb[16] =
+        {0xF0, 0x2C, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+static const unsigned char erase_cdb[16] =
+        {0xF0, 0x0C, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+static const unsigned char write_16_cdb[16] =
+        {0x8A, 0x00, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0};
+static const unsigned char read_16_cdb[16] =
+        {0x88, 0x00, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0};
+static const unsigned char write_same_cdb[16] =
+        {0x93, 0x08, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+int smo_open(struct smo_session * s, const char * name)
+{
+    char ebuff[256];
+    int fd, k;
+
+    memset(s, 0, sizeof(*s));
+    s->name = name;
+    s->out = stdout;
+    s->erase_method = smo_erase_write_same;
+    if ((fd = open(name, O_RDWR)) < 0) {
+        snprintf(ebuff, sizeof(ebuff), "sg_SM3252: error opening file: %s", name);
+        perror(ebuff);
+        return -1;
+    }
+    /* Just to be safe, check we have a new sg device by trying an ioctl */
+    if ((ioctl(fd, SG_GET_VERSION_NUM, &k) < 0) || (k < 30000)) {
+        printf("sg_SM3252: %s doesn't seem to be a new sg device\n", name);
+        close(fd);
+        return -1;
+    }
+    smd_dev_init(&s->dev, fd);
+    return 0;
+}
+
+void smo_close(struct smo_session * s)
+{
+    unsigned char dummy[SMO_REPLY_LEN];
+
+    if (s->reset_pending) {
+        fprintf(s->out, "Resetting %s\n", s->name);
+        /* The module drops off the bus, so no status is expected.  The
+           standalone tools send the reset with a 512 byte data phase as
+           well; here it carries zeroes, not whatever was on the stack. */
+        memset(dummy, 0, sizeof(dummy));
+        smo_cmd(&s->dev, reset_cdb, sizeof(reset_cdb), SG_DXFER_TO_DEV,
+                dummy, sizeof(dummy), SMO_CMD_TIMEOUT, NULL);
+    }
+    free(s->erase_buf);
+    s->erase_buf = NULL;
+    smd_arena_release(&s->arena);
+    smd_dev_release(&s->dev);
+    close(s->dev.fd);
+    s->dev.fd = -1;
+}
+
+int smo_cmd(struct smd_dev * dev, const unsigned char * cdb, int cdb_len,
+            int direction, void * buf, unsigned int len, unsigned int timeout,
+            const char * leadin)
+{
+    sg_io_hdr_t io_hdr;
+    unsigned char sense_buffer[32];
+    char text[96];
+
+    memset(&io_hdr, 0, sizeof(sg_io_hdr_t));
+    io_hdr.interface_id = 'S';
+    io_hdr.cmd_len = cdb_len;
+    io_hdr.mx_sb_len = sizeof(sense_buffer);
+    io_hdr.dxfer_direction = direction;
+    io_hdr.dxfer_len = len;
+    io_hdr.dxferp = buf;
+    io_hdr.cmdp = (unsigned char *)cdb;
+    io_hdr.sbp = sense_buffer;
+    io_hdr.timeout = timeout;
+
+    if (smd_io(dev, &io_hdr) < 0) {
+        perror("sg_SM3252: SG_IO ioctl error");
+        return -1;
+    }
+    /* Recovered errors only go into the device's error counts */
+    if (smd_status_ok(&dev->last))
+        return 1;
+    if (leadin)
+        fprintf(stderr, "%s: %s\n", leadin,
+                smd_status_str(&dev->last, text, sizeof(text)));
+    return 0;
+}
+
+/* STEPS 1 to 3, once per session, for smo_identify() and smo_ident() */
+static int smo_inquire(struct smo_session * s)
+{
+    unsigned char capBuff[READCAP_REPLY_LEN];
+    int ok;
+
+    if (s->inquired)
+        return 0;
+
+    /* 1. INQUIRY for Vendor ID, Product ID, Product Revision */
+    ok = smo_cmd(&s->dev, inq_cdb, sizeof(inq_cdb), SG_DXFER_FROM_DEV, s->inq,
+                 sizeof(s->inq), SMO_CMD_TIMEOUT, "INQUIRY command error");
+    if (ok <= 0)
+        return -1;
+
+    /* 2. INQUIRY for Unit Serial Number */
+    ok = smo_cmd(&s->dev, inq_sn_cdb, sizeof(inq_sn_cdb), SG_DXFER_FROM_DEV,
+                 s->inq_sn, sizeof(s->inq_sn), SMO_CMD_TIMEOUT, "INQUIRY command error");
+    if (ok < 0)
+        return -1;
+    if (0 == ok)
+        memset(s->inq_sn, 0, sizeof(s->inq_sn));
+
+    /* 3. READ CAPACITY for Block Size and Disk Size */
+    ok = smo_cmd(&s->dev, readcap_cdb, sizeof(readcap_cdb), SG_DXFER_FROM_DEV,
+                 capBuff, sizeof(capBuff), SMO_CMD_TIMEOUT,
+                 "READ CAPACITY command error");
+    if (ok < 0)
+        return -1;
+    if (ok) {
+        s->block_size = smc_readcap_block_size(capBuff);
+        s->last_lba = smc_readcap_last_lba(capBuff);
+    }
+    /* Until STEP 5 finds a system block, the firmware picks the profile */
+    s->profile = smp_default(smv_inq_revision(smv_inquiry_view(s->inq)));
+    s->inquired = 1;
+    return 0;
+}
+
+int smo_identify(struct smo_session * s)
+{
+    struct smv_basic_info basic;
+    unsigned int count;
+    int ok;
+
+    if (s->identified)
+        return 0;
+    if (smo_inquire(s) < 0)
+        return -1;
+
+    /* 4. Basic information */
+    ok = smo_cmd(&s->dev, basic_info_cdb, sizeof(basic_info_cdb),
+                 SG_DXFER_FROM_DEV, s->basic_info, sizeof(s->basic_info),
+                 SMO_CMD_TIMEOUT, "READ_10 command error");
+    if (ok <= 0)
+        return -1;
+    if (smd_geometry_decode(s->basic_info, &s->geom) < 0) {
+        basic = smv_basic_info_view(s->basic_info);
+        fprintf(s->out, "Invalid geometry: Total MU = %u, Total LBA = 0x%08X\n",
+                smv_basic_total_mu(basic), (unsigned int)smv_basic_total_lba(basic));
+        return -1;
+    }
+
+    /* Size the per-MU results by the MU count the module reports */
+    count = s->geom.total_mu;
+    if ((smd_arena_init(&s->arena, smd_mu_table_size(count) + 2 * count) < 0) ||
+        (smd_mu_table_alloc(&s->arena, count, &s->mu) < 0) ||
+        ((s->mu_found = smd_arena_alloc(&s->arena, 2 * count)) == NULL)) {
+        fprintf(s->out, "sg_SM3252: out of memory for %u MUs\n", count);
+        smd_arena_release(&s->arena);
+        return -1;
+    }
+    s->mu_spare_ok = s->mu_found + count;
+    s->identified = 1;
+    return 0;
+}
+
+int smo_ident(struct smo_session * s)
+{
+    unsigned char cdb[16];
+    unsigned char inBuffBB[SMO_BB_REPLY_LEN];
+    const struct smp_profile * p;
+    int ok;
+
+    if (smo_inquire(s) < 0)
+        return -1;
+    if (s->ident_probed || s->chip[0])
+        return 0;
+    /* One bad block probe of MU 0, where the profile says STEP 5 starts */
+    memcpy(cdb, bad_block_cdb, sizeof(cdb));
+    smc_bad_block_probe(cdb, s->profile->fblk_top, 0);
+    ok = smo_cmd(&s->dev, cdb, sizeof(cdb), SG_DXFER_FROM_DEV, inBuffBB,
+                 sizeof(inBuffBB), SMO_CMD_TIMEOUT, NULL);
+    if (ok < 0)
+        return -1;
+    s->ident_probed = 1;
+    if (ok && smp_sysblk_match(inBuffBB)) {
+        memcpy(s->chip, smv_sysblk_chip(smv_sysblk_view(inBuffBB)), SMV_CHIP_LEN);
+        p = smp_match(inBuffBB, smv_inq_revision(smv_inquiry_view(s->inq)));
+        if (p)
+            s->profile = p;
+    }
+    return 0;
+}
+
+int smo_scan_mu(struct smo_session * s, unsigned int mu)
+{
+    unsigned char cdb[16];
+    unsigned char inBuffBB[SMO_BB_REPLY_LEN];
+    unsigned char inBuff[SMO_REPLY_LEN];
+    struct smv_sysblk sb = smv_sysblk_view(inBuffBB);
+    const struct smp_profile * p;
+    unsigned int window;
+    int FBlk, ok, found;
+
+    /* 5. Initial and current bad blocks, from the system block found by
+       probing down from the last flash block.  Without -W the profile
+       says how many probes to queue. */
+    memcpy(cdb, bad_block_cdb, sizeof(cdb));
+    s->mu_found[mu] = 0;
+    found = -2;
+    window = s->probe_window ? s->probe_window : s->profile->probe_window;
+    if (window > 1) {
+        found = smd_probe_window(&s->dev, cdb, mu, s->profile->fblk_top, window,
+                                 SMO_CMD_TIMEOUT, smp_sysblk_match, inBuffBB,
+                                 sizeof(inBuffBB), &s->probes);
+        if (-3 == found) {
+            perror("smd_probe_window: read() of a queued probe failed");
+            return -1;
+        }
+        s->probe_window = (-2 == found) ? 1 : window;
+    }
+    for (FBlk=s->profile->fblk_top; (-2 == found) && (FBlk>=0); FBlk--) {
+        smc_bad_block_probe(cdb, FBlk, mu);
+        /* Up to 1024 of these per MU: failures are counted, not printed */
+        ok = smo_cmd(&s->dev, cdb, sizeof(cdb), SG_DXFER_FROM_DEV, inBuffBB,
+                     sizeof(inBuffBB), SMO_CMD_TIMEOUT, NULL);
+        if (ok < 0)
+            return -1;
+        if (ok && smp_sysblk_match(inBuffBB))
+            found = FBlk;
+    }
+    if (found >= 0) {
+        s->mu.current_badblock[mu] = smv_sysblk_current_badblock(sb);
+        s->mu.initial_badblock[mu] = smv_sysblk_initial_badblock(sb);
+        s->mu.total_datablock[mu] = smv_sysblk_datablock(sb);
+        /* Every MU carries the same chip name, and the first system
+           block settles the profile */
+        if ('\0' == s->chip[0]) {
+            memcpy(s->chip, smv_sysblk_chip(sb), SMV_CHIP_LEN);
+            p = smp_match(inBuffBB, smv_inq_revision(smv_inquiry_view(s->inq)));
+            if (p)
+                s->profile = p;
+        }
+        s->mu_found[mu] = 1;
+    }
+    /* 5+. Initial spare blocks */
+    s->mu.initial_spareblock[mu] = smp_initial_spare(s->profile, mu,
+                                                     s->mu.total_datablock[mu],
+                                                     s->mu.initial_badblock[mu]);
+
+    /* 6. Current spare blocks: a READ(10) in the middle of the MU selects
+       it, 0xF0 0xAA returns the count */
+    memcpy(cdb, spare_1_cdb, sizeof(cdb));
+    smc_read10_lba(cdb, (s->geom.lba_per_mu * mu) + s->geom.half_lba_per_mu);
+    s->mu_spare_ok[mu] = 0;
+    ok = smo_cmd(&s->dev, cdb, sizeof(cdb), SG_DXFER_FROM_DEV, inBuff,
+                 sizeof(inBuff), SMO_CMD_TIMEOUT, "READ_10 command error");
+    if (ok < 0)
+        return -1;
+    ok = smo_cmd(&s->dev, spare_2_cdb, sizeof(spare_2_cdb), SG_DXFER_FROM_DEV,
+                 inBuff, sizeof(inBuff), SMO_CMD_TIMEOUT, "READ_10 command error");
+    if (ok < 0)
+        return -1;
+    if (ok) {
+        s->mu.current_spareblock[mu] = smv_spare_count(smv_spare_view(inBuff),
+                                                        s->profile->spare_offset);
+        s->mu_spare_ok[mu] = 1;
+    }
+    return s->mu_found[mu] && s->mu_spare_ok[mu];
+}
+
+int smo_scan(struct smo_session * s)
+{
+    unsigned int mu;
+    int res, count = 0;
+
+    if (smo_identify(s) < 0)
+        return -1;
+    for (mu=0; mu<s->geom.total_mu; mu++) {
+        if ((res = smo_scan_mu(s, mu)) < 0)
+            return -1;
+        count += res;
+    }
+    s->scanned = 1;
+    return count;
+}
+
+void smo_health_scan(const struct smo_session * s, char * serial,
+                     struct smh_scan * scan)
+{
+    const unsigned char * sn = smv_serial_number(smv_serial_view(s->inq_sn));
+    unsigned int i, j, mu;
+
+    memset(scan, 0, sizeof(*scan));
+    for (i=0, j=0; (i<SMV_SERIAL_LEN) && (j<SMH_SERIAL_LEN); i++) {
+        if ((sn[i] > ' ') && (sn[i] < 0x7F))
+            serial[j++] = sn[i];
+    }
+    serial[j] = '\0';
+    scan->timestamp = (uint32_t)time(NULL);
+    scan->mu_count = s->mu.count;
+    for (mu=0; mu<s->mu.count; mu++) {
+        scan->col[smh_current_badblock][mu]   = s->mu.current_badblock[mu];
+        scan->col[smh_initial_badblock][mu]   = s->mu.initial_badblock[mu];
+        scan->col[smh_total_datablock][mu]    = s->mu.total_datablock[mu];
+        scan->col[smh_initial_spareblock][mu] = s->mu.initial_spareblock[mu];
+        scan->col[smh_current_spareblock][mu] = s->mu.current_spareblock[mu];
+    }
+}
+
+int smo_health_append(const struct smo_session * s, const char * dir)
+{
+    char serial[SMH_SERIAL_LEN + 1];
+    struct smh_scan scan;
+
+    smo_health_scan(s, serial, &scan);
+    return smh_append(dir, serial, &scan);
+}
+
+int smo_read_cid(struct smo_session * s)
+{
+    if (s->have_cid)
+        return 0;
+    if (smo_cmd(&s->dev, read_led_cdb, sizeof(read_led_cdb), SG_DXFER_FROM_DEV,
+                s->cid, sizeof(s->cid), SMO_CMD_TIMEOUT,
+                "READ_10 command error") <= 0)
+        return -1;
+    s->have_cid = 1;
+    return 0;
+}
+
+int smo_led_write(struct smd_dev * dev, FILE * out, unsigned char * cid,
+                  unsigned int led)
+{
+    unsigned char newBuff[SMO_REPLY_LEN];
+    unsigned int i;
+    int ok;
+
+    if (cid[led] == SMO_LED_NEW) {
+        fprintf(out, "Already configured\n");
+        return smo_led_done;
+    }
+    if (cid[led] != SMO_LED_OLD) {
+        fprintf(out, "FAILED - Unexpected LED setting 0x%02X.\n", cid[led]);
+        return smo_led_failed;
+    }
+    memcpy(newBuff, cid, sizeof(newBuff));
+    newBuff[led] = SMO_LED_NEW;
+    ok = smo_cmd(dev, write_led_cdb, sizeof(write_led_cdb), SG_DXFER_TO_DEV,
+                 newBuff, sizeof(newBuff), SMO_CMD_TIMEOUT,
+                 "WRITE LED command error");
+    if (ok < 0)
+        return -1;
+    /* Read back what the module has now; the write flushed the cache */
+    if (smo_cmd(dev, read_led_cdb, sizeof(read_led_cdb), SG_DXFER_FROM_DEV,
+                cid, SMO_REPLY_LEN, SMO_CMD_TIMEOUT,
+                "READ_10 command error") <= 0)
+        return -1;
+    for (i=0; i<SMO_REPLY_LEN; i++) {
+        if ((i != led) && (cid[i] != newBuff[i])) {
+            fprintf(out, "FAILED - Buffer comparison failed.\n");
+            return smo_led_failed;
+        }
+    }
+    if (cid[led] != SMO_LED_NEW) {
+        fprintf(out, "FAILED - Re-test or reject.\n");
+        return smo_led_failed;
+    }
+    fprintf(out, "PASSED.\n");
+    return smo_led_passed;
+}
+
+int smo_led_config(struct smo_session * s)
+{
+    struct smv_cid cid = smv_cid_view(s->cid);
+    char product_number[SMV_PRODUCT_NUMBER_LEN + 1], filename[32];
+    const char * what;
+    unsigned int i;
+    time_t rawtime;
+    struct tm timeinfo;
+    char date[32];
+    FILE *pFile;
+    int result;
+
+    if ((smo_identify(s) < 0) || (smo_read_cid(s) < 0))
+        return -1;
+    for (i=0; i<SMV_PRODUCT_NUMBER_LEN; i++)
+        product_number[i] = smv_cid_product_char(cid, i);
+    product_number[SMV_PRODUCT_NUMBER_LEN] = '\0';
+
+    if (memcmp(smv_inq_vendor(smv_inquiry_view(s->inq)), "VT", 2) != 0) {
+        fprintf(s->out, "NO RECONFIG - Not a Viking drive.\n");
+        result = smo_led_skipped;
+    }
+    else {
+        /* Only a write needs the reset */
+        if (smv_cid_led(cid, s->profile->led_offset) == SMO_LED_OLD)
+            s->reset_pending = 1;
+        result = smo_led_write(&s->dev, s->out, s->cid, s->profile->led_offset);
+        if (result < 0) {
+            s->have_cid = 0;
+            return -1;
+        }
+    }
+
+    what = (result == smo_led_passed) ? "PASSED" :
+           (result == smo_led_failed) ? "FAILED" :
+           (result == smo_led_done) ? "ALREADY CONFIGURED" : NULL;
+    snprintf(filename, sizeof(filename), "%s.txt", product_number);
+    if ((pFile = fopen(filename, "a")) == NULL)
+        fprintf(s->out, "Error opening log file.\n");
+    else {
+        time(&rawtime);
+        localtime_r(&rawtime, &timeinfo);
+        fprintf(pFile, "%s, %.16s, %s, %s", product_number,
+                smv_serial_number(smv_serial_view(s->inq_sn)),
+                what ? what : "NOT VIKING", asctime_r(&timeinfo, date));
+        fclose(pFile);
+    }
+    return result;
+}
+
+int smo_block_is_erased(const unsigned char * buf, unsigned int len)
+{
+    unsigned int i;
+
+    if ((buf[0] != 0) && (buf[0] != 0xFF))
+        return 0;
+    for (i=1; i<len; i++) {
+        if (buf[i] != buf[0])
+            return 0;
+    }
+    return 1;
+}
+
+unsigned int smo_erase_chunk(unsigned int block_size)
+{
+    return (block_size < SMO_ERASE_CHUNK_BYTES) ? SMO_ERASE_CHUNK_BYTES / block_size : 1;
+}
+
+int smo_erase_blocks(struct smd_dev * dev, FILE * out,
+                     enum smo_erase_method * method, unsigned int mu,
+                     unsigned int lba, unsigned int len,
+                     unsigned int block_size, unsigned char * buf)
+{
+    unsigned char cdb[16];
+    char text[96];
+    unsigned int chunk = smo_erase_chunk(block_size), at, nblk = 0, sample;
+    int ok, not_erased = 0;
+
+    /* Try the cheapest method first and stay with the first one the
+       module accepts for the remaining MUs */
+    if (*method == smo_erase_vendor) {
+        memcpy(cdb, erase_cdb, sizeof(cdb));
+        cdb[6] = mu & 0xFF;
+        ok = smo_cmd(dev, cdb, sizeof(cdb), SG_DXFER_NONE, NULL, 0,
+                     SMO_ERASE_TIMEOUT, NULL);
+        if (ok < 0)
+            return -1;
+        if (!ok) {
+            fprintf(out, "Vendor erase not accepted (%s), trying WRITE SAME\n",
+                    smd_status_str(&dev->last, text, sizeof(text)));
+            *method = smo_erase_write_same;
+        }
+    }
+    if (*method == smo_erase_write_same) {
+        /* WRITE SAME(16) with UNMAP, one zeroed block as the data */
+        memcpy(cdb, write_same_cdb, sizeof(cdb));
+        smc_rw16(cdb, lba, len);
+        ok = smo_cmd(dev, cdb, sizeof(cdb), SG_DXFER_TO_DEV, buf,
+                     block_size, SMO_ERASE_TIMEOUT, NULL);
+        if (ok < 0)
+            return -1;
+        if (!ok) {
+            fprintf(out, "WRITE SAME not accepted (%s), falling back to zero fill\n",
+                    smd_status_str(&dev->last, text, sizeof(text)));
+            *method = smo_erase_zero_fill;
+        }
+    }
+    if (*method == smo_erase_zero_fill) {
+        memcpy(cdb, write_16_cdb, sizeof(cdb));
+        for (at=lba, ok=1; (ok > 0) && (at<lba+len); at+=nblk) {
+            nblk = ((lba + len - at) < chunk) ? (lba + len - at) : chunk;
+            smc_rw16(cdb, at, nblk);
+            ok = smo_cmd(dev, cdb, sizeof(cdb), SG_DXFER_TO_DEV, buf,
+                         nblk * block_size, SMO_CMD_TIMEOUT, NULL);
+            if (ok < 0)
+                return -1;
+            /* smd_io() takes DID_ERROR on WRITE(16) as done, see
+               smd_policies[], but dev->last still has it */
+            if (!ok && (SMD_DID_ERROR == dev->last.host))
+                ok = 1;
+        }
+        /* A MU left partly written could still pass the sampling */
+        if (!ok) {
+            fprintf(out, "MU %u not erased, zero fill refused at lba %u (%s)\n",
+                    mu, at - nblk, smd_status_str(&dev->last, text, sizeof(text)));
+            return SMO_ERASE_SAMPLES;
+        }
+    }
+
+    /* Sample blocks spread evenly over the range */
+    memcpy(cdb, read_16_cdb, sizeof(cdb));
+    for (sample=0; (sample<SMO_ERASE_SAMPLES) && (len > 0); sample++) {
+        at = lba + (unsigned int)(((uint64_t)len * sample) / SMO_ERASE_SAMPLES);
+        smc_rw16(cdb, at, 1);
+        ok = smo_cmd(dev, cdb, sizeof(cdb), SG_DXFER_FROM_DEV, buf,
+                     block_size, SMO_CMD_TIMEOUT, "READ_16 command error");
+        if (ok < 0)
+            return -1;
+        if (!ok || !smo_block_is_erased(buf, block_size)) {
+            fprintf(out, "MU %u lba %u not erased\n", mu, at);
+            not_erased++;
+        }
+    }
+    /* The zero fill path writes from this buffer, keep it zeroed */
+    memset(buf, 0, block_size);
+    fprintf(out, "MU %u erased (%s)\n", mu,
+            (*method == smo_erase_vendor) ? "vendor erase" :
+            (*method == smo_erase_write_same) ? "WRITE SAME" : "zero fill");
+    return not_erased;
+}
+
+int smo_erase_mu(struct smo_session * s, unsigned int mu)
+{
+    unsigned int block_size, mu_lba, mu_len;
+
+    if (smo_identify(s) < 0)
+        return -1;
+    block_size = s->block_size ? s->block_size : SMO_REPLY_LEN;
+    if ((NULL == s->erase_buf) &&
+        ((s->erase_buf = calloc(smo_erase_chunk(block_size), block_size)) == NULL)) {
+        fprintf(s->out, "sg_SM3252: out of memory for the erase buffer\n");
+        return -1;
+    }
+    mu_lba = s->geom.lba_per_mu * mu;
+    mu_len = (mu == s->geom.total_mu - 1) ? s->geom.total_lba - mu_lba :
+                                            s->geom.lba_per_mu;
+    /* Whatever was scanned or read before describes the old contents */
+    s->scanned = 0;
+    s->have_cid = 0;
+    return smo_erase_blocks(&s->dev, s->out, &s->erase_method, mu, mu_lba,
+                            mu_len, block_size, s->erase_buf);
+}
+
+int smo_erase(struct smo_session * s)
+{
+    unsigned int mu;
+    int res, not_erased = 0;
+
+    if (smo_identify(s) < 0)
+        return -1;
+    for (mu=0; mu<s->geom.total_mu; mu++) {
+        if ((res = smo_erase_mu(s, mu)) < 0)
+            return -1;
+        not_erased += res;
+    }
+    return not_erased;
+}
+
+static void smo_print_unit(const struct smo_session * s)
+{
+    struct smv_inquiry inq = smv_inquiry_view(s->inq);
+
+    fprintf(s->out, "Vendor Identification  : %.8s\n", smv_inq_vendor(inq));
+    fprintf(s->out, "Product Identification : %.16s\n", smv_inq_product(inq));
+    fprintf(s->out, "Product Revision Level : %.4s\n", smv_inq_revision(inq));
+    fprintf(s->out, "Unit Serial Number     : %.16s\n",
+            smv_serial_number(smv_serial_view(s->inq_sn)));
+}
+
+void smo_print_ident(const struct smo_session * s)
+{
+    double disk_size = (double)(s->last_lba + 1) * s->block_size;
+
+    smo_print_unit(s);
+    fprintf(s->out, "Silicon Motion chip    : %.7s\n", s->chip[0] ? s->chip : "-");
+    fprintf(s->out, "Controller profile     : %s\n", s->profile->name);
+    fprintf(s->out, "Disk Size              : %.2f MiB or %.2f MB\n\n",
+            disk_size / 1048576, disk_size / 1000000);
+}
+
+void smo_print_info(const struct smo_session * s)
+{
+    double disk_size = (double)(s->last_lba + 1) * s->block_size;
+
+    smo_print_unit(s);
+    if (s->scanned) {
+        fprintf(s->out, "Silicon Motion chip    : %.7s\n", s->chip);
+        fprintf(s->out, "Controller profile     : %s\n", s->profile ? s->profile->name : "-");
+    }
+    fprintf(s->out, "\nBlock Size : %u Bytes\n", s->block_size);
+    fprintf(s->out, "Disk Size  : %.2f MiB or %.2f MB\n\n", disk_size / 1048576,
+            disk_size / 1000000);
+    fprintf(s->out, "Total MU       = %u\n", s->geom.total_mu);
+    fprintf(s->out, "Total LBA      = %u (0x%08X)\n", s->geom.total_lba, s->geom.total_lba);
+    fprintf(s->out, "LBA per MU     = %u\n", s->geom.lba_per_mu);
+    fprintf(s->out, "HalfLBA per MU = %u\n\n", s->geom.half_lba_per_mu);
+}
+
+void smo_print_scan(const struct smo_session * s)
+{
+    unsigned int mu;
+
+    fprintf(s->out, "  MU  Current_BB  Initial_BB  Data_Blocks  Initial_Spare  Current_Spare\n");
+    for (mu=0; mu<s->mu.count; mu++) {
+        fprintf(s->out, "%4u  %10u  %10u  %11u  %13u  ", mu, s->mu.current_badblock[mu],
+                s->mu.initial_badblock[mu], s->mu.total_datablock[mu],
+                s->mu.initial_spareblock[mu]);
+        if (s->mu_spare_ok[mu])
+            fprintf(s->out, "%13u", s->mu.current_spareblock[mu]);
+        else
+            fprintf(s->out, "%13s", "-");
+        fprintf(s->out, "%s\n", s->mu_found[mu] ? "" : "  (no system block)");
+    }
+    if (s->probe_window > 1)
+        fprintf(s->out, "%lu bad block probes queued %u at a time, %lu of them wasted below a match\n",
+                s->probes.probes, s->probe_window, s->probes.wasted);
+    fprintf(s->out, "\n");
+}
+
+void smo_print_cid(const struct smo_session * s)
+{
+    struct smv_cid cid = smv_cid_view(s->cid);
+    unsigned int i, j, led = smv_cid_led(cid, s->profile->led_offset);
+
+    fprintf(s->out, "VID                    : 0x%04X\n", smv_cid_vid(cid));
+    fprintf(s->out, "PID                    : 0x%04X\n", smv_cid_pid(cid));
+    fprintf(s->out, "LED setting            : 0x%02X (ready %u, busy %u)\n\n",
+            led, (led & 0x06) >> 1, (led & 0x60) >> 5);
+    fprintf(s->out, "   reply buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F\n");
+    fprintf(s->out, "                 -----------------------------------------------\n");
+    for (i=0; i<sizeof(s->cid); i+=16) {
+        fprintf(s->out, "       %3u-%3u = ", i, i + 15);
+        for (j=0; j<16; j++)
+            fprintf(s->out, "%02X ", s->cid[i + j]);
+        fprintf(s->out, "\n");
+    }
+    fprintf(s->out, "\n");
+}
@@ -0,0 +1,169 @@
+#ifndef SG_SM3252_OPS_H
+#define SG_SM3252_OPS_H
+
+#include <stdio.h>
+#include "sg_SM3252_dev.h"
+#include "sg_SM3252_health.h"
+#include "sg_SM3252_view.h"
+#include "sg_SM3252_prof.h"
+
+/* The steps of the SM3252 tools as functions over one open device, for
+   sg_SM3252 which chains several of them in a single run.
+
+   A session identifies the module once (INQUIRY, unit serial number,
+   READ CAPACITY and the basic information) and every later step works
+   from what was kept, so a station running info, scan and led on a drive
+   opens it once and asks each question once.  The steps print what they
+   find like the single purpose tools do. */
+
+#define SMO_REPLY_LEN       512
+#define SMO_INQ_REPLY_LEN   96
+#define SMO_BB_REPLY_LEN    1024
+#define SMO_CMD_TIMEOUT     20000   /* millisecs */
+#define SMO_ERASE_TIMEOUT   120000  /* millisecs for one vendor erase / WRITE SAME */
+#define SMO_ERASE_CHUNK_BYTES 65536 /* per zero fill write; usb-storage takes at
+                                       most 120 KiB per command on USB 2.0 */
+#define SMO_ERASE_SAMPLES   16      /* blocks read back per MU after an erase */
+
+/* smo_open() starts sessions at WRITE SAME.  The vendor erase 0xF0 0x0C
+   is not documented and its MU in CDB byte 6 is a guess after 0xF0 0x0A,
+   so it is only tried when the caller sets it. */
+enum smo_erase_method {smo_erase_vendor, smo_erase_write_same, smo_erase_zero_fill};
+
+/* Outcome of smo_led_config() and smo_led_write() */
+enum smo_led_result {smo_led_done, smo_led_passed, smo_led_failed, smo_led_skipped};
+
+struct smo_session {
+    const char * name;              /* device file, for messages */
+    FILE * out;                     /* what the steps print, stdout by default */
+    struct smd_dev dev;
+
+    /* smo_identify(), and STEPS 1 to 3 of it for smo_ident() */
+    int inquired, identified;
+    /* The INQUIRY replies, read through smv_inquiry_view() and
+       smv_serial_view() */
+    unsigned char inq[SMO_INQ_REPLY_LEN], inq_sn[SMO_INQ_REPLY_LEN];
+    unsigned int block_size, last_lba;
+    unsigned char basic_info[SMO_REPLY_LEN];
+    struct smd_geometry geom;
+    struct smd_arena arena;
+    struct smd_mu_table mu;
+    unsigned char * mu_found;       /* system block found by STEP 5 */
+    unsigned char * mu_spare_ok;    /* spare count read by STEP 6 */
+
+    /* smo_scan(), or for the chip name smo_ident() */
+    int scanned, ident_probed;
+    char chip[8];
+    /* Of the firmware from smo_identify() on, of the first system block
+       found once there is one */
+    const struct smp_profile * profile;
+    unsigned int probe_window;      /* > 1: STEP 5 probes queued, see smd_probe_window();
+                                       0: as many as the profile says */
+    struct smd_probe_stats probes;
+
+    /* smo_read_cid() */
+    int have_cid;
+    unsigned char cid[SMO_REPLY_LEN];
+
+    enum smo_erase_method erase_method;     /* the next to try */
+    unsigned char * erase_buf;
+    int reset_pending;              /* issued by smo_close() */
+};
+
+/* Open 'name' and check it is an sg v3 device.  Returns 0, or -1 after
+   printing why not. */
+extern int smo_open(struct smo_session * s, const char * name);
+
+/* Reset the module if a step asked for it, then free and close */
+extern void smo_close(struct smo_session * s);
+
+/* One command of at most 16 bytes.  Returns 1 when it completed, 0 on a
+   SCSI error (reported under 'leadin' unless that is NULL) and -1 when
+   the ioctl failed.  Recovered errors count as completed; like the
+   failures they go into dev->errors. */
+extern int smo_cmd(struct smd_dev * dev, const unsigned char * cdb,
+                   int cdb_len, int direction, void * buf, unsigned int len,
+                   unsigned int timeout, const char * leadin);
+
+/* STEPS 1 to 4, once per session.  Returns 0, or -1 when the module
+   can't be identified or reports no usable geometry. */
+extern int smo_identify(struct smo_session * s);
+
+/* Fast identification for inventories: INQUIRY, unit serial number,
+   READ CAPACITY and one bad block probe of MU 0 at the FBlk the profile
+   starts STEP 5 from, four commands in all and none of them per MU.  The
+   chip name is only known when that probe hits the system block (most
+   modules keep it in their top block, a profile file can say where a lot
+   keeps it); s->chip stays empty otherwise.  Returns 0, or -1 when the
+   module can't be identified. */
+extern int smo_ident(struct smo_session * s);
+
+/* STEP 5 and STEP 6 for one MU.  Returns 1 when both the system block
+   and the spare count were read, 0 when not, -1 on an ioctl failure. */
+extern int smo_scan_mu(struct smo_session * s, unsigned int mu);
+
+/* smo_scan_mu() for every MU.  Returns the MUs read completely or -1 */
+extern int smo_scan(struct smo_session * s);
+
+/* The scan as the health history keeps it, under the serial number with
+   blanks and control characters dropped ('serial' has room for
+   SMH_SERIAL_LEN + 1 characters) */
+extern void smo_health_scan(const struct smo_session * s, char * serial,
+                            struct smh_scan * scan);
+
+/* Append the scan to the health history of the unit in 'dir' */
+extern int smo_health_append(const struct smo_session * s, const char * dir);
+
+/* Read the CID/LED block (0xF0 0x02) once per session.  Returns 0 or -1 */
+extern int smo_read_cid(struct smo_session * s);
+
+/* Set the LED byte of the CID table to 0x82 and check nothing else
+   changed.  The result is also appended to <product_number>.txt.  The
+   reset that makes the new setting take effect is left to smo_close().
+   Returns the result, or -1 on an ioctl failure. */
+extern int smo_led_config(struct smo_session * s);
+
+/* Erase MU 'mu' with smo_erase_blocks().  Returns what that does. */
+extern int smo_erase_mu(struct smo_session * s, unsigned int mu);
+
+/* smo_erase_mu() for every MU */
+extern int smo_erase(struct smo_session * s);
+
+/* The LED patch and the fast erase work on a bare device as well, for
+   sg_read_SM3252_LED and sg_read_SM3252_Erase_Flash, which don't keep a
+   session */
+
+/* Set the LED byte at 'led' of the CID table in 'cid', as read with 0xF0
+   0x02, from 0x80 to 0x82 with 0xF1 0x03, read the table back into 'cid'
+   and check nothing else changed.  Prints the outcome to 'out'; no reset
+   is sent.  Returns smo_led_passed, smo_led_done when the byte was 0x82
+   already, smo_led_failed (nothing is written when the byte is neither),
+   or -1 on an ioctl failure. */
+extern int smo_led_write(struct smd_dev * dev, FILE * out, unsigned char * cid,
+                         unsigned int led);
+
+/* An erased block reads back as all 0x00 (unmapped) or all 0xFF (erased
+   NAND) */
+extern int smo_block_is_erased(const unsigned char * buf, unsigned int len);
+
+/* Blocks per zero fill write */
+extern unsigned int smo_erase_chunk(unsigned int block_size);
+
+/* Erase the 'len' blocks from 'lba', MU 'mu', with '*method' or, where
+   the module refuses it, the next slower one, which is left in '*method'
+   for the MUs after.  Then read SMO_ERASE_SAMPLES blocks spread evenly
+   over the range back.  'buf' holds smo_erase_chunk() blocks of zeroes
+   and is left so.  Returns the sampled blocks found not erased, all
+   SMO_ERASE_SAMPLES of them when a zero fill write was refused, or -1
+   on an ioctl failure. */
+extern int smo_erase_blocks(struct smd_dev * dev, FILE * out,
+                            enum smo_erase_method * method, unsigned int mu,
+                            unsigned int lba, unsigned int len,
+                            unsigned int block_size, unsigned char * buf);
+
+extern void smo_print_ident(const struct smo_session * s);
+extern void smo_print_info(const struct smo_session * s);
+extern void smo_print_scan(const struct smo_session * s);
+extern void smo_print_cid(const struct smo_session * s);
+
+#endif
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "sg_SM3252_prof.h"
+
+/* Controller profiles, see sg_SM3252_prof.h */
+
+#define SMP_MARKER          0xE1
+#define SMP_FLAGS_MASK      0x48
+#define SMP_FBLK_MAX        0x3FF   /* the probe CDB has 10 bits of FBlk */
+#define SMP_LINE_LEN        256
+
+/* Chip name bytes, the 0xE1 marker, and none of the 0x48 flags */
+#define SMP_SIG_MASK(c5) \
+    SMP_KEY(0xFF, 0xFF, 0xFF, 0xFF, 0xFF, c5, 0xFF, SMP_FLAGS_MASK)
+
+static const struct smp_profile smp_builtin[] = {
+    {"SM3252", "", SMP_KEY('S', 'M', '3', '2', '5', '2', SMP_MARKER, 0),
+     SMP_SIG_MASK(0xFF), {1014, 1020}, 0x3FF, 0x65, 0x187, 0},
+    /* Any other SM325x with the same system block, as the tools always
+       accepted it */
+    {"SM325x", "", SMP_KEY('S', 'M', '3', '2', '5', 0, SMP_MARKER, 0),
+     SMP_SIG_MASK(0), {1014, 1020}, 0x3FF, 0x65, 0x187, 0},
+};
+
+static const struct smp_profile * smp_table = smp_builtin;
+static unsigned int smp_count = sizeof(smp_builtin) / sizeof(smp_builtin[0]);
+
+/* The signature of 'chip' ("SM3252", or "SM325*" for a prefix) */
+static int smp_compile_chip(struct smp_profile * p, const char * chip)
+{
+    unsigned char c[SMP_CHIP_LEN], m[SMP_CHIP_LEN];
+    size_t i, len = strlen(chip);
+    int any = (len > 0) && ('*' == chip[len - 1]);
+
+    if (any)
+        len--;
+    if ((len > SMP_CHIP_LEN) || memchr(chip, '*', len))
+        return -1;
+    for (i = 0; i < SMP_CHIP_LEN; i++) {
+        c[i] = (i < len) ? (unsigned char)chip[i] : 0;
+        m[i] = ((i < len) || !any) ? 0xFF : 0;
+    }
+    p->sig = SMP_KEY(c[0], c[1], c[2], c[3], c[4], c[5], SMP_MARKER, 0);
+    p->sig_mask = SMP_KEY(m[0], m[1], m[2], m[3], m[4], m[5], 0xFF, SMP_FLAGS_MASK);
+    return 0;
+}
+
+/* One line of a profile file.  Returns 1, 0 for a blank or comment line,
+   or -1. */
+static int smp_parse(struct smp_profile * p, const char * line)
+{
+    char chip[SMP_LINE_LEN], revision[SMP_LINE_LEN];
+    int n, spare, led, end = 0;
+
+    memset(p, 0, sizeof(*p));
+    n = sscanf(line, " %15s %255s %255s %u %u %i %i %i %u %n", p->name, chip,
+               revision, &p->blocks[0], &p->blocks[1], &p->fblk_top, &spare,
+               &led, &p->probe_window, &end);
+    if ((n <= 0) || ('#' == p->name[0]))
+        return 0;
+    if ((n < 9) || (line[end] != '\0') || (strlen(revision) > SMP_REV_LEN) ||
+        (p->fblk_top < 0) || (p->fblk_top > SMP_FBLK_MAX) ||
+        (spare < 0) || (spare >= SMP_REPLY_LEN) ||
+        (led < 0) || (led >= SMP_REPLY_LEN) ||
+        (smp_compile_chip(p, chip) < 0))
+        return -1;
+    strcpy(p->revision, strcmp(revision, "-") ? revision : "");
+    p->spare_offset = spare;
+    p->led_offset = led;
+    return 1;
+}
+
+int smp_load(const char * file, unsigned int * line)
+{
+    struct smp_profile * t = NULL, * nt;
+    unsigned int n = 0, size = 0;
+    char buf[SMP_LINE_LEN];
+    FILE * fp;
+    int res = 0;
+
+    *line = 0;
+    if ((fp = fopen(file, "r")) == NULL)
+        return -1;
+    while (fgets(buf, sizeof(buf), fp)) {
+        (*line)++;
+        if (n == size) {
+            size = size ? (size * 2) : 8;
+            if ((nt = realloc(t, size * sizeof(*t))) == NULL) {
+                free(t);
+                fclose(fp);
+                errno = ENOMEM;
+                return -1;
+            }
+            t = nt;
+        }
+        if ((res = smp_parse(&t[n], buf)) < 0)
+            break;
+        n += res;
+    }
+    fclose(fp);
+    if ((res < 0) || (0 == n)) {
+        if (res >= 0)
+            *line = 0;
+        free(t);
+        errno = EINVAL;
+        return -1;
+    }
+    smp_table = t;
+    smp_count = n;
+    return n;
+}
+
+static int smp_for_revision(const struct smp_profile * p,
+                            const unsigned char * revision)
+{
+    return (NULL == revision) ||
+           (0 == memcmp(p->revision, revision, strlen(p->revision)));
+}
+
+const struct smp_profile * smp_default(const unsigned char * revision)
+{
+    unsigned int i;
+
+    for (i = 0; i < smp_count; i++) {
+        if (smp_for_revision(&smp_table[i], revision))
+            return &smp_table[i];
+    }
+    return &smp_table[0];
+}
+
+const struct smp_profile * smp_match(const unsigned char * reply,
+                                     const unsigned char * revision)
+{
+    uint64_t key = smp_sysblk_key(reply);
+    unsigned int i;
+
+    for (i = 0; i < smp_count; i++) {
+        if (((key & smp_table[i].sig_mask) == smp_table[i].sig) &&
+            smp_for_revision(&smp_table[i], revision))
+            return &smp_table[i];
+    }
+    return NULL;
+}
+
+int smp_sysblk_match(const unsigned char * reply)
+{
+    return smp_match(reply, NULL) != NULL;
+}
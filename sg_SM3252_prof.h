@@ -0,0 +1,103 @@
+#ifndef SG_SM3252_PROF_H
+#define SG_SM3252_PROF_H
+
+#include <stdint.h>
+
+/* Controller profiles of the SM325x family, and the system block
+   signature that tells which one a module has.
+
+   STEP 5 finds the system block of a MU by probing flash blocks until a
+   reply carries the controller's signature: the chip name at 0x114, the
+   0xE1 marker at 0x200 and none of the 0x48 flags at 0x210.  Those eight
+   bytes that matter (six of the chip name, the marker and the flags) are
+   packed into one 64 bit key per reply, and each profile is a value and a
+   mask over that key, so checking a reply against every known controller
+   costs one load per byte and one compare per profile, however many
+   profiles there are.  The first profile that matches wins; specific
+   chips come before the catch-all of their family.
+
+   Besides its signature a profile holds what the tools used to take for
+   granted of every SM325x: the blocks a MU has in all (data, bad and
+   spare), the FBlk probing starts from, where the spare count and the LED
+   byte are in their replies, and how many probes STEP 5 should keep
+   queued on it.  The built in profiles are the values the tools always
+   used.  smp_load() replaces them with a profile file, so a new module
+   lot needs a line in that file rather than a new build:
+
+     # name  chip    revision  blocks_mu0  blocks  fblk_top  spare  led    window
+     SM3252  SM3252  -         1014        1020    0x3FF     0x65   0x187  0
+     SM325x  SM325*  -         1014        1020    0x3FF     0x65   0x187  0
+
+   A chip ending in '*' matches any name starting with what is before it.
+   The revision is a prefix of the INQUIRY product revision the line is
+   for, '-' for any.  Numbers are decimal, or hex with 0x.  The file is
+   read once, before any device is opened, into a table that is not
+   changed afterwards; a device's profile is picked from it once, by
+   smp_default() until its first system block is found and by smp_match()
+   from then on. */
+
+/* The key of a system block reply, built by smp_sysblk_key() */
+#define SMP_KEY(c0, c1, c2, c3, c4, c5, marker, flags) \
+    ((uint64_t)(c0) | ((uint64_t)(c1) << 8) | ((uint64_t)(c2) << 16) | \
+     ((uint64_t)(c3) << 24) | ((uint64_t)(c4) << 32) | ((uint64_t)(c5) << 40) | \
+     ((uint64_t)(marker) << 48) | ((uint64_t)(flags) << 56))
+
+#define SMP_SYSBLK_CHIP     0x114
+#define SMP_SYSBLK_MARKER   0x200
+#define SMP_SYSBLK_FLAGS    0x210
+#define SMP_SYSBLK_LEN      (SMP_SYSBLK_FLAGS + 1)  /* reply bytes the key needs */
+
+#define SMP_NAME_LEN        15
+#define SMP_CHIP_LEN        6       /* chip name bytes in the key */
+#define SMP_REV_LEN         4
+#define SMP_REPLY_LEN       512     /* of the 0xF0 0xAA and 0xF0 0x02 replies */
+
+struct smp_profile {
+    char name[SMP_NAME_LEN + 1];    /* e.g. "SM3252" */
+    char revision[SMP_REV_LEN + 1]; /* firmware it is for, "" for any */
+    uint64_t sig;                   /* key of its system block ... */
+    uint64_t sig_mask;              /* ... in the bits that matter */
+    unsigned int blocks[2];         /* of MU 0 and of the other MUs, for STEP 5+ */
+    int fblk_top;                   /* first FBlk STEP 5 probes */
+    unsigned int spare_offset;      /* of the count in the 0xF0 0xAA reply */
+    unsigned int led_offset;        /* of the LED byte in the CID table */
+    unsigned int probe_window;      /* STEP 5 probes to queue, 0 for one at a time */
+};
+
+static inline uint64_t smp_sysblk_key(const unsigned char * reply)
+{
+    const unsigned char * c = reply + SMP_SYSBLK_CHIP;
+
+    return SMP_KEY(c[0], c[1], c[2], c[3], c[4], c[5],
+                   reply[SMP_SYSBLK_MARKER], reply[SMP_SYSBLK_FLAGS]);
+}
+
+/* Initial spare blocks of a MU of this profile (STEP 5+) */
+static inline unsigned int smp_initial_spare(const struct smp_profile * p,
+                                             unsigned int mu,
+                                             unsigned int datablock,
+                                             unsigned int initial_bb)
+{
+    return p->blocks[(mu == 0) ? 0 : 1] - datablock - initial_bb;
+}
+
+/* Replace the built in profiles with those of 'file'.  Call it before
+   any device is opened.  Returns the number of profiles, or -1 with errno
+   set; EINVAL means line '*line' is not a valid profile (0: the file has
+   none). */
+extern int smp_load(const char * file, unsigned int * line);
+
+/* The profile of a module with firmware 'revision' (the 4 bytes of the
+   INQUIRY product revision, or NULL) before a system block tells more:
+   the first one for that firmware, else the first one.  Never NULL. */
+extern const struct smp_profile * smp_default(const unsigned char * revision);
+
+/* Profile of the system block in 'reply' for firmware 'revision' (NULL
+   for any), or NULL when it is not one */
+extern const struct smp_profile * smp_match(const unsigned char * reply,
+                                            const unsigned char * revision);
+
+/* smp_match() of any firmware, as the match of smd_probe_window() */
+extern int smp_sysblk_match(const unsigned char * reply);
+
+#endif
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "sg_SM3252_sched.h"
+
+/* Work stealing scheduler, see sg_SM3252_sched.h */
+
+struct sms_deque {
+    unsigned int * slot;            /* job indexes, head first */
+    unsigned int n;
+};
+
+struct sms_sched {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct sms_job * jobs;
+    struct sms_group * groups;
+    unsigned int n_groups;
+    unsigned int n_workers;
+    unsigned int remaining;         /* jobs not done */
+    struct sms_deque * dq;
+    struct sms_stats stats;
+};
+
+struct sms_worker {
+    struct sms_sched * sc;
+    unsigned int id;
+};
+
+static struct sms_group * sms_group_of(struct sms_sched * sc,
+                                       const struct sms_job * job)
+{
+    return (job->group < sc->n_groups) ? &sc->groups[job->group] : NULL;
+}
+
+/* May the next step of 'job' start now?  Every rescan passes a held
+   step over again; it is counted once. */
+static int sms_runnable(struct sms_sched * sc, struct sms_job * job)
+{
+    struct sms_group * g = sms_group_of(sc, job);
+
+    if ((job->next != sms_next_bulk) || (NULL == g) || (0 == g->limit))
+        return 1;
+    if (g->active < g->limit)
+        return 1;
+    if (!job->held) {
+        job->held = 1;
+        g->held++;
+    }
+    return 0;
+}
+
+static double sms_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sms_window_start(struct sms_group * g, double now)
+{
+    g->win_steps = 0;
+    g->win_bytes = 0;
+    g->win_start = now;
+}
+
+/* A bulk step of an adaptive group moved 'bytes'.  Called with the lock
+   held. */
+static void sms_adapt(struct sms_group * g, unsigned long long bytes)
+{
+    double now = sms_now(), rate;
+
+    g->win_bytes += bytes;
+    if ((++g->win_steps < SMS_WINDOW_STEPS * g->limit) ||
+        ((now - g->win_start) * 1000 < SMS_WINDOW_MS))
+        return;
+    rate = g->win_bytes / (now - g->win_start);
+    if (g->probing) {
+        if (rate > g->best_rate * (100 + SMS_GAIN) / 100) {
+            g->best_rate = rate;
+            g->best_limit = g->limit;
+            if (g->limit < g->jobs)
+                g->limit++;
+            else
+                g->probing = 0;
+        }
+        else {
+            /* One more slot didn't pay, the hub is saturated */
+            g->limit = g->best_limit;
+            g->probing = 0;
+        }
+        g->settled = 0;
+    }
+    else {
+        g->best_rate = rate;
+        if ((++g->settled >= SMS_REPROBE) && (g->limit < g->jobs)) {
+            g->limit++;
+            g->probing = 1;
+            g->settled = 0;
+        }
+    }
+    sms_window_start(g, now);
+}
+
+static void sms_dq_remove(struct sms_deque * d, unsigned int pos)
+{
+    memmove(&d->slot[pos], &d->slot[pos + 1], (d->n - pos - 1) * sizeof(d->slot[0]));
+    d->n--;
+}
+
+static void sms_dq_push_head(struct sms_deque * d, unsigned int job)
+{
+    memmove(&d->slot[1], &d->slot[0], d->n * sizeof(d->slot[0]));
+    d->slot[0] = job;
+    d->n++;
+}
+
+/* Take a runnable job out of the worker's own deque, head first, else
+   out of another's, tail first.  Called with the lock held.  Returns the
+   job index or -1. */
+static int sms_take(struct sms_sched * sc, unsigned int self)
+{
+    struct sms_deque * d = &sc->dq[self];
+    unsigned int pos, w, victim;
+    int job;
+
+    for (pos=0; pos<d->n; pos++) {
+        if (sms_runnable(sc, &sc->jobs[d->slot[pos]])) {
+            job = d->slot[pos];
+            sms_dq_remove(d, pos);
+            return job;
+        }
+    }
+    for (w=1; w<sc->n_workers; w++) {
+        victim = (self + w) % sc->n_workers;
+        d = &sc->dq[victim];
+        for (pos=d->n; pos-- > 0; ) {
+            if (sms_runnable(sc, &sc->jobs[d->slot[pos]])) {
+                job = d->slot[pos];
+                sms_dq_remove(d, pos);
+                sc->stats.steals++;
+                return job;
+            }
+        }
+    }
+    return -1;
+}
+
+static void * sms_worker_main(void * arg)
+{
+    struct sms_worker * w = (struct sms_worker *)arg;
+    struct sms_sched * sc = w->sc;
+    struct sms_job * job;
+    struct sms_group * g;
+    enum sms_next prev;
+    unsigned long long bytes = 0;
+    int idx;
+
+    pthread_mutex_lock(&sc->lock);
+    while (sc->remaining > 0) {
+        if ((idx = sms_take(sc, w->id)) < 0) {
+            /* Everything left is running elsewhere or held by its group */
+            pthread_cond_wait(&sc->wake, &sc->lock);
+            continue;
+        }
+        job = &sc->jobs[idx];
+        job->held = 0;
+        g = sms_group_of(sc, job);
+        prev = job->next;
+        if (g && (prev == sms_next_bulk)) {
+            g->active++;
+            g->bulk_steps++;
+        }
+        if (job->bytes)
+            bytes = *job->bytes;
+        pthread_mutex_unlock(&sc->lock);
+
+        job->next = job->step(job->arg);
+
+        pthread_mutex_lock(&sc->lock);
+        job->steps++;
+        sc->stats.steps++;
+        if (g && (prev == sms_next_bulk)) {
+            g->active--;
+            if (g->adaptive && job->bytes)
+                sms_adapt(g, *job->bytes - bytes);
+        }
+        if (job->next == sms_done)
+            sc->remaining--;
+        else
+            sms_dq_push_head(&sc->dq[w->id], idx);
+        /* A group slot came free, a job came back or the tray is done */
+        pthread_cond_broadcast(&sc->wake);
+    }
+    pthread_mutex_unlock(&sc->lock);
+    return NULL;
+}
+
+int sms_run(struct sms_job * jobs, unsigned int n_jobs,
+            struct sms_group * groups, unsigned int n_groups,
+            unsigned int n_workers, struct sms_stats * stats)
+{
+    struct sms_sched sc;
+    struct sms_worker * workers;
+    pthread_t * tid;
+    unsigned int k, started = 0;
+    int res = 0;
+
+    if (n_workers < 1)
+        n_workers = 1;
+    if (n_workers > n_jobs)
+        n_workers = n_jobs ? n_jobs : 1;
+
+    memset(&sc, 0, sizeof(sc));
+    sc.jobs = jobs;
+    sc.groups = groups;
+    sc.n_groups = n_groups;
+    sc.n_workers = n_workers;
+    sc.remaining = n_jobs;
+    sc.stats.workers = n_workers;
+    for (k=0; k<n_groups; k++) {
+        groups[k].jobs = 0;
+        groups[k].active = 0;
+        groups[k].bulk_steps = 0;
+        groups[k].held = 0;
+        groups[k].best_rate = 0;
+        groups[k].best_limit = 1;
+        groups[k].probing = 1;
+        groups[k].settled = 0;
+        if (groups[k].adaptive)
+            groups[k].limit = 1;
+        sms_window_start(&groups[k], sms_now());
+    }
+    for (k=0; k<n_jobs; k++) {
+        if (jobs[k].group < n_groups)
+            groups[jobs[k].group].jobs++;
+    }
+
+    sc.dq = calloc(n_workers, sizeof(*sc.dq));
+    workers = calloc(n_workers, sizeof(*workers));
+    tid = calloc(n_workers, sizeof(*tid));
+    if ((NULL == sc.dq) || (NULL == workers) || (NULL == tid)) {
+        res = -1;
+        goto out;
+    }
+    for (k=0; k<n_workers; k++) {
+        if ((sc.dq[k].slot = calloc(n_jobs ? n_jobs : 1, sizeof(unsigned int))) == NULL) {
+            res = -1;
+            goto out;
+        }
+        workers[k].sc = &sc;
+        workers[k].id = k;
+    }
+    /* Deal the drives out round robin; stealing evens out the rest */
+    for (k=0; k<n_jobs; k++) {
+        jobs[k].steps = 0;
+        jobs[k].held = 0;
+        if (jobs[k].next == sms_done)
+            sc.remaining--;
+        else
+            sc.dq[k % n_workers].slot[sc.dq[k % n_workers].n++] = k;
+    }
+
+    pthread_mutex_init(&sc.lock, NULL);
+    pthread_cond_init(&sc.wake, NULL);
+    for (k=1; k<n_workers; k++) {
+        if (pthread_create(&tid[k], NULL, sms_worker_main, &workers[k]) != 0) {
+            perror("sg_SM3252: can't start worker thread");
+            break;
+        }
+        started++;
+    }
+    if (started + 1 < n_workers) {
+        /* Run with the workers there are, worker 0 takes over the jobs
+           dealt to the others */
+        pthread_mutex_lock(&sc.lock);
+        sc.n_workers = started + 1;
+        for (k=started+1; k<n_workers; k++) {
+            while (sc.dq[k].n > 0)
+                sms_dq_push_head(&sc.dq[0], sc.dq[k].slot[--sc.dq[k].n]);
+        }
+        pthread_mutex_unlock(&sc.lock);
+    }
+    /* The calling thread is worker 0 */
+    sms_worker_main(&workers[0]);
+    for (k=1; k<=started; k++)
+        pthread_join(tid[k], NULL);
+    pthread_cond_destroy(&sc.wake);
+    pthread_mutex_destroy(&sc.lock);
+    sc.stats.workers = started + 1;
+
+out:
+    if (sc.dq) {
+        for (k=0; k<n_workers; k++)
+            free(sc.dq[k].slot);
+    }
+    free(sc.dq);
+    free(workers);
+    free(tid);
+    if (stats)
+        *stats = sc.stats;
+    return res;
+}
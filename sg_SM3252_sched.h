@@ -0,0 +1,87 @@
+#ifndef SG_SM3252_SCHED_H
+#define SG_SM3252_SCHED_H
+
+/* Work stealing scheduler for a tray of drives, used by sg_SM3252.
+
+   The work of a drive is a sequence of short steps (identify, scan one
+   MU, erase one MU, the LED patch ...) run by a job's step function.  A
+   drive never has two steps running, so there is at most one command
+   outstanding per device, but between steps any worker may pick it up.
+
+   Each worker owns a deque of jobs.  It runs the next step of the job at
+   the head of its own deque and puts the job back at the head, so a
+   drive stays with its worker while that worker has nothing better to
+   do.  A worker whose deque has nothing runnable steals from the tail of
+   another worker's deque.  A drive needing a full scan then no longer
+   holds up the drives queued behind it: the worker that finished its one
+   second drives takes them over.
+
+   Steps that move a lot of data over the bus are marked bulk.  Jobs are
+   put in groups, e.g. the drives behind one USB hub, and a group runs at
+   most 'limit' bulk steps at once; other steps are never held back.
+
+   An adaptive group finds its limit itself.  It starts at one bulk step
+   and measures the bytes its bulk steps move per second over windows of
+   SMS_WINDOW_STEPS steps per slot (and at least SMS_WINDOW_MS).  While
+   another slot raises the throughput by more than SMS_GAIN percent the
+   limit goes up; when it doesn't, the limit goes back to the best one
+   seen.  Every SMS_REPROBE windows at that limit one more slot is tried
+   again, as the mix of steps changes during a run.
+
+   One mutex guards the deques.  A step is a USB round trip or many of
+   them, so it is not contended. */
+
+/* What a step function returns: what the next step of the job is */
+enum sms_next {sms_done, sms_next_step, sms_next_bulk};
+
+typedef enum sms_next (*sms_step_fn)(void * arg);
+
+#define SMS_WINDOW_STEPS    4
+#define SMS_WINDOW_MS       500
+#define SMS_GAIN            5
+#define SMS_REPROBE         8
+
+struct sms_group {
+    unsigned int limit;             /* bulk steps at once, 0: no limit */
+    int adaptive;                   /* find the limit from the throughput */
+    /* sms_run() */
+    unsigned int jobs;
+    unsigned int active;
+    unsigned long bulk_steps;
+    unsigned long held;             /* bulk steps held back, group full */
+    double best_rate;               /* bytes per second ... */
+    unsigned int best_limit;        /* ... with this many bulk steps */
+    int probing;
+    unsigned int settled;
+    unsigned int win_steps;
+    unsigned long long win_bytes;
+    double win_start;
+};
+
+struct sms_job {
+    void * arg;
+    sms_step_fn step;
+    unsigned int group;
+    enum sms_next next;             /* set to sms_next_step or _bulk */
+    /* Data the job has moved so far, e.g. &dev->stats.bytes; needed for
+       adaptive groups */
+    const unsigned long long * bytes;
+    unsigned long steps;            /* sms_run() */
+    int held;                       /* next step counted in its group's held */
+};
+
+struct sms_stats {
+    unsigned long steps;
+    unsigned long steals;
+    unsigned int workers;
+};
+
+/* Run every job to completion on 'n_workers' threads, the calling
+   thread among them.  Worker threads that can't be started leave their
+   jobs to the others, down to the calling thread alone.  Returns 0, or
+   -1 when out of memory for the deques; no job has run then. */
+extern int sms_run(struct sms_job * jobs, unsigned int n_jobs,
+                   struct sms_group * groups, unsigned int n_groups,
+                   unsigned int n_workers, struct sms_stats * stats);
+
+#endif
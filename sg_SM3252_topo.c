@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include "sg_SM3252_topo.h"
+
+/* USB topology of sg devices from sysfs, see sg_SM3252_topo.h */
+
+/* A USB device directory is <bus>-<port>[.<port>...], e.g. "1-2.3";
+   interfaces ("1-2.3:1.0") and everything else are not */
+static int smt_is_usb_device(const char * c, int len)
+{
+    int i = 0, ports = 0;
+
+    while ((i < len) && (c[i] >= '0') && (c[i] <= '9'))
+        i++;
+    if ((0 == i) || (i >= len) || (c[i] != '-'))
+        return 0;
+    for (i++; i < len; i++) {
+        if ((c[i] >= '0') && (c[i] <= '9'))
+            ports = 1;
+        else if ((c[i] != '.') || !ports)
+            return 0;
+    }
+    return ports;
+}
+
+int smt_usb_hub(const char * dev_name, char * hub, int hub_len)
+{
+    char node[PATH_MAX], link[PATH_MAX + 48], path[PATH_MAX];
+    const char * base, * c, * next, * dev_start = NULL, * hub_end = NULL;
+
+    /* /dev/sgN, or a link to it */
+    if (NULL == realpath(dev_name, node))
+        return -1;
+    base = strrchr(node, '/');
+    base = base ? base + 1 : node;
+    snprintf(link, sizeof(link), "/sys/class/scsi_generic/%s/device", base);
+    if (NULL == realpath(link, path))
+        return -1;
+
+    /* The last USB device component is the module, the one before it
+       its hub */
+    for (c = path; *c; c = next) {
+        while ('/' == *c)
+            c++;
+        next = strchr(c, '/');
+        if (NULL == next)
+            next = c + strlen(c);
+        if (smt_is_usb_device(c, next - c)) {
+            dev_start = c;
+            hub_end = c - 1;
+        }
+    }
+    if ((NULL == dev_start) || (hub_end - path >= hub_len))
+        return -1;
+    memcpy(hub, path, hub_end - path);
+    hub[hub_end - path] = '\0';
+    return 0;
+}
+
+const char * smt_hub_name(const char * hub)
+{
+    const char * p = strrchr(hub, '/');
+
+    return p ? p + 1 : hub;
+}
+
+int smt_usb_sg_devices(char *** names)
+{
+    char name[PATH_MAX], hub[PATH_MAX];
+    char ** list = NULL, ** nl;
+    struct dirent * e;
+    int n = 0, size = 0;
+    DIR * d;
+
+    if ((d = opendir("/sys/class/scsi_generic")) == NULL)
+        return -1;
+    while ((e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, "sg", 2) != 0)
+            continue;
+        snprintf(name, sizeof(name), "/dev/%s", e->d_name);
+        if (smt_usb_hub(name, hub, sizeof(hub)) < 0)
+            continue;
+        if (n == size) {
+            size = size ? (size * 2) : 16;
+            if ((nl = realloc(list, size * sizeof(*list))) == NULL)
+                break;
+            list = nl;
+        }
+        if ((list[n] = strdup(name)) == NULL)
+            break;
+        n++;
+    }
+    closedir(d);
+    *names = list;
+    return n;
+}
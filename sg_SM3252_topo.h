@@ -0,0 +1,29 @@
+#ifndef SG_SM3252_TOPO_H
+#define SG_SM3252_TOPO_H
+
+/* Where an sg device sits on the USB bus, from sysfs.
+
+   /sys/class/scsi_generic/sgN/device leads to the SCSI device, below
+   the USB device of the module, e.g.
+
+     /sys/devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2.3/1-2.3:1.0/host6/...
+
+   Here the module is 1-2.3, on port 3 of hub 1-2.  The modules on one
+   hub share its upstream link, so that is what concurrent bulk commands
+   contend for. */
+
+/* Put the sysfs directory of the hub 'dev_name' hangs off in 'hub'
+   (".../usb1/1-2" above; the root hub ".../usb1" for a module on a root
+   port).  Returns 0, or -1 when the device is not an sg device on USB or
+   the name does not fit. */
+extern int smt_usb_hub(const char * dev_name, char * hub, int hub_len);
+
+/* Last component of a hub directory, "1-2" or "usb1" */
+extern const char * smt_hub_name(const char * hub);
+
+/* The sg devices on USB, "/dev/sgN" in '*names' (each and the array
+   malloc()ed) in the order sysfs lists them.  Returns how many, or -1
+   when sysfs can't be read. */
+extern int smt_usb_sg_devices(char *** names);
+
+#endif
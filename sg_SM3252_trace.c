@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sg_SM3252_trace.h"
+#include "sg_SM3252_dev.h"
+#include "sg_SM3252_cdb.h"
+
+/* Chrome trace of the SG_IO commands, see sg_SM3252_trace.h */
+
+struct smtr_event {
+    uint64_t submit, complete;      /* ns since smtr_start() */
+    const char * name;              /* lane name; NULL for a command */
+    int fd;
+    unsigned int duration;          /* millisecs, as the device reported */
+    unsigned int dxfer_len;
+    int resid;
+    unsigned char cdb[16];
+    unsigned char attempt;
+    unsigned char err;
+};
+
+struct smtr_chunk {
+    struct smtr_chunk * next;
+    unsigned int n;
+    struct smtr_event ev[SMTR_CHUNK];
+};
+
+struct smtr_thread {
+    struct smtr_thread * next;
+    unsigned int id;
+    struct smtr_chunk * head;
+    struct smtr_chunk * tail;
+};
+
+volatile int smtr_on;
+static struct timespec smtr_base;
+static struct smtr_thread * volatile smtr_threads;
+static unsigned int smtr_thread_ids;
+static __thread struct smtr_thread * smtr_self;
+static const char * smtr_file;
+
+void smtr_start(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &smtr_base);
+    smtr_on = 1;
+}
+
+uint64_t smtr_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)(ts.tv_sec - smtr_base.tv_sec) * 1000000000ULL +
+           ts.tv_nsec - smtr_base.tv_nsec;
+}
+
+/* Next free event of the calling thread, NULL when out of memory */
+static struct smtr_event * smtr_slot(void)
+{
+    struct smtr_thread * t = smtr_self;
+    struct smtr_chunk * c;
+
+    if (NULL == t) {
+        if ((t = calloc(1, sizeof(*t))) == NULL)
+            return NULL;
+        t->id = __sync_add_and_fetch(&smtr_thread_ids, 1);
+        do
+            t->next = smtr_threads;
+        while (!__sync_bool_compare_and_swap(&smtr_threads, t->next, t));
+        smtr_self = t;
+    }
+    c = t->tail;
+    if ((NULL == c) || (c->n == SMTR_CHUNK)) {
+        if ((c = malloc(sizeof(*c))) == NULL)
+            return NULL;
+        c->next = NULL;
+        c->n = 0;
+        if (t->tail)
+            t->tail->next = c;
+        else
+            t->head = c;
+        t->tail = c;
+    }
+    return &c->ev[c->n++];
+}
+
+void smtr_name(int fd, const char * name)
+{
+    struct smtr_event * e;
+
+    if (!smtr_on || ((e = smtr_slot()) == NULL))
+        return;
+    memset(e, 0, sizeof(*e));
+    e->fd = fd;
+    e->name = strdup(name);
+}
+
+void smtr_record(int fd, const sg_io_hdr_t * io_hdr, uint64_t submit,
+                 int attempt, int err)
+{
+    struct smtr_event * e;
+    unsigned int len = io_hdr->cmd_len;
+
+    if ((e = smtr_slot()) == NULL)
+        return;
+    e->complete = smtr_now();
+    e->submit = submit;
+    e->name = NULL;
+    e->fd = fd;
+    e->duration = io_hdr->duration;
+    e->dxfer_len = io_hdr->dxfer_len;
+    e->resid = io_hdr->resid;
+    if (len > sizeof(e->cdb))
+        len = sizeof(e->cdb);
+    memset(e->cdb, 0, sizeof(e->cdb));
+    memcpy(e->cdb, io_hdr->cmdp, len);
+    e->attempt = (attempt > 255) ? 255 : attempt;
+    e->err = err;
+}
+
+static const char * smtr_op_name(const unsigned char * cdb, char * buf, int len)
+{
+    switch (cdb[0]) {
+    case 0x12: return "INQUIRY";
+    case 0x25: return "READ CAPACITY(10)";
+    case 0x28: return "READ(10)";
+    case 0x88: return "READ(16)";
+    case 0x8A: return "WRITE(16)";
+    case 0x93: return "WRITE SAME(16)";
+    case 0xF0:
+        switch (cdb[1]) {
+        case 0x02: return "F0 02 read CID";
+        case 0x0A: return "F0 0A bad block probe";
+        case 0x0C: return "F0 0C erase";
+        case 0x20: return "F0 20 basic information";
+        case 0x2C: return "F0 2C reset";
+        case 0xAA: return "F0 AA spare blocks";
+        }
+        break;
+    case 0xF1:
+        if (0x03 == cdb[1])
+            return "F1 03 write CID";
+        break;
+    }
+    snprintf(buf, len, "%02X %02X", cdb[0], cdb[1]);
+    return buf;
+}
+
+/* What the CDB addresses: MU and FBlk of the vendor commands, LBA and
+   length of the reads and writes */
+static void smtr_write_addr(FILE * f, const unsigned char * cdb)
+{
+    switch (cdb[0]) {
+    case 0x28:
+        fprintf(f, ",\"lba\":%u", (unsigned int)smc_get_be32(cdb + 2));
+        break;
+    case 0x88:
+    case 0x8A:
+    case 0x93:
+        fprintf(f, ",\"lba\":%u,\"blocks\":%u", (unsigned int)smc_get_be32(cdb + 6),
+                (unsigned int)smc_get_be32(cdb + 10));
+        break;
+    case 0xF0:
+        if (0x0A == cdb[1])
+            fprintf(f, ",\"mu\":%u,\"fblk\":%u", cdb[6], smc_get_be16(cdb + 2));
+        else if (0x0C == cdb[1])
+            fprintf(f, ",\"mu\":%u", cdb[6]);
+        break;
+    }
+}
+
+static void smtr_write_string(FILE * f, const char * s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (('"' == *s) || ('\\' == *s))
+            fputc('\\', f);
+        if ((unsigned char)*s >= ' ')
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+int smtr_write(const char * file_name)
+{
+    const struct smtr_thread * t;
+    const struct smtr_chunk * c;
+    const struct smtr_event * e;
+    const char * sep = "";
+    char op[8];
+    unsigned int i;
+    int pid = getpid(), res;
+    FILE * f;
+
+    if ((f = fopen(file_name, "w")) == NULL)
+        return -1;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (t = smtr_threads; t; t = t->next) {
+        for (c = t->head; c; c = c->next) {
+            for (i=0; i<c->n; i++) {
+                e = &c->ev[i];
+                if (e->name) {
+                    fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                            "\"tid\":%d,\"args\":{\"name\":", sep, pid, e->fd);
+                    smtr_write_string(f, e->name);
+                    fprintf(f, "}}");
+                }
+                else {
+                    fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"sg_io\",\"ph\":\"X\","
+                            "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{",
+                            sep, smtr_op_name(e->cdb, op, sizeof(op)),
+                            e->submit / 1e3, (e->complete - e->submit) / 1e3,
+                            pid, e->fd);
+                    fprintf(f, "\"device_ms\":%u,\"bytes\":%u,\"resid\":%d,"
+                            "\"attempt\":%u,\"thread\":%u,\"status\":\"%s\"",
+                            e->duration, e->dxfer_len, e->resid, e->attempt,
+                            t->id, smd_err_name((enum smd_err)e->err));
+                    smtr_write_addr(f, e->cdb);
+                    fprintf(f, "}}");
+                }
+                sep = ",";
+            }
+        }
+    }
+    fprintf(f, "\n]}\n");
+    res = ferror(f) ? -1 : 0;
+    if (fclose(f) != 0)
+        res = -1;
+    return res;
+}
+
+static void smtr_write_file(void)
+{
+    if (smtr_write(smtr_file) < 0)
+        perror("error writing the trace");
+    else
+        printf("Trace of the SG_IO commands written to %s\n", smtr_file);
+}
+
+void smtr_start_file(const char * file_name)
+{
+    smtr_file = file_name;
+    atexit(smtr_write_file);
+    smtr_start();
+}
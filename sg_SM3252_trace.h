@@ -0,0 +1,50 @@
+#ifndef SG_SM3252_TRACE_H
+#define SG_SM3252_TRACE_H
+
+#include <stdint.h>
+#include <scsi/sg.h>
+
+/* Command timeline of the SM3252 tools, written as a Chrome trace.
+
+   Once smtr_start() was called, smd_io() records every SG_IO attempt as a
+   span: the CDB, the host's submit and completion times, the duration the
+   device reported and how the attempt ended.  A trace opens in
+   chrome://tracing or ui.perfetto.dev with one lane per device, so the
+   concurrency of a tray of drives and the gaps between commands show.
+
+   Recording is a copy into a buffer of the calling thread; no lock is
+   taken and nothing is formatted.  A thread's buffer grows in chunks of
+   SMTR_CHUNK events (about 64 bytes each) and is put on the list of
+   buffers with a single compare and swap the first time the thread
+   records.  The opcode, MU, FBlk and LBA are only decoded from the CDB
+   when smtr_write() writes the file. */
+
+#define SMTR_CHUNK      4096
+
+/* Non-zero after smtr_start() */
+extern volatile int smtr_on;
+
+/* Start recording; timestamps count from now */
+extern void smtr_start(void);
+
+/* Nanoseconds since smtr_start() */
+extern uint64_t smtr_now(void);
+
+/* Name the lane of the device on 'fd', e.g. after its INQUIRY */
+extern void smtr_name(int fd, const char * name);
+
+/* One SG_IO attempt on 'fd' that was submitted at 'submit' and has just
+   completed; 'err' is its enum smd_err */
+extern void smtr_record(int fd, const sg_io_hdr_t * io_hdr, uint64_t submit,
+                        int attempt, int err);
+
+/* Write everything recorded so far as Chrome trace JSON.  Only call it
+   when no other thread is recording any more.  Returns 0, or -1 with
+   errno set. */
+extern int smtr_write(const char * file_name);
+
+/* smtr_start(), and smtr_write() to 'file_name' when the tool exits, so
+   the commands of a run that gave up half way are in the trace too */
+extern void smtr_start_file(const char * file_name);
+
+#endif
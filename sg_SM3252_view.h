@@ -0,0 +1,188 @@
+#ifndef SG_SM3252_VIEW_H
+#define SG_SM3252_VIEW_H
+
+#include <string.h>
+#include "sg_SM3252_cdb.h"
+
+/* Typed views over the replies the SM3252 tools parse.
+
+   SG_IO transfers the reply straight into the buffer the command was
+   issued with (io_hdr.dxferp) and the sense data into io_hdr.sbp, so
+   there is nothing to copy out of io_hdr afterwards.  A view is that
+   buffer wrapped in a struct of its own type, so a system block reply
+   can't be handed to a CID accessor by mistake, and the accessors read
+   the fields where they are.  A field read through a view is only good
+   until the buffer is reused for the next command; whatever has to
+   outlive it is decoded into a number or copied by the caller. */
+
+#define SMV_VENDOR_LEN      8
+#define SMV_PRODUCT_LEN     16
+#define SMV_REVISION_LEN    4
+#define SMV_SERIAL_LEN      16
+#define SMV_CHIP_LEN        7       /* "SM3252" + the variant letter */
+#define SMV_PRODUCT_NUMBER_LEN  18
+
+/* Standard INQUIRY */
+struct smv_inquiry {
+    const unsigned char * b;
+};
+
+/* The unit serial number INQUIRY (the tools send it without EVPD, the
+   serial starts at byte 4 either way) */
+struct smv_serial {
+    const unsigned char * b;
+};
+
+/* 0xF0 0x20: basic information */
+struct smv_basic_info {
+    const unsigned char * b;
+};
+
+/* 0xF0 0x0A: the system block region 0x100 - 0x210 of a flash block */
+struct smv_sysblk {
+    const unsigned char * b;
+};
+
+/* 0xF0 0xAA: current spare blocks of the MU selected by the READ(10) */
+struct smv_spare {
+    const unsigned char * b;
+};
+
+/* 0xF0 0x02: CID table */
+struct smv_cid {
+    const unsigned char * b;
+};
+
+static inline struct smv_inquiry smv_inquiry_view(const unsigned char * reply)
+{
+    struct smv_inquiry v = {reply};
+    return v;
+}
+
+static inline struct smv_serial smv_serial_view(const unsigned char * reply)
+{
+    struct smv_serial v = {reply};
+    return v;
+}
+
+static inline struct smv_basic_info smv_basic_info_view(const unsigned char * reply)
+{
+    struct smv_basic_info v = {reply};
+    return v;
+}
+
+static inline struct smv_sysblk smv_sysblk_view(const unsigned char * reply)
+{
+    struct smv_sysblk v = {reply};
+    return v;
+}
+
+static inline struct smv_spare smv_spare_view(const unsigned char * reply)
+{
+    struct smv_spare v = {reply};
+    return v;
+}
+
+static inline struct smv_cid smv_cid_view(const unsigned char * reply)
+{
+    struct smv_cid v = {reply};
+    return v;
+}
+
+/* INQUIRY: space padded, not terminated; print with "%.8s" etc. */
+static inline const unsigned char * smv_inq_vendor(struct smv_inquiry v)
+{
+    return v.b + 8;
+}
+
+static inline const unsigned char * smv_inq_product(struct smv_inquiry v)
+{
+    return v.b + 16;
+}
+
+static inline const unsigned char * smv_inq_revision(struct smv_inquiry v)
+{
+    return v.b + 32;
+}
+
+static inline int smv_inq_flags(struct smv_inquiry v)
+{
+    return v.b[7];
+}
+
+static inline const unsigned char * smv_serial_number(struct smv_serial v)
+{
+    return v.b + 4;
+}
+
+/* Basic information */
+static inline unsigned int smv_basic_total_mu(struct smv_basic_info v)
+{
+    return v.b[1];
+}
+
+static inline uint32_t smv_basic_total_lba(struct smv_basic_info v)
+{
+    return smc_get_be32(v.b + 0x14);
+}
+
+/* System block; whether a reply is one, and of which controller, is
+   smp_match() in sg_SM3252_prof.h */
+static inline unsigned int smv_sysblk_current_badblock(struct smv_sysblk v)
+{
+    return smc_get_be16(v.b + 0x100);
+}
+
+/* Bad blocks grown since the factory, the difference to the initial ones */
+static inline unsigned int smv_sysblk_grown_badblock(struct smv_sysblk v)
+{
+    return smc_get_be16(v.b + 0x104);
+}
+
+static inline unsigned int smv_sysblk_initial_badblock(struct smv_sysblk v)
+{
+    return smv_sysblk_current_badblock(v) - smv_sysblk_grown_badblock(v);
+}
+
+static inline unsigned int smv_sysblk_datablock(struct smv_sysblk v)
+{
+    return smc_get_be16(v.b + 0x112);
+}
+
+static inline const unsigned char * smv_sysblk_chip(struct smv_sysblk v)
+{
+    return v.b + 0x114;
+}
+
+/* The offset of the count is in the controller profile, see
+   sg_SM3252_prof.h */
+static inline unsigned int smv_spare_count(struct smv_spare v, unsigned int offset)
+{
+    return v.b[offset];
+}
+
+/* CID table */
+
+static inline unsigned int smv_cid_vid(struct smv_cid v)
+{
+    return smc_get_le16(v.b + 0x08);
+}
+
+static inline unsigned int smv_cid_pid(struct smv_cid v)
+{
+    return smc_get_le16(v.b + 0x0A);
+}
+
+/* As the spare count, the LED byte is where the profile says */
+static inline unsigned int smv_cid_led(struct smv_cid v, unsigned int offset)
+{
+    return v.b[offset];
+}
+
+/* The product number is stored in the low bytes of 16 bit characters */
+static inline unsigned char smv_cid_product_char(struct smv_cid v, unsigned int i)
+{
+    return v.b[86 + (i * 2)];
+}
+
+#endif
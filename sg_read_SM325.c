@@ -1,6 +1,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <time.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -9,6 +10,13 @@
 #include <sys/stat.h>
 #include "sg_lib.h"
 #include "sg_io_linux.h"
+#include "sg_SM3252_health.h"
+#include "sg_SM3252_dev.h"
+#include "sg_SM3252_cdb.h"
+#include "sg_SM3252_view.h"
+#include "sg_SM3252_prof.h"
+#include "sg_SM3252_trace.h"
+#include "sg_SM3252_board.h"
 
 /* This program performs a similar READ_10 command as scsi mid-level support
    16 byte commands from lk 2.4.15 to read basic information from SM325 chip
@@ -19,7 +27,28 @@
 *  the Free Software Foundation; either version 2, or (at your option)
 *  any later version.
 
-   Invocation: sg_read_SM325 <scsi_device>
+   Invocation: sg_read_SM325 [-B] [-C <controller_file>] [-H <store_dir>] [-I] [-R <retries>]
+                             [-S <board>] [-T <profile_dir>] [-t <trace_file>]
+                             [-W <window>] <scsi_device>
+
+   -B queues the READ(10) / 0xF0 0xAA pair of each MU of STEP 6 on the
+   device instead of waiting for each command; STEP 6 prints how long it
+   took either way, so the two can be compared.
+   -W <window> does the same for the bad block probes of STEP 5, with
+   <window> FBlks in flight per MU (see smd_probe_window()); without it
+   the controller profile says how many.
+   -I only identifies the module: STEPS 1 to 3 and one bad block probe
+   of MU 0 for the chip name, in place of STEPS 4 to 6 (see smo_ident()
+   of sg_SM3252, whose ident command does this for many drives at once).
+   -C replaces the built in controller profiles, which hold the spare
+   block totals of STEP 5+ and the reply offsets, with those of
+   <controller_file> (see sg_SM3252_prof.h).
+   With -H the per-MU results are appended to the health history of the
+   unit in <store_dir> (see sg_SM3252_health.h and sg_SM3252_hist).
+   -R overrides the number of retries of a failed command, which otherwise
+   depends on the command (see smd_io() in sg_SM3252_dev.c).
+   -T shortens command timeouts to what this product and firmware has
+   needed so far, learned in <profile_dir>.
 
    Version 1.02 (20020206)
 
@@ -41,20 +70,118 @@
 #define INQ_CMD_LEN       6
 
 #define EBUFF_SZ 256
-#define MAX_MU   256
 
 enum read_steps {basic_info, init_and_current_badblocks, current_spare_blocks_1, current_spare_blocks_2}; 
 enum inq_read_steps {inq_basic_info, inq_unit_serial_number}; 
 
+/* One queued command of the batched STEP 6 */
+struct spare_slot {
+    sg_io_hdr_t hdr;
+    unsigned char cdb[READ10_CMD_LEN];
+    unsigned char sense[32];
+    unsigned char reply[READ10_REPLY_LEN];
+    uint64_t t_submit;
+};
+
+/* STEP 6 with the READ(10) / 0xF0 0xAA pair of each MU queued on the sg
+   device (sg v3 write() and read(), see smd_queue_submit()) instead of
+   one SG_IO round trip after the other.  The pair goes to the tail of
+   the queue and only one pair is in flight, so each 0xF0 0xAA runs right
+   after the READ(10) that selects its MU.  The completions are counted
+   and traced like the commands of smd_io(), but not retried.  mu_ok[mu]
+   is set for the MUs whose pair both completed.  Returns the number of
+   such MUs, -1 when the queue can't be used at all, or -2 when the device
+   failed with a command still queued and can't be used any more. */
+static int spare_query_batched(struct smd_dev * dev, unsigned char cdb_tbl[][READ10_CMD_LEN],
+                               unsigned int total_mu, unsigned int lba_per_mu,
+                               unsigned int spare_offset, unsigned short * spare,
+                               unsigned char * mu_ok)
+{
+    struct spare_slot * slot, * sp;
+    sg_io_hdr_t hdr;
+    enum smd_io_class cls;
+    unsigned int mu;
+    int k, in_flight, sel_ok, err = 0, count = 0;
+
+    if ((slot = calloc(2, sizeof(*slot))) == NULL)
+        return -1;
+    for (mu = 0; mu < total_mu; mu++) {
+        mu_ok[mu] = 0;
+        for (k = 0, in_flight = 0; k < 2; k++) {
+            sp = &slot[k];
+            memcpy(sp->cdb, cdb_tbl[k ? current_spare_blocks_2 : current_spare_blocks_1],
+                   READ10_CMD_LEN);
+            if (0 == k)
+                smc_read10_lba(sp->cdb, (lba_per_mu * mu) + (lba_per_mu / 2));
+            memset(&sp->hdr, 0, sizeof(sg_io_hdr_t));
+            sp->hdr.interface_id = 'S';
+            sp->hdr.cmd_len = READ10_CMD_LEN;
+            sp->hdr.mx_sb_len = sizeof(sp->sense);
+            sp->hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+            sp->hdr.dxfer_len = READ10_REPLY_LEN;
+            sp->hdr.dxferp = sp->reply;
+            sp->hdr.cmdp = sp->cdb;
+            sp->hdr.sbp = sp->sense;
+            sp->hdr.timeout = 20000;
+            sp->hdr.pack_id = k;
+            sp->hdr.usr_ptr = sp;
+            if (smd_queue_submit(dev, &sp->hdr, &sp->t_submit) < 0) {
+                err = errno;
+                break;
+            }
+            in_flight++;
+        }
+        if ((0 == mu) && (0 == in_flight)) {
+            free(slot);
+            return -1;
+        }
+        /* A READ(10) without its 0xF0 0xAA is read back and dropped */
+        for (sel_ok = 0; in_flight > 0; in_flight--) {
+            if (smd_queue_read(dev, &hdr) < 0) {
+                /* The kernel still owns the slots of what is queued */
+                perror("sg_read_SM325: queued spare query read error");
+                return -2;
+            }
+            sp = (struct spare_slot *)hdr.usr_ptr;
+            cls = smd_queue_done(dev, &hdr, sp->t_submit);
+            if ((smd_io_ok != cls) && (smd_io_recovered != cls))
+                continue;
+            if (0 == hdr.pack_id)
+                sel_ok = 1;
+            else if (sel_ok) {
+                spare[mu] = smv_spare_count(smv_spare_view(sp->reply), spare_offset);
+                mu_ok[mu] = 1;
+                count++;
+            }
+        }
+        if (k < 2) {
+            errno = err;
+            perror("sg_read_SM325: queued spare query write error");
+            break;
+        }
+    }
+    free(slot);
+    return count;
+}
+
 int main(int argc, char * argv[])
 {
     int sg_fd, k, ok, i, j, FBlk;
     sg_io_hdr_t io_hdr;
+    struct smd_dev dev;
+    int max_retries = -1;
+    char * profile_dir = 0;
+    char * trace_file = 0;
+    int batched = 0, n_batched = -1;
+    int found, ident_only = 0;
+    unsigned int window = 0, mu_window, queued = 0;
+    struct smd_probe_stats probe_stats = {0, 0};
+    unsigned char *mu_ok;
+    struct timespec t_start, t_end;
+    char profile_name[EBUFF_SZ] = "";
     char * file_name = 0;
     char ebuff[EBUFF_SZ];
     unsigned char sense_buffer[32];
-    unsigned char FourBytes[4], TwoBytes[2];
-    unsigned char *ptr2Buffer;
 
     unsigned char r10CmdBlk[4][READ10_CMD_LEN] =
              { {0xF0, 0x20, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0},
@@ -64,30 +191,55 @@ int main(int argc, char * argv[])
     unsigned char inBuff[READ10_REPLY_LEN];
     unsigned char inBuffBB[READBB_REPLY_LEN];
     unsigned int Total_MU=0, Total_LBA=0, LBA_per_MU=0, HalfLBA_per_MU=0, mu, SLBA;
-    int Current_BadBlock[MAX_MU], Initial_BadBlock[MAX_MU], Total_DataBlock[MAX_MU];
-    int Initial_SpareBlock[MAX_MU], Current_SpareBlock[MAX_MU];
+    unsigned short *Current_BadBlock, *Initial_BadBlock, *Total_DataBlock;
+    unsigned short *Initial_SpareBlock, *Current_SpareBlock;
+    struct smd_geometry geom;
+    struct smd_arena arena;
+    struct smd_mu_table mu_table;
     
     unsigned char inqCmdBlk [2][INQ_CMD_LEN] =
              { {0x12, 0, 0, 0, INQ_REPLY_LEN, 0}, {0x12, 0, 0x80, 0, INQ_REPLY_LEN, 0} };
-    unsigned char inqBuff[INQ_REPLY_LEN];
-    unsigned char VendorID[8], ProductID[16], ProductRevision[4], UnitSerialNumber[16], SMIChip[8];
+    /* Each INQUIRY gets its own buffer; the fields are read in place */
+    unsigned char inqBuff[INQ_REPLY_LEN], snBuff[INQ_REPLY_LEN];
+    struct smv_inquiry inq = smv_inquiry_view(inqBuff);
+    struct smv_serial sn = smv_serial_view(snBuff);
+    struct smv_sysblk sb = smv_sysblk_view(inBuffBB);
+    const unsigned char * UnitSerialNumber = smv_serial_number(sn);
+    unsigned char SMIChip[SMV_CHIP_LEN + 1];
+    const struct smp_profile * profile = NULL, * matched;
+    char * controller_file = 0;
+    unsigned int line;
 
     unsigned char capCmdBlk [READCAP_CMD_LEN] =
               {0x25, 0, 0, 0, 0, 0, 0, 0, 0, 0};
     unsigned char capBuff[READCAP_REPLY_LEN];
     unsigned int  BlockSize=0, DiskSize=0;
-    
-    /* Initialize results to 0 */
-    for (i = 0; i < MAX_MU; i++) {
-       Current_BadBlock[i] = 0;
-       Initial_BadBlock[i] = 0;
-       Total_DataBlock[i]  = 0;
-       Initial_SpareBlock[i] = 0;
-       Current_SpareBlock[i] = 0;
-    }
+    char * health_dir = 0;
+    char * board_name = 0;
+    struct smb_board * board;
+    char serial[SMH_SERIAL_LEN + 1];
+    struct smh_scan scan;
     
     for (k = 1; k < argc; ++k) {
-        if (*argv[k] == '-') {
+        if ((0 == strcmp("-R", argv[k])) && (k + 1 < argc))
+            max_retries = atoi(argv[++k]);
+        else if ((0 == strcmp("-C", argv[k])) && (k + 1 < argc))
+            controller_file = argv[++k];
+        else if ((0 == strcmp("-T", argv[k])) && (k + 1 < argc))
+            profile_dir = argv[++k];
+        else if (0 == strcmp("-I", argv[k]))
+            ident_only = 1;
+        else if (0 == strcmp("-B", argv[k]))
+            batched = 1;
+        else if ((0 == strcmp("-W", argv[k])) && (k + 1 < argc))
+            window = (unsigned int)atoi(argv[++k]);
+        else if ((0 == strcmp("-H", argv[k])) && (k + 1 < argc))
+            health_dir = argv[++k];
+        else if ((0 == strcmp("-S", argv[k])) && (k + 1 < argc))
+            board_name = argv[++k];
+        else if ((0 == strcmp("-t", argv[k])) && (k + 1 < argc))
+            trace_file = argv[++k];
+        else if (*argv[k] == '-') {
             printf("Unrecognized switch: %s\n", argv[k]);
             file_name = 0;
             break;
@@ -101,7 +253,34 @@ int main(int argc, char * argv[])
         }
     }
     if (0 == file_name) {
-        printf("Usage: 'sg_read_SM325 <sg_device>'\n");
+        printf("Usage: 'sg_read_SM325 [-B] [-C <controller_file>] [-H <store_dir>] [-I] [-R <retries>] [-S <board>] [-T <profile_dir>] [-t <trace_file>] [-W <window>] <sg_device>'\n");
+        printf("  -B    queue the spare block queries of all MUs instead of one at a time\n");
+        printf("  -C    controller profiles from <controller_file> instead of the built in ones\n");
+        printf("  -H    append this scan to the health history in <store_dir>\n");
+        printf("  -I    identification, chip and capacity only, with four commands\n");
+        printf("  -R    retries of a failed SG_IO command (default: depends on the command)\n");
+        printf("  -S    publish this scan in the shared memory results board <board>,\n");
+        printf("        e.g. %s\n", SMB_DEFAULT_NAME);
+        printf("  -T    learn command timeouts from observed latencies, kept per product\n");
+        printf("        and firmware in <profile_dir>\n");
+        printf("  -t    write every SG_IO command to <trace_file> as a Chrome trace\n");
+        printf("        (chrome://tracing, ui.perfetto.dev)\n");
+        printf("  -W    keep <window> bad block probes of STEP 5 queued on the device\n");
+        printf("        (at most %d) instead of waiting for each one (default: as the\n",
+               SMD_PROBE_WINDOW_MAX);
+        printf("        controller profile says)\n");
+        return 1;
+    }
+    if (controller_file && (smp_load(controller_file, &line) < 0)) {
+        if ((EINVAL == errno) && line)
+            printf("sg_read_SM325: %s line %u is not a controller profile\n",
+                   controller_file, line);
+        else if (EINVAL == errno)
+            printf("sg_read_SM325: no controller profile in %s\n", controller_file);
+        else {
+            snprintf(ebuff, EBUFF_SZ, "sg_read_SM325: error reading %s", controller_file);
+            perror(ebuff);
+        }
         return 1;
     }
 
@@ -118,6 +297,16 @@ int main(int argc, char * argv[])
         close(sg_fd);
         return 1;
     }
+    smd_dev_init(&dev, sg_fd);
+    dev.max_retries = max_retries;
+    if (trace_file) {
+        smtr_start_file(trace_file);
+        smtr_name(sg_fd, file_name);
+    }
+    /* What a failed command leaves out prints as blanks */
+    memset(inqBuff, 0, sizeof(inqBuff));
+    memset(snBuff, 0, sizeof(snBuff));
+    memset(SMIChip, 0, sizeof(SMIChip));
 
     /* 1. Prepare INQUIRY command for Vendor ID, Product ID, Product Revision */
     /**************************************************************************/
@@ -136,7 +325,7 @@ int main(int argc, char * argv[])
     /* io_hdr.pack_id = 0; */
     /* io_hdr.usr_ptr = NULL; */
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
         perror("sg_simple1: Inquiry SG_IO ioctl error");
         close(sg_fd);
         return 1;
@@ -158,10 +347,10 @@ int main(int argc, char * argv[])
     }
 
     if (ok) { /* output result if it is available */
-        char * p = (char *)inqBuff;
-        int f = (int)*(p + 7);
+        int f = smv_inq_flags(inq);
         printf("Some of the INQUIRY command's results for Vendor ID, Product ID and Revision:\n");
-        printf("    %.8s  %.16s  %.4s  ", p + 8, p + 16, p + 32);
+        printf("    %.8s  %.16s  %.4s  ", smv_inq_vendor(inq), smv_inq_product(inq),
+               smv_inq_revision(inq));
         printf("[wide=%d sync=%d cmdque=%d sftre=%d]\n",
                !!(f & 0x20), !!(f & 0x10), !!(f & 2), !!(f & 1));
         printf("INQUIRY duration=%u millisecs, resid=%d, msg_status=%d\n",
@@ -169,7 +358,6 @@ int main(int argc, char * argv[])
 #ifdef DEBUG_FLAG
 	    printf(" inquiry buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-   		memcpy( inqBuff, io_hdr.dxferp, sizeof(inqBuff));
 	    for (i=0; i<8; i++)  /* 8 rows */
 	    {
 	      printf("       %3d-%3d = ", i*j, (i*j)+31);
@@ -181,17 +369,23 @@ int main(int argc, char * argv[])
 	    }
         printf("\n");
 #endif
-   		memcpy( VendorID, p + 8, sizeof(VendorID));
-   		memcpy( ProductID, p + 16, sizeof(ProductID));
-   		memcpy( ProductRevision, p + 32, sizeof(ProductRevision));
+    }
+
+    /* Timeouts learned on earlier runs with this product and firmware */
+    if (ok && profile_dir &&
+        (smd_lat_profile_name(profile_dir, smv_inq_vendor(inq), smv_inq_product(inq), smv_inq_revision(inq),
+                              profile_name, sizeof(profile_name)) == 0)) {
+        smd_lat_load(&dev, profile_name);
+        dev.adaptive = 1;
     }
 
     /* 2. Prepare INQUIRY command for Unit Serial Number */
     /*****************************************************/
     io_hdr.cmd_len = sizeof(inqCmdBlk[inq_unit_serial_number]);
     io_hdr.cmdp = inqCmdBlk[inq_unit_serial_number];
+    io_hdr.dxferp = snBuff;
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
         perror("sg_simple1: Inquiry SG_IO ioctl error");
         close(sg_fd);
         return 1;
@@ -213,10 +407,9 @@ int main(int argc, char * argv[])
     }
 
     if (ok) { /* output result if it is available */
-        char * p = (char *)inqBuff;
-        int f = (int)*(p + 7);
+        int f = (int)snBuff[7];
         printf("Some of the INQUIRY command's results for Unit Serial Number:\n");
-        printf("    %.16s  ", p + 4);
+        printf("    %.16s  ", UnitSerialNumber);
         printf("[wide=%d sync=%d cmdque=%d sftre=%d]\n",
                !!(f & 0x20), !!(f & 0x10), !!(f & 2), !!(f & 1));
         printf("INQUIRY duration=%u millisecs, resid=%d, msg_status=%d\n",
@@ -224,19 +417,17 @@ int main(int argc, char * argv[])
 #ifdef DEBUG_FLAG
 	    printf(" inquiry buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-   		memcpy( inqBuff, io_hdr.dxferp, sizeof(inqBuff));
 	    for (i=0; i<8; i++)  /* 8 rows */
 	    {
 	      printf("       %3d-%3d = ", i*j, (i*j)+31);
 
 	      for (j=0; j<32; j++)
-	         printf("%c ", inqBuff[i+j]);
+	         printf("%c ", snBuff[i+j]);
 	   
 	      printf("\n");
 	    }
         printf("\n");
 #endif
-   		memcpy( UnitSerialNumber, p + 4, sizeof(UnitSerialNumber));
     }
 
     /* 3. Prepare READ CAPACITY command for Block Size and Disk Size */
@@ -246,7 +437,7 @@ int main(int argc, char * argv[])
     io_hdr.dxferp = capBuff;
     io_hdr.cmdp = capCmdBlk;
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
         perror("sg_simple1: READ CAPACITY SG_IO ioctl error");
         close(sg_fd);
         return 1;
@@ -273,22 +464,59 @@ int main(int argc, char * argv[])
 #ifdef DEBUG_FLAG
 	    printf(" readcap buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-   		memcpy( capBuff, io_hdr.dxferp, sizeof(capBuff));
         printf("                 ");
         for (j=0; j<8; j++)
 	        printf("%02X ", capBuff[j]);
 	    printf("\n");
 #endif
-        FourBytes[0] = capBuff[7];
-        FourBytes[1] = capBuff[6];
-        FourBytes[2] = capBuff[5];
-        FourBytes[3] = capBuff[4];
-        BlockSize  = *(int *)FourBytes;
-        FourBytes[0] = capBuff[3];
-        FourBytes[1] = capBuff[2];
-        FourBytes[2] = capBuff[1];
-        FourBytes[3] = capBuff[0];
-        DiskSize  = ((*(int *)FourBytes) + 1) * BlockSize;
+        BlockSize  = smc_readcap_block_size(capBuff);
+        DiskSize  = (smc_readcap_last_lba(capBuff) + 1) * BlockSize;
+    }
+
+    /* -I. One bad block probe of MU 0 for the chip name, where the
+       profile says STEP 5 starts; the module is not scanned */
+    /******************************************************************/
+    if (ident_only)
+    {
+        profile = smp_default(smv_inq_revision(inq));
+        smc_bad_block_probe(r10CmdBlk[init_and_current_badblocks], profile->fblk_top, 0);
+        io_hdr.cmd_len = sizeof(r10CmdBlk[init_and_current_badblocks]);
+        io_hdr.cmdp = r10CmdBlk[init_and_current_badblocks];
+        io_hdr.dxfer_len = READBB_REPLY_LEN;
+        io_hdr.dxferp = inBuffBB;
+        if (smd_io(&dev, &io_hdr) < 0) {
+            perror("sg_read_SM325: READ_10 SG_IO ioctl error");
+            close(sg_fd);
+            return 1;
+        }
+        if (smd_status_ok(&dev.last) && smp_sysblk_match(inBuffBB))
+        {
+            memcpy( SMIChip, smv_sysblk_chip(sb), SMV_CHIP_LEN);
+            matched = smp_match(inBuffBB, smv_inq_revision(inq));
+            if (matched)
+                profile = matched;
+        }
+
+        printf("\n   *********** THE RESULT IS: **********\n\n");
+        printf("Vendor Identification  : %.8s\n", smv_inq_vendor(inq));
+        printf("Product Identification : %.16s\n", smv_inq_product(inq));
+        printf("Product Revision Level : %.4s\n", smv_inq_revision(inq));
+        printf("Unit Serial Number     : %.16s\n", UnitSerialNumber);
+        printf("Silicon Motion chip    : %.7s\n", SMIChip[0] ? (char *)SMIChip : "-");
+        printf("Controller profile     : %s\n\n", profile->name);
+        printf("Block Size : %d Bytes\n", BlockSize);
+        printf("Disk Size  : %.2f MiB or %.2f MB\n\n", (float)(DiskSize / BYTES_IN_MiB), (float)(DiskSize / BYTES_IN_MB));
+
+        if (profile_name[0]) {
+            smd_lat_print(&dev);
+            if (smd_lat_save(&dev, profile_name) < 0)
+                perror("sg_read_SM325: error saving timeout profile");
+        }
+        smd_print_stats(&dev, "sg_read_SM325");
+        smd_print_errors(&dev, "sg_read_SM325");
+        smd_dev_release(&dev);
+        close(sg_fd);
+        return 0;
     }
 
     /* 4. Prepare READ_10 command for reading basic information */
@@ -308,7 +536,7 @@ int main(int argc, char * argv[])
     /* io_hdr.pack_id = 0; */
     /* io_hdr.usr_ptr = NULL; */
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
 	   perror("sg_read_SM325: Inquiry SG_IO ioctl error");
 	   close(sg_fd);
 	   return 1;
@@ -333,7 +561,6 @@ int main(int argc, char * argv[])
 	    printf("\n  STEP 4: READ BASIC INFORMATION\n");
 	    printf("READ_10 duration=%u millisecs, resid=%d, msg_status=%d \n",
 	       io_hdr.duration, io_hdr.resid, (int)io_hdr.msg_status);
-	    memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
 /*	    
 	    printf("\n        sense buffer= ");
 	    for (j=0; j<32; j++)
@@ -344,7 +571,6 @@ int main(int argc, char * argv[])
 	    /* Print out io_hdr.deferp */
 	    printf("   reply buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-	    memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
 	    for (i=0; i<8; i++)  /* 8 rows */
 	    {
 	      printf("       %3d-%3d = ", i*j, (i*j)+31);
@@ -356,14 +582,13 @@ int main(int argc, char * argv[])
 	    }
         printf("\n");
 #endif
-        Total_MU   = inBuff[1];
-        FourBytes[0] = inBuff[0x17];
-        FourBytes[1] = inBuff[0x16];
-        FourBytes[2] = inBuff[0x15];
-        FourBytes[3] = inBuff[0x14];
-        Total_LBA  = *(int *)FourBytes;
-        LBA_per_MU = Total_LBA / Total_MU;
-        HalfLBA_per_MU = LBA_per_MU / 2;
+        if (smd_geometry_decode(inBuff, &geom) < 0)
+            printf("Invalid geometry: Total MU = %d, Total LBA = 0x%02X%02X%02X%02X\n",
+                   inBuff[1], inBuff[0x14], inBuff[0x15], inBuff[0x16], inBuff[0x17]);
+        Total_MU   = geom.total_mu;
+        Total_LBA  = geom.total_lba;
+        LBA_per_MU = geom.lba_per_mu;
+        HalfLBA_per_MU = geom.half_lba_per_mu;
 
         printf("Total MU       = %d\n", Total_MU);
         printf("Total LBA      = %d (0x%X)\n", Total_LBA, Total_LBA);
@@ -371,6 +596,21 @@ int main(int argc, char * argv[])
         printf("HalfLBA per MU = %d\n\n", HalfLBA_per_MU);
     }
 
+    /* Size the per-MU results by the MU count the module reports */
+    if ((0 == Total_MU) ||
+        (smd_arena_init(&arena, smd_mu_table_size(Total_MU) + Total_MU) < 0) ||
+        (smd_mu_table_alloc(&arena, Total_MU, &mu_table) < 0) ||
+        ((mu_ok = smd_arena_alloc(&arena, Total_MU)) == NULL)) {
+        printf("sg_read_SM325: no usable MU geometry, can't read the MUs\n");
+        close(sg_fd);
+        return 1;
+    }
+    Current_BadBlock   = mu_table.current_badblock;
+    Initial_BadBlock   = mu_table.initial_badblock;
+    Total_DataBlock    = mu_table.total_datablock;
+    Initial_SpareBlock = mu_table.initial_spareblock;
+    Current_SpareBlock = mu_table.current_spareblock;
+
     /* 5. Prepare READ_10 command to get Initial and Current BadBlock numbers for each MU */
     /**************************************************************************************/
     printf("\n  STEP 5: READ EACH MU INITIAL AND CURRENT BADBLOCKS\n");
@@ -378,19 +618,45 @@ int main(int argc, char * argv[])
     io_hdr.dxfer_len = READBB_REPLY_LEN;
     io_hdr.dxferp = inBuffBB;
 
+    /* The firmware picks the profile until the first system block does */
+    profile = smp_default(smv_inq_revision(inq));
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
     /* Loop through each MU */
     for (mu=0; mu<Total_MU; mu++)
     {
+        /* With -W, or when the profile says so, the probes are queued a
+           window at a time */
+        found = -2;
+        mu_window = window ? window : profile->probe_window;
+        if (mu_window > 1)
+        {
+            found = smd_probe_window(&dev, r10CmdBlk[init_and_current_badblocks], mu,
+                                     profile->fblk_top, mu_window, 20000,
+                                     smp_sysblk_match, inBuffBB, READBB_REPLY_LEN,
+                                     &probe_stats);
+            if (-3 == found)
+            {
+                perror("sg_read_SM325: read() of a queued probe failed");
+                close(sg_fd);
+                return 1;
+            }
+            if (-2 == found)
+            {
+                printf("Queued probes not supported, probing one FBlk at a time\n");
+                window = 1;
+            }
+            else
+            {
+                queued = mu_window;
+                if (found >= 0)
+                    printf("\n   PROCESSING MU NUMBER: %d\nSystem block at FBlk 0x%03X\n", mu, found);
+            }
+        }
+
         /* Loop through each FBlk */
-        for (FBlk=0x3FF; FBlk>=0; FBlk--)
+        for (FBlk=profile->fblk_top; (-2 == found) && (FBlk>=0); FBlk--)
         {
-            TwoBytes[0] = (FBlk >> 8) & 0x03;
-            TwoBytes[1] = FBlk & 0xFF;
-            ptr2Buffer = &r10CmdBlk[init_and_current_badblocks][2];
-            memcpy( ptr2Buffer, TwoBytes, 2);
-            TwoBytes[0] = ((unsigned int)mu) & 0xFF;
-            ptr2Buffer = &r10CmdBlk[init_and_current_badblocks][6];
-            memcpy( ptr2Buffer, TwoBytes, 1);
+            smc_bad_block_probe(r10CmdBlk[init_and_current_badblocks], FBlk, mu);
             io_hdr.cmdp = r10CmdBlk[init_and_current_badblocks];
 		    printf("Cmd buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F\n");
 	        printf("            -----------------------------------------------\n");
@@ -399,26 +665,15 @@ int main(int argc, char * argv[])
 		       printf("%02X ", r10CmdBlk[init_and_current_badblocks][j]);
 		    printf("\n");
 
-	        if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+	        if (smd_io(&dev, &io_hdr) < 0) {
 		       perror("sg_read_SM325: Inquiry SG_IO ioctl error");
 		       close(sg_fd);
 		    return 1;
 	        }
 
-	        /* now for the error processing */
-	        ok = 0;
-	        switch (sg_err_category3(&io_hdr)) {
-	           case SG_LIB_CAT_CLEAN:
-		          ok = 1;
-		          break;
-	           case SG_LIB_CAT_RECOVERED:
-		          printf("Recovered error on READ_10, continuing\n");
-		          ok = 1;
-		          break;
-	           default: /* won't bother decoding other categories */
-		          sg_chk_n_print3("READ_10 command error", &io_hdr, 1);
-		          break;
-	        }
+	        /* A probe of a block without a system block may fail; those are
+	           counted in dev.errors and summed up at the end, not printed */
+	        ok = smd_status_ok(&dev.last);
 
 	        if (ok) { /* output result if it is available */
                printf("\n   PROCESSING MU NUMBER: %d\n", mu);
@@ -426,9 +681,6 @@ int main(int argc, char * argv[])
 		           io_hdr.duration, io_hdr.resid, (int)io_hdr.msg_status);
 
                /* Check the result to see if this MU has any BadBlock */
-		       memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-       		   memcpy( inBuffBB, io_hdr.dxferp, sizeof(inBuffBB));
-
 #ifdef DEBUG_FLAG
 	       	   /* Print out io_hdr.deferp Reply Buffer */
 		       printf("   reply buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
@@ -441,49 +693,52 @@ int main(int argc, char * argv[])
 		       }
 		       printf("\n");
 #endif
-               ptr2Buffer = &inBuffBB[0x114];
-               if ((inBuffBB[0x114] == 0x53) &&  /* "S" */
-                   (inBuffBB[0x115] == 0x4D) &&  /* "M" */
-                   (inBuffBB[0x116] == 0x33) &&  /* "3" */
-                   (inBuffBB[0x117] == 0x32) &&  /* "2" */
-                   (inBuffBB[0x118] == 0x35) &&  /* "5" */
-                   (inBuffBB[0x200] == 0xE1) &&
-                   ((inBuffBB[0x210] & 0x48) == 0))
+               if (smp_sysblk_match(inBuffBB))
                {
-                  TwoBytes[0] = inBuffBB[0x101];
-                  TwoBytes[1] = inBuffBB[0x100];
-                  Current_BadBlock[mu] = *(int *)TwoBytes;
-                  TwoBytes[0] = inBuffBB[0x105];
-                  TwoBytes[1] = inBuffBB[0x104];
-                  Initial_BadBlock[mu] = Current_BadBlock[mu] - (*(int *)TwoBytes);
-                  TwoBytes[0] = inBuffBB[0x113];
-                  TwoBytes[1] = inBuffBB[0x112];
-                  Total_DataBlock[mu] = *(int *)TwoBytes;
-   		          memcpy( SMIChip, ptr2Buffer, sizeof(SMIChip));
-
-		          printf("Current MU = %d\n", mu);
-		          printf("Current_BadBlock   = %d (0x%04X)\n", Current_BadBlock[mu], Current_BadBlock[mu]);
-		          printf("Initial_BadBlock   = %d (0x%04X)\n", Initial_BadBlock[mu], Initial_BadBlock[mu]);
-		          printf("Total_DataBlock    = %d (0x%04X)\n\n", Total_DataBlock[mu], Total_DataBlock[mu]);
-		          
-		          break;
+                  found = FBlk;
+                  break;
                }
 	        }
         }  /* end of for loop each FBlk */
+
+        /* inBuffBB holds the system block */
+        if (found >= 0)
+        {
+            Current_BadBlock[mu] = smv_sysblk_current_badblock(sb);
+            Initial_BadBlock[mu] = smv_sysblk_initial_badblock(sb);
+            Total_DataBlock[mu] = smv_sysblk_datablock(sb);
+            /* Every MU carries the same chip name, keep the first; it
+               settles the profile */
+            if (SMIChip[0] == 0)
+            {
+                memcpy( SMIChip, smv_sysblk_chip(sb), SMV_CHIP_LEN);
+                matched = smp_match(inBuffBB, smv_inq_revision(inq));
+                if (matched)
+                    profile = matched;
+            }
+
+            printf("Current MU = %d\n", mu);
+            printf("Current_BadBlock   = %d (0x%04X)\n", Current_BadBlock[mu], Current_BadBlock[mu]);
+            printf("Initial_BadBlock   = %d (0x%04X)\n", Initial_BadBlock[mu], Initial_BadBlock[mu]);
+            printf("Total_DataBlock    = %d (0x%04X)\n\n", Total_DataBlock[mu], Total_DataBlock[mu]);
+        }
         
         /* 5+. Calculate Initial Spare Numbers for each MU */
         /**************************************************/
-        if (mu == 0)
-        {
-           Initial_SpareBlock[mu] = 1014 - Total_DataBlock[mu] - Initial_BadBlock[mu];
-        }
-        else
-        {
-           Initial_SpareBlock[mu] = 1020 - Total_DataBlock[mu] - Initial_BadBlock[mu];
-        }
+        Initial_SpareBlock[mu] = smp_initial_spare(profile, mu, Total_DataBlock[mu],
+                                                   Initial_BadBlock[mu]);
         
     }  /* end of for loop each mu */
 
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    printf("\nSTEP 5 took %.1f millisecs for %u MUs",
+           ((t_end.tv_sec - t_start.tv_sec) * 1e3) + ((t_end.tv_nsec - t_start.tv_nsec) / 1e6),
+           Total_MU);
+    if (queued > 1)
+        printf(", %lu probes queued %u at a time, %lu of them wasted below a match\n",
+               probe_stats.probes, queued, probe_stats.wasted);
+    else
+        printf(", one probe at a time\n");
         
     /* 6. Get Current Spare Numbers for each MU */
     /********************************************/
@@ -492,16 +747,42 @@ int main(int argc, char * argv[])
     io_hdr.dxfer_len = READ10_REPLY_LEN;
     io_hdr.dxferp = inBuff;
 
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    if (batched)
+    {
+        n_batched = spare_query_batched(&dev, r10CmdBlk, Total_MU, LBA_per_MU,
+                                        profile->spare_offset, Current_SpareBlock,
+                                        mu_ok);
+        if (-2 == n_batched)
+        {
+            close(sg_fd);
+            return 1;
+        }
+        if (n_batched < 0)
+            printf("Queued spare queries not supported, reading one MU at a time\n");
+        else
+        {
+            for (mu=0; mu<Total_MU; mu++)
+            {
+                if (mu_ok[mu])
+                    printf("Current MU = %d\nCurrent_SpareBlock   = %d (0x%02X)\n",
+                           mu, Current_SpareBlock[mu], Current_SpareBlock[mu]);
+            }
+            if (n_batched < (int)Total_MU)
+                printf("%d of %u MUs failed in the queue, reading them one at a time\n",
+                       (int)Total_MU - n_batched, Total_MU);
+        }
+    }
+
     for (mu=0; mu<Total_MU; mu++)
     {
+        /* Already read by the batched query */
+        if ((n_batched >= 0) && mu_ok[mu])
+            continue;
+
         SLBA = (LBA_per_MU * mu) + HalfLBA_per_MU;
 
-        FourBytes[0] = (SLBA >> 24) & 0xFF;
-        FourBytes[1] = (SLBA >> 16) & 0xFF;
-        FourBytes[2] = (SLBA >> 8) & 0xFF;
-        FourBytes[3] = SLBA & 0xFF;
-        ptr2Buffer = &r10CmdBlk[current_spare_blocks_1][2];
-        memcpy( ptr2Buffer, FourBytes, 4);
+        smc_read10_lba(r10CmdBlk[current_spare_blocks_1], SLBA);
         io_hdr.cmdp = r10CmdBlk[current_spare_blocks_1];
 	    printf("Cmd buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F\n");
         printf("            -----------------------------------------------\n");
@@ -510,7 +791,7 @@ int main(int argc, char * argv[])
 	       printf("%02X ", r10CmdBlk[current_spare_blocks_1][j]);
 	    printf("\n");
 
-        if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+        if (smd_io(&dev, &io_hdr) < 0) {
 	       perror("sg_read_SM325: Inquiry SG_IO ioctl error");
 	       close(sg_fd);
 	    return 1;
@@ -536,9 +817,6 @@ int main(int argc, char * argv[])
 	       printf("READ_10 duration=%u millisecs, resid=%d, msg_status=%d \n",
 	           io_hdr.duration, io_hdr.resid, (int)io_hdr.msg_status);
 
-           /* Check the result to see if this MU has any BadBlock */
-	       memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-   		   memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
 
 #ifdef DEBUG_FLAG
        	   /* Print out io_hdr.deferp Reply Buffer */
@@ -552,7 +830,8 @@ int main(int argc, char * argv[])
 	       }
 	       printf("\n");
 #endif
-           Current_SpareBlock[mu] = inBuff[0x65];
+           Current_SpareBlock[mu] = smv_spare_count(smv_spare_view(inBuff),
+                                                    profile->spare_offset);
 
            printf("Current MU = %d\n", mu);
            printf("Current_SpareBlock   = %d (0x%02X)\n", Current_SpareBlock[mu], Current_SpareBlock[mu]);
@@ -567,7 +846,7 @@ int main(int argc, char * argv[])
 	       printf("%02X ", r10CmdBlk[current_spare_blocks_2][j]);
 	    printf("\n");
 
-        if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+        if (smd_io(&dev, &io_hdr) < 0) {
 	       perror("sg_read_SM325: Inquiry SG_IO ioctl error");
 	       close(sg_fd);
 	    return 1;
@@ -593,9 +872,6 @@ int main(int argc, char * argv[])
 	       printf("READ_10 duration=%u millisecs, resid=%d, msg_status=%d \n",
 	           io_hdr.duration, io_hdr.resid, (int)io_hdr.msg_status);
 
-           /* Check the result to see if this MU has any BadBlock */
-	       memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-   		   memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
 
 #ifdef DEBUG_FLAG
        	   /* Print out io_hdr.deferp Reply Buffer */
@@ -609,7 +885,8 @@ int main(int argc, char * argv[])
 	       }
 	       printf("\n");
 #endif
-           Current_SpareBlock[mu] = inBuff[0x65];
+           Current_SpareBlock[mu] = smv_spare_count(smv_spare_view(inBuff),
+                                                    profile->spare_offset);
 
            printf("Current MU = %d\n", mu);
            printf("Current_SpareBlock   = %d (0x%02X)\n", Current_SpareBlock[mu], Current_SpareBlock[mu]);
@@ -617,16 +894,24 @@ int main(int argc, char * argv[])
         
     }  /* end of for loop each mu */
 
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    printf("\nSTEP 6 took %.1f millisecs for %u MUs (%.2f per MU, %s)\n",
+           ((t_end.tv_sec - t_start.tv_sec) * 1e3) + ((t_end.tv_nsec - t_start.tv_nsec) / 1e6),
+           Total_MU,
+           (((t_end.tv_sec - t_start.tv_sec) * 1e3) + ((t_end.tv_nsec - t_start.tv_nsec) / 1e6)) / Total_MU,
+           (n_batched >= 0) ? "queued" : "one pair at a time");
+
     /******************************/
     /*    Print out the results   */
     /******************************/
     printf("\n   *********** THE RESULT IS: **********\n\n");
 
-    printf("Vendor Identification  : %.8s\n", VendorID);
-    printf("Product Identification : %.16s\n", ProductID);
-    printf("Product Revision Level : %.4s\n", ProductRevision);
+    printf("Vendor Identification  : %.8s\n", smv_inq_vendor(inq));
+    printf("Product Identification : %.16s\n", smv_inq_product(inq));
+    printf("Product Revision Level : %.4s\n", smv_inq_revision(inq));
     printf("Unit Serial Number     : %.16s\n", UnitSerialNumber);
-    printf("Silicon Motion chip    : %.7s\n\n", SMIChip);
+    printf("Silicon Motion chip    : %.7s\n", SMIChip);
+    printf("Controller profile     : %s\n\n", profile ? profile->name : "-");
     printf("Block Size : %d Bytes\n", BlockSize);
     printf("Disk Size  : %.2f MiB or %.2f MB\n\n", (float)(DiskSize / BYTES_IN_MiB), (float)(DiskSize / BYTES_IN_MB));
 
@@ -646,7 +931,65 @@ int main(int argc, char * argv[])
         printf("\n");
 
     }  /* end of for loop each mu */
+
+    /* Append this scan to the unit's health history and publish it on the
+       results board */
+    if (health_dir || board_name)
+    {
+        memset(&scan, 0, sizeof(scan));
+        for (i=0, j=0; (i<16) && (j<SMH_SERIAL_LEN); i++)
+        {
+            if ((UnitSerialNumber[i] > ' ') && (UnitSerialNumber[i] < 0x7F))
+                serial[j++] = UnitSerialNumber[i];
+        }
+        serial[j] = '\0';
+        scan.timestamp = (uint32_t)time(NULL);
+        scan.mu_count = Total_MU;
+        for (mu=0; mu<Total_MU; mu++)
+        {
+            scan.col[smh_current_badblock][mu]   = (uint16_t)Current_BadBlock[mu];
+            scan.col[smh_initial_badblock][mu]   = (uint16_t)Initial_BadBlock[mu];
+            scan.col[smh_total_datablock][mu]    = (uint16_t)Total_DataBlock[mu];
+            scan.col[smh_initial_spareblock][mu] = (uint16_t)Initial_SpareBlock[mu];
+            scan.col[smh_current_spareblock][mu] = (uint16_t)Current_SpareBlock[mu];
+        }
+    }
+    if (health_dir)
+    {
+        if (smh_append(health_dir, serial, &scan) < 0)
+        {
+            snprintf(ebuff, EBUFF_SZ,
+                     "sg_read_SM325: error appending health history of %s", serial);
+            perror(ebuff);
+        }
+        else
+            printf("Health history of %s updated in %s\n", serial, health_dir);
+    }
+    if (board_name)
+    {
+        if ((board = smb_open(board_name, 1)) == NULL)
+        {
+            snprintf(ebuff, EBUFF_SZ,
+                     "sg_read_SM325: error opening results board %s", board_name);
+            perror(ebuff);
+        }
+        else if (smb_publish(board, serial, &scan) < 0)
+            printf("Results board %s is %s, %s not published\n", board_name,
+                   (EBUSY == errno) ? "busy" : "full", serial);
+        else
+            printf("Scan of %s published on results board %s\n", serial, board_name);
+        smb_close(board);
+    }
     
+    if (profile_name[0]) {
+        smd_lat_print(&dev);
+        if (smd_lat_save(&dev, profile_name) < 0)
+            perror("sg_read_SM325: error saving timeout profile");
+    }
+    smd_print_stats(&dev, "sg_read_SM325");
+    smd_print_errors(&dev, "sg_read_SM325");
+    smd_arena_release(&arena);
+    smd_dev_release(&dev);
     close(sg_fd);
     return 0;
 }
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <time.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/ioctl.h>
@@ -10,6 +11,12 @@
 #include <sys/stat.h>
 #include "sg_lib.h"
 #include "sg_io_linux.h"
+#include "sg_SM3252_dev.h"
+#include "sg_SM3252_cdb.h"
+#include "sg_SM3252_view.h"
+#include "sg_SM3252_prof.h"
+#include "sg_SM3252_trace.h"
+#include "sg_SM3252_ops.h"
 
 /* This program performs a similar READ_10 command as scsi mid-level support
    16 byte commands from lk 2.4.15 to read basic information from SM325 chip
@@ -20,7 +27,10 @@
 *  the Free Software Foundation; either version 2, or (at your option)
 *  any later version.
 
-   Invocation: sg_read_SM3252_Erase_Flash <scsi_device>
+   Invocation: sg_read_SM3252_Erase_Flash [-r] [-c <ckpt_file>] [-s <min_spare>]
+                   [-d <rate>] [-v | -e | -E] [-b <blocks>] [-p <pattern>]
+                   [-m <mu>|all] [-C <controller_file>] [-R <retries>]
+                   [-T <profile_dir>] [-t <trace_file>] <scsi_device>
 
    Version 1.02 (20020206)
 
@@ -47,27 +57,396 @@
 #define INQ_CMD_LEN       6
 
 #define EBUFF_SZ 256
-#define MAX_MU   256
 
-enum read_steps {basic_info, init_and_current_badblocks, current_spare_blocks_1, current_spare_blocks_2, read_LED, write_LED, reset_drive, erase_flash, write_10};
+#define SWEEP_PASSES      10
+#define CKPT_INTERVAL     1000    /* LBAs written between checkpoint flushes */
+
+#define SPARE_SAMPLES     256     /* spare count is one byte, so 256 changes max */
+#define SPARE_MIN_DEFAULT 4       /* abort the burn-in below this many spares */
+#define RATE_MIN_FRACTION 10      /* judge the rate after 1/10 of a pass per MU */
+
+#define VERIFY_CHUNK_DEFAULT 128  /* blocks per WRITE(16)/READ(16) in verify mode */
+#define VERIFY_CHUNK_MAX     2048
+
+
+#define PATTERN_SZ        40
+#define HOT_SIZE_DEFAULT  10      /* hot-spot pattern: % of the range that is hot */
+#define HOT_HIT_DEFAULT   90      /* hot-spot pattern: % of accesses landing there */
+
+enum read_steps {basic_info, init_and_current_badblocks, current_spare_blocks_1, current_spare_blocks_2, read_LED, write_LED, reset_drive, erase_flash, write_10, read_16};
 enum inq_read_steps {inq_basic_info, inq_unit_serial_number}; 
 
+enum pattern_kind {pat_seq, pat_random, pat_stride, pat_hotspot};
+
+/* Order in which the sweep visits the n units (LBAs, or chunks in verify
+   mode) of its range.  Unit i is computed from i alone, so nothing is
+   materialized and a resumed sweep can start at any position. */
+struct access_pattern {
+    enum pattern_kind kind;
+    unsigned int n;
+    unsigned int stride;
+    unsigned int hot_n, hot_pct;
+    unsigned int half_bits;     /* random: Feistel half width */
+    uint64_t seed;
+};
+
+static uint64_t mix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/* Parse "seq", "random[:seed]", "stride:<n>" or "hotspot[:size%:hit%]".
+   Returns -1 on a bad spec. */
+static int pattern_parse(const char * spec, struct access_pattern * p)
+{
+    unsigned int a, b;
+
+    memset(p, 0, sizeof(*p));
+    p->seed = 1;
+    p->hot_n = HOT_SIZE_DEFAULT;
+    p->hot_pct = HOT_HIT_DEFAULT;
+    if (0 == strcmp(spec, "seq"))
+        p->kind = pat_seq;
+    else if (0 == strncmp(spec, "random", 6)) {
+        p->kind = pat_random;
+        if ((spec[6] == ':') && (sscanf(spec + 7, "%u", &a) == 1))
+            p->seed = a;
+        else if (spec[6] != '\0')
+            return -1;
+    }
+    else if (0 == strncmp(spec, "stride:", 7)) {
+        p->kind = pat_stride;
+        if ((sscanf(spec + 7, "%u", &a) != 1) || (a == 0))
+            return -1;
+        p->stride = a;
+    }
+    else if (0 == strncmp(spec, "hotspot", 7)) {
+        p->kind = pat_hotspot;
+        if (spec[7] == ':') {
+            if ((sscanf(spec + 8, "%u:%u", &a, &b) != 2) ||
+                (a == 0) || (a >= 100) || (b > 100))
+                return -1;
+            p->hot_n = a;
+            p->hot_pct = b;
+        }
+        else if (spec[7] != '\0')
+            return -1;
+    }
+    else
+        return -1;
+    return 0;
+}
+
+/* Size the pattern for n units; hot_n turns from a percentage into units */
+static void pattern_init(struct access_pattern * p, unsigned int n)
+{
+    unsigned int bits = 1;
+
+    p->n = n;
+    if (p->kind == pat_random) {
+        while ((bits < 64) && ((1ULL << bits) < n))
+            bits++;
+        p->half_bits = (bits + 1) / 2;
+    }
+    else if (p->kind == pat_hotspot) {
+        p->hot_n = (unsigned int)((uint64_t)n * p->hot_n / 100);
+        if (p->hot_n == 0)
+            p->hot_n = 1;
+    }
+}
+
+/* Unit visited at position i of the sweep, 0 <= i < p->n */
+static unsigned int pattern_unit(const struct access_pattern * p, unsigned int i)
+{
+    unsigned int q, rem, c, r, j;
+    uint64_t x, h, left, right, mask;
+    int round;
+
+    switch (p->kind) {
+    case pat_random:
+        /* 4 round Feistel permutation of [0, 2^(2*half_bits)), walking the
+           cycle until the value lands inside [0, n) */
+        mask = (1ULL << p->half_bits) - 1;
+        x = i;
+        do {
+            left = x >> p->half_bits;
+            right = x & mask;
+            for (round=0; round<4; round++) {
+                h = mix64(right ^ (p->seed << 8) ^ (uint64_t)round) & mask;
+                h ^= left;
+                left = right;
+                right = h;
+            }
+            x = (left << p->half_bits) | right;
+        } while (x >= p->n);
+        return (unsigned int)x;
+    case pat_stride:
+        /* Column c holds the units c, c+stride, c+2*stride ... in order;
+           the first n%stride columns are one unit longer than the rest */
+        q = p->n / p->stride;
+        rem = p->n % p->stride;
+        if (i < rem * (q + 1)) {
+            c = i / (q + 1);
+            r = i % (q + 1);
+        }
+        else {
+            j = i - rem * (q + 1);
+            c = rem + j / q;
+            r = j % q;
+        }
+        return r * p->stride + c;
+    case pat_hotspot:
+        /* Not a permutation: hot_pct% of the accesses go to the first
+           hot_n units, the rest spread over the cold part */
+        h = mix64(p->seed ^ ((uint64_t)i << 1));
+        if (((h & 0xFFFF) % 100 < p->hot_pct) || (p->hot_n >= p->n))
+            return (unsigned int)((h >> 16) % p->hot_n);
+        return p->hot_n + (unsigned int)((h >> 16) % (p->n - p->hot_n));
+    case pat_seq:
+    default:
+        return i;
+    }
+}
+
+/* Progress of the WRITE(16) sweep.  Positions [0, done) of the access
+   pattern in pass 'pass' are written; all earlier passes are complete.
+   Kept in a small text file so a run that dies at pass 7 can be resumed
+   there instead of at lba 0. */
+struct sweep_ckpt {
+    char serial[20];
+    char pattern[PATTERN_SZ];
+    char range[PATTERN_SZ];
+    int pass;
+    unsigned int done;
+    unsigned int mu_count;
+    unsigned short * spare;      /* mu_count entries */
+};
+
+/* Spare block history of one MU during the sweep.  A sample is only stored
+   when the spare count changes, so the series stays short. */
+struct spare_trend {
+    unsigned int written;        /* LBAs written to this MU by this run */
+    unsigned int n_samples;
+    struct {
+        unsigned int written;
+        unsigned short spare;
+    } sample[SPARE_SAMPLES];
+};
+
+static void spare_trend_add(struct spare_trend * t, unsigned short spare)
+{
+    t->written++;
+    if ((t->n_samples > 0) &&
+        (t->sample[t->n_samples - 1].spare == spare))
+        return;
+    if (t->n_samples < SPARE_SAMPLES) {
+        t->sample[t->n_samples].written = t->written;
+        t->sample[t->n_samples].spare = spare;
+        t->n_samples++;
+    }
+}
+
+/* Spare blocks consumed per full pass over the MU, extrapolated from the
+   first and last sample of this run */
+static double spare_trend_rate(const struct spare_trend * t, unsigned int lba_per_pass)
+{
+    if ((t->n_samples < 2) || (t->written == 0))
+        return 0.0;
+    return ((double)t->sample[0].spare - t->sample[t->n_samples - 1].spare) *
+           lba_per_pass / t->written;
+}
+
+/* Consecutive miscomparing LBAs are reported as one range */
+struct miscompare {
+    unsigned int bad_blocks;
+    unsigned int n_ranges;
+    int          in_range;
+    unsigned int first, last;
+};
+
+static void miscompare_flush(struct miscompare * mc, int pass)
+{
+    if (mc->in_range) {
+        printf("MISCOMPARE loop %d: lba %u - %u (%u blocks)\n", pass,
+               mc->first, mc->last, mc->last - mc->first + 1);
+        mc->n_ranges++;
+        mc->in_range = 0;
+    }
+}
+
+/* Every 64 bit word of a block holds the block's LBA, the pass number and
+   the word index, so stale, misplaced and corrupted blocks all miscompare */
+static void fill_pattern(uint64_t * buf, unsigned int lba, unsigned int nblk,
+                         unsigned int words_per_blk, int pass)
+{
+    unsigned int b, w;
+    uint64_t base;
+
+    for (b=0; b<nblk; b++, buf += words_per_blk) {
+        base = ((uint64_t)(lba + b) << 32) | ((uint64_t)(pass & 0xFFFF) << 16);
+        for (w=0; w<words_per_blk; w++)
+            buf[w] = base | w;
+    }
+}
+
+/* The inner loop only XORs and ORs whole words with no early exit, so the
+   compiler turns it into SIMD compares; the per block result is checked
+   once the whole block has been folded */
+static void check_pattern(const uint64_t * buf, unsigned int lba, unsigned int nblk,
+                          unsigned int words_per_blk, int pass, struct miscompare * mc)
+{
+    unsigned int b, w;
+    uint64_t base, diff;
+
+    for (b=0; b<nblk; b++, buf += words_per_blk) {
+        base = ((uint64_t)(lba + b) << 32) | ((uint64_t)(pass & 0xFFFF) << 16);
+        diff = 0;
+        for (w=0; w<words_per_blk; w++)
+            diff |= buf[w] ^ (base | w);
+        if (diff) {
+            mc->bad_blocks++;
+            if (mc->in_range && (mc->last + 1 == lba + b))
+                mc->last = lba + b;
+            else {
+                miscompare_flush(mc, pass);
+                mc->in_range = 1;
+                mc->first = mc->last = lba + b;
+            }
+        }
+        else
+            miscompare_flush(mc, pass);
+    }
+}
+
+/* One 16 byte command of the verify sweep.  Returns 1
+   when the command completed, 0 on a SCSI error and -1 when the ioctl
+   failed.  When 'quiet' SCSI errors are left to the caller to report,
+   from dev->last. */
+static int sweep_io(struct smd_dev * dev, unsigned char * cdb, int direction,
+                    void * buf, unsigned int len, unsigned int timeout,
+                    const char * leadin, int quiet)
+{
+    sg_io_hdr_t io_hdr;
+    unsigned char sense_buffer[32];
+    char text[96];
+
+    memset(&io_hdr, 0, sizeof(sg_io_hdr_t));
+    io_hdr.interface_id = 'S';
+    io_hdr.cmd_len = READ10_CMD_LEN;
+    io_hdr.mx_sb_len = sizeof(sense_buffer);
+    io_hdr.dxfer_direction = direction;
+    io_hdr.dxfer_len = len;
+    io_hdr.dxferp = buf;
+    io_hdr.cmdp = cdb;
+    io_hdr.sbp = sense_buffer;
+    io_hdr.timeout = timeout;
+
+    if (smd_io(dev, &io_hdr) < 0) {
+        perror("sg_read_SM3252_Erase_Flash: sweep SG_IO ioctl error");
+        return -1;
+    }
+    /* A sweep may see thousands of recovered errors; they are only
+       counted in dev->errors and summed up at the end.  DID_ERROR on
+       WRITE(16) is ok, as in the write sweep. */
+    if (smd_status_ok(&dev->last) ||
+        ((0x8A == cdb[0]) && (io_hdr.host_status == SMD_DID_ERROR)))
+        return 1;
+    if (!quiet)
+        fprintf(stderr, "%s: %s\n", leadin,
+                smd_status_str(&dev->last, text, sizeof(text)));
+    return 0;
+}
+
+/* A blank VPD 0x80 leaves the serial empty, which fscanf() can't read
+   back: empty strings are written as "-" */
+#define CKPT_EMPTY(str)   ((str)[0] ? (str) : "-")
+
+/* Write the checkpoint to a temporary file and rename it over the old one,
+   so a crash while writing never leaves a half written checkpoint behind */
+static int write_checkpoint(const char * name, const struct sweep_ckpt * ck)
+{
+    char tmp_name[EBUFF_SZ];
+    FILE *fp;
+    unsigned int mu;
+
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", name);
+    if ((fp = fopen(tmp_name, "w")) == NULL)
+        return -1;
+    fprintf(fp, "serial %s\n", CKPT_EMPTY(ck->serial));
+    fprintf(fp, "pattern %s\n", CKPT_EMPTY(ck->pattern));
+    fprintf(fp, "range %s\n", CKPT_EMPTY(ck->range));
+    fprintf(fp, "pass %d\n", ck->pass);
+    fprintf(fp, "done %u\n", ck->done);
+    fprintf(fp, "mu_count %u\n", ck->mu_count);
+    fprintf(fp, "spare");
+    for (mu=0; mu<ck->mu_count; mu++)
+        fprintf(fp, " %u", ck->spare[mu]);
+    fprintf(fp, "\n");
+    if ((fflush(fp) != 0) || (fsync(fileno(fp)) < 0)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    return rename(tmp_name, name);
+}
+
+/* Returns 0 when a complete checkpoint of at most 'max_mu' MUs was read
+   into 'ck', whose spare array has room for 'max_mu' entries; -1 otherwise */
+static int read_checkpoint(const char * name, struct sweep_ckpt * ck,
+                           unsigned int max_mu)
+{
+    unsigned short * spare = ck->spare;
+    FILE *fp;
+    unsigned int mu, val;
+    int ok;
+
+    memset(ck, 0, sizeof(*ck));
+    ck->spare = spare;
+    if ((fp = fopen(name, "r")) == NULL)
+        return -1;
+    ok = (fscanf(fp, "serial %19s pattern %39s range %39s pass %d done %u mu_count %u spare",
+                 ck->serial, ck->pattern, ck->range, &ck->pass, &ck->done,
+                 &ck->mu_count) == 6);
+    if (ok && (ck->mu_count > max_mu))
+        ok = 0;
+    if (0 == strcmp(ck->serial, "-"))
+        ck->serial[0] = '\0';
+    if (0 == strcmp(ck->pattern, "-"))
+        ck->pattern[0] = '\0';
+    if (0 == strcmp(ck->range, "-"))
+        ck->range[0] = '\0';
+    for (mu=0; ok && (mu<ck->mu_count); mu++) {
+        if (fscanf(fp, "%u", &val) != 1)
+            ok = 0;
+        else
+            ck->spare[mu] = (unsigned short)val;
+    }
+    fclose(fp);
+    return ok ? 0 : -1;
+}
+
 int main(int argc, char * argv[])
 {
-    FILE *pFile;
+    FILE *pFile = NULL;
     time_t rawtime;
     struct tm * timeinfo;
     int sg_fd, k, ok, i, j, FBlk;
     sg_io_hdr_t io_hdr;
+    struct smd_dev dev;
+    int max_retries = -1;
+    char * profile_dir = 0;
+    char * trace_file = 0;
+    char profile_name[EBUFF_SZ] = "";
     char * file_name = 0;
     char ebuff[EBUFF_SZ];
     unsigned char sense_buffer[32];
-    unsigned char FourBytes[4], TwoBytes[2];
     unsigned char Viking[] = "VT";
     unsigned char filename[22];
-    unsigned char *ptr2Buffer;
 
-    unsigned char r10CmdBlk[9][READ10_CMD_LEN] =
+    unsigned char r10CmdBlk[11][READ10_CMD_LEN] =
              { {0xF0, 0x20, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0},
                {0xF0, 0x0A, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0},
                {0x28, 0x00, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0},
@@ -76,31 +455,162 @@ int main(int argc, char * argv[])
                {0xF1, 0x03, 0, 0, 0, 0, 0, 0, 0x20, 0, 0, 1, 0, 0, 0, 0},
                {0xF0, 0x2C, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
                {0xF0, 0x0C, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-               {0x8A, 0x00, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0} };
+               {0x8A, 0x00, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0},
+               {0x88, 0x00, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0} };
 //               {0x2A, 0x00, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0} };
     unsigned char inBuff[READ10_REPLY_LEN];
     unsigned char inBuffBB[READBB_REPLY_LEN];
+    struct smv_sysblk sb = smv_sysblk_view(inBuffBB);
     unsigned int Total_MU=0, Total_LBA=0, LBA_per_MU=0, HalfLBA_per_MU=0, mu, lba, SLBA, LED_result=0;
-    unsigned short Current_BadBlock[MAX_MU], Initial_BadBlock[MAX_MU], Total_DataBlock[MAX_MU];
-    unsigned short Initial_SpareBlock[MAX_MU], Current_SpareBlock[MAX_MU];
+    unsigned short *Current_BadBlock, *Initial_BadBlock, *Total_DataBlock;
+    unsigned short *Initial_SpareBlock, *Current_SpareBlock;
+    struct smd_geometry geom;
+    struct smd_arena arena;
+    struct smd_mu_table mu_table;
 
     unsigned char inqCmdBlk [2][INQ_CMD_LEN] =
              { {0x12, 0, 0, 0, INQ_REPLY_LEN, 0}, {0x12, 0, 0x80, 0, INQ_REPLY_LEN, 0} };
-    unsigned char inqBuff[INQ_REPLY_LEN];
-    unsigned char VendorID[8], ProductID[16], ProductRevision[4], UnitSerialNumber[18], UnitProductNumber[18], SMIChip[8];
+    /* Each INQUIRY gets its own buffer; the fields are read in place */
+    unsigned char inqBuff[INQ_REPLY_LEN], snBuff[INQ_REPLY_LEN];
+    struct smv_inquiry inq = smv_inquiry_view(inqBuff);
+    const unsigned char * VendorID = smv_inq_vendor(inq);
+    const unsigned char * ProductID = smv_inq_product(inq);
+    const unsigned char * ProductRevision = smv_inq_revision(inq);
+    const unsigned char * UnitSerialNumber = smv_serial_number(smv_serial_view(snBuff));
+    unsigned char UnitProductNumber[18];
+    const struct smp_profile * profile = NULL, * matched = NULL;
+    char * controller_file = 0;
+    unsigned int line;
 
     unsigned char capCmdBlk [READCAP_CMD_LEN] =
               {0x25, 0, 0, 0, 0, 0, 0, 0, 0, 0};
     unsigned char capBuff[READCAP_REPLY_LEN];
     unsigned int  BlockSize=0, DiskSize=0, countRead=0, countWrite=0;
     unsigned char LED_Status_Byte=0, LED_Ready=0, LED_Busy=0;
-    int loop;
+    int loop, start_loop=1, do_resume=0;
+    unsigned int start_pos=0, pos, range_start, range_len, n_units, blocks_moved;
+    char * pattern_spec = "seq";
+    char * range_spec = "0";
+    struct access_pattern sweep;
+    char * ckpt_name = 0;
+    char ckpt_default[EBUFF_SZ];
+    struct sweep_ckpt ckpt;
+    struct spare_trend *trend = NULL;
+    unsigned int spare_min = SPARE_MIN_DEFAULT;
+    double max_rate = 0.0, rate;
+    int burnin_abort = 0, verify_failed = 0, erase_failed = 0;
+    char abort_reason[EBUFF_SZ], status_text[96];
+    FILE *trendFile;
+    int do_verify = 0, do_erase = 0;
+    enum smo_erase_method erase_method = smo_erase_write_same;
+    unsigned int mu_first, mu_last, mu_lba, mu_len, erase_bad = 0;
+    double secs_erase;
+    unsigned int chunk_blocks = VERIFY_CHUNK_DEFAULT, nblk, words_per_blk;
+    uint64_t *verifyBuff;
+    struct miscompare mc;
+    struct timespec t_start, t_end;
+    double secs_write, secs_read;
     
     time( &rawtime );
     timeinfo = localtime( &rawtime );
     
     for (k = 1; k < argc; ++k) {
-        if (*argv[k] == '-') {
+        if (0 == strcmp("-r", argv[k]))
+            do_resume = 1;
+        else if (0 == strcmp("-c", argv[k])) {
+            if (++k >= argc) {
+                printf("-c needs a checkpoint file name\n");
+                file_name = 0;
+                break;
+            }
+            ckpt_name = argv[k];
+        }
+        else if (0 == strcmp("-R", argv[k])) {
+            if (++k >= argc) {
+                printf("-R needs a retry count\n");
+                file_name = 0;
+                break;
+            }
+            max_retries = atoi(argv[k]);
+        }
+        else if (0 == strcmp("-C", argv[k])) {
+            if (++k >= argc) {
+                printf("-C needs a controller profile file\n");
+                file_name = 0;
+                break;
+            }
+            controller_file = argv[k];
+        }
+        else if (0 == strcmp("-T", argv[k])) {
+            if (++k >= argc) {
+                printf("-T needs a timeout profile directory\n");
+                file_name = 0;
+                break;
+            }
+            profile_dir = argv[k];
+        }
+        else if (0 == strcmp("-t", argv[k])) {
+            if (++k >= argc) {
+                printf("-t needs a trace file name\n");
+                file_name = 0;
+                break;
+            }
+            trace_file = argv[k];
+        }
+        else if (0 == strcmp("-s", argv[k])) {
+            if (++k >= argc) {
+                printf("-s needs a minimum spare block count\n");
+                file_name = 0;
+                break;
+            }
+            spare_min = (unsigned int)atoi(argv[k]);
+        }
+        else if (0 == strcmp("-d", argv[k])) {
+            if (++k >= argc) {
+                printf("-d needs a maximum depletion rate\n");
+                file_name = 0;
+                break;
+            }
+            max_rate = atof(argv[k]);
+        }
+        else if (0 == strcmp("-p", argv[k])) {
+            if ((++k >= argc) || (pattern_parse(argv[k], &sweep) < 0)) {
+                printf("-p needs seq, random[:seed], stride:<n> or hotspot[:size%%:hit%%]\n");
+                file_name = 0;
+                break;
+            }
+            pattern_spec = argv[k];
+        }
+        else if (0 == strcmp("-m", argv[k])) {
+            if (++k >= argc) {
+                printf("-m needs a MU number or 'all'\n");
+                file_name = 0;
+                break;
+            }
+            range_spec = argv[k];
+        }
+        else if (0 == strcmp("-v", argv[k]))
+            do_verify = 1;
+        else if (0 == strcmp("-e", argv[k]))
+            do_erase = 1;
+        else if (0 == strcmp("-E", argv[k])) {
+            do_erase = 1;
+            erase_method = smo_erase_vendor;
+        }
+        else if (0 == strcmp("-b", argv[k])) {
+            if (++k >= argc) {
+                printf("-b needs a number of blocks\n");
+                file_name = 0;
+                break;
+            }
+            chunk_blocks = (unsigned int)atoi(argv[k]);
+            if ((chunk_blocks < 1) || (chunk_blocks > VERIFY_CHUNK_MAX)) {
+                printf("-b must be between 1 and %d blocks\n", VERIFY_CHUNK_MAX);
+                file_name = 0;
+                break;
+            }
+        }
+        else if (*argv[k] == '-') {
             printf("Unrecognized switch: %s\n", argv[k]);
             file_name = 0;
             break;
@@ -113,8 +623,47 @@ int main(int argc, char * argv[])
             break;
         }
     }
+    if (do_erase && do_verify) {
+        printf("-e/-E and -v can not be used together\n");
+        file_name = 0;
+    }
     if (0 == file_name) {
-        printf("Usage: 'sg_read_SM3252_LED <sg_device>'\n");
+        printf("Usage: 'sg_read_SM3252_Erase_Flash [-r] [-c <ckpt_file>] [-s <min_spare>] [-d <rate>] [-v | -e | -E] [-b <blocks>] [-p <pattern>] [-m <mu>|all] [-C <controller_file>] [-R <retries>] [-T <profile_dir>] [-t <trace_file>] <sg_device>'\n");
+        printf("  -r    resume the write sweep from its checkpoint file\n");
+        printf("  -c    checkpoint file name (default: <serial_number>.ckpt)\n");
+        printf("  -s    abort the sweep when a MU drops below this many spare blocks (default %d)\n", SPARE_MIN_DEFAULT);
+        printf("  -d    abort the sweep when a MU loses more spare blocks per pass than this (default off)\n");
+        printf("  -v    write a per-LBA pattern and read it back instead of the plain write sweep\n");
+        printf("  -e    fast erase each MU of the range (WRITE SAME, or zero fill where that\n");
+        printf("        is refused) and check it by sampling, instead of the write sweep\n");
+        printf("  -E    as -e, but try the vendor erase 0xF0 0x0C first; experimental: the\n");
+        printf("        command is not documented and the MU going in CDB byte 6 is a guess\n");
+        printf("  -b    blocks per command in verify mode (default %d)\n", VERIFY_CHUNK_DEFAULT);
+        printf("  -p    access pattern: seq (default), random[:seed], stride:<n>,\n");
+        printf("        hotspot[:size%%:hit%%] (default %d%% of the range gets %d%% of the writes)\n",
+               HOT_SIZE_DEFAULT, HOT_HIT_DEFAULT);
+        printf("  -m    LBA range to sweep: a MU number (default 0) or 'all' for the whole device\n");
+        printf("  -C    controller profiles from <controller_file> instead of the built in ones\n");
+        printf("  -R    retries of a failed SG_IO command (default: depends on the command)\n");
+        printf("  -T    learn command timeouts from observed latencies, kept per product\n");
+        printf("        and firmware in <profile_dir>\n");
+        printf("  -t    write every SG_IO command to <trace_file> as a Chrome trace\n");
+        printf("        (chrome://tracing, ui.perfetto.dev); a sweep of the whole\n");
+        printf("        device keeps 64 bytes per command in memory until the end\n");
+        return 1;
+    }
+    if (controller_file && (smp_load(controller_file, &line) < 0)) {
+        if ((EINVAL == errno) && line)
+            printf("sg_read_SM3252_Erase_Flash: %s line %u is not a controller profile\n",
+                   controller_file, line);
+        else if (EINVAL == errno)
+            printf("sg_read_SM3252_Erase_Flash: no controller profile in %s\n",
+                   controller_file);
+        else {
+            snprintf(ebuff, EBUFF_SZ, "sg_read_SM3252_Erase_Flash: error reading %s",
+                     controller_file);
+            perror(ebuff);
+        }
         return 1;
     }
 
@@ -131,6 +680,15 @@ int main(int argc, char * argv[])
         close(sg_fd);
         return 1;
     }
+    smd_dev_init(&dev, sg_fd);
+    dev.max_retries = max_retries;
+    if (trace_file) {
+        smtr_start_file(trace_file);
+        smtr_name(sg_fd, file_name);
+    }
+    /* What a failed INQUIRY leaves out prints as blanks */
+    memset(inqBuff, 0, sizeof(inqBuff));
+    memset(snBuff, 0, sizeof(snBuff));
 
     /* 1. Prepare INQUIRY command for Vendor ID, Product ID, Product Revision  0x12 */
     /**************************************************************************/
@@ -151,7 +709,7 @@ int main(int argc, char * argv[])
     /* io_hdr.pack_id = 0; */
     /* io_hdr.usr_ptr = NULL; */
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
         perror("sg_simple1: Inquiry SG_IO ioctl error");
         close(sg_fd);
         return 1;
@@ -178,7 +736,6 @@ int main(int argc, char * argv[])
 #ifdef DEBUG_FLAG
 	    printf(" inquiry buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-   		memcpy( inqBuff, io_hdr.dxferp, sizeof(inqBuff));
 	    for (i=0; i<16; i++)  /* 16 rows */
 	    {
 	      printf("       %3d-%3d = ", i*j, (i*j)+31);
@@ -190,9 +747,14 @@ int main(int argc, char * argv[])
 	    }
         printf("\n");
 #endif
-   		memcpy( VendorID, p + 8, sizeof(VendorID));
-   		memcpy( ProductID, p + 16, sizeof(ProductID));
-   		memcpy( ProductRevision, p + 32, sizeof(ProductRevision));
+    }
+
+    /* Timeouts learned on earlier runs with this product and firmware */
+    if (ok && profile_dir &&
+        (smd_lat_profile_name(profile_dir, VendorID, ProductID, ProductRevision,
+                              profile_name, sizeof(profile_name)) == 0)) {
+        smd_lat_load(&dev, profile_name);
+        dev.adaptive = 1;
     }
     }
 
@@ -202,8 +764,9 @@ int main(int argc, char * argv[])
         printf("2. INQUIRY command 0x12 for Serial Number\n");
     io_hdr.cmd_len = sizeof(inqCmdBlk[inq_unit_serial_number]);
     io_hdr.cmdp = inqCmdBlk[inq_unit_serial_number];
+    io_hdr.dxferp = snBuff;
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
         perror("sg_simple1: Inquiry SG_IO ioctl error");
         close(sg_fd);
         return 1;
@@ -225,25 +788,23 @@ int main(int argc, char * argv[])
     }
 
     if (ok) { /* output result if it is available */
-        char * p = (char *)inqBuff;
+        char * p = (char *)snBuff;
         int f = (int)*(p + 7);
 #ifdef DEBUG_FLAG
         printf("Unit Serial Number: %.16s \n", p + 4);
 	    printf(" inquiry buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-   		memcpy( inqBuff, io_hdr.dxferp, sizeof(inqBuff));
 	    for (i=0; i<16; i++)  /* 16 rows */
 	    {
 	      printf("       %3d-%3d = ", i*j, (i*j)+31);
 
 	      for (j=0; j<32; j++)
-	         printf("%02X ", inqBuff[(i*32)+j]);
+	         printf("%02X ", snBuff[(i*32)+j]);
 	   
 	      printf("\n");
 	    }
         printf("\n");
 #endif
-   		memcpy( UnitSerialNumber, p + 4, sizeof(UnitSerialNumber));
     }
     }
 
@@ -256,7 +817,7 @@ int main(int argc, char * argv[])
     io_hdr.dxferp = capBuff;
     io_hdr.cmdp = capCmdBlk;
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
         perror("sg_simple1: READ CAPACITY SG_IO ioctl error");
         close(sg_fd);
         return 1;
@@ -281,22 +842,13 @@ int main(int argc, char * argv[])
 #ifdef DEBUG_FLAG
 	    printf(" readcap buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-   		memcpy( capBuff, io_hdr.dxferp, sizeof(capBuff));
         printf("                 ");
         for (j=0; j<8; j++)
 	        printf("%02X ", capBuff[j]);
 	    printf("\n");
 #endif
-        FourBytes[0] = capBuff[7];
-        FourBytes[1] = capBuff[6];
-        FourBytes[2] = capBuff[5];
-        FourBytes[3] = capBuff[4];
-        BlockSize  = *(int *)FourBytes;
-        FourBytes[0] = capBuff[3];
-        FourBytes[1] = capBuff[2];
-        FourBytes[2] = capBuff[1];
-        FourBytes[3] = capBuff[0];
-        DiskSize  = ((*(int *)FourBytes) + 1) * BlockSize;
+        BlockSize  = smc_readcap_block_size(capBuff);
+        DiskSize  = (smc_readcap_last_lba(capBuff) + 1) * BlockSize;
     }
     }
 
@@ -319,7 +871,7 @@ int main(int argc, char * argv[])
     /* io_hdr.pack_id = 0; */
     /* io_hdr.usr_ptr = NULL; */
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
 	   perror("sg_read_SM325: Inquiry SG_IO ioctl error");
 	   close(sg_fd);
 	   return 1;
@@ -341,14 +893,11 @@ int main(int argc, char * argv[])
     }
 
     if (ok) { /* output result if it is available */
-	    memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-
 #ifdef DEBUG_FLAG
 	    printf("\n  STEP 1: READ BASIC INFORMATION\n");
 	    /* Print out io_hdr.deferp */
 	    printf("   reply buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-	    memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
 	    for (i=0; i<8; i++)  /* 8 rows */
 	    {
 	      printf("       %3d-%3d = ", i*j, (i*j)+31);
@@ -360,14 +909,13 @@ int main(int argc, char * argv[])
 	    }
         printf("\n");
 #endif
-        Total_MU   = inBuff[1];
-        FourBytes[0] = inBuff[0x17];
-        FourBytes[1] = inBuff[0x16];
-        FourBytes[2] = inBuff[0x15];
-        FourBytes[3] = inBuff[0x14];
-        Total_LBA  = *(int *)FourBytes;
-        LBA_per_MU = Total_LBA / Total_MU;
-        HalfLBA_per_MU = LBA_per_MU / 2;
+        if (smd_geometry_decode(inBuff, &geom) < 0)
+            printf("Invalid geometry: Total MU = %d, Total LBA = 0x%02X%02X%02X%02X\n",
+                   inBuff[1], inBuff[0x14], inBuff[0x15], inBuff[0x16], inBuff[0x17]);
+        Total_MU   = geom.total_mu;
+        Total_LBA  = geom.total_lba;
+        LBA_per_MU = geom.lba_per_mu;
+        HalfLBA_per_MU = geom.half_lba_per_mu;
 
 #ifdef DEBUG_FLAG1
         printf("Total MU       = %d\n", Total_MU);
@@ -379,6 +927,22 @@ int main(int argc, char * argv[])
     }
     }
 
+    /* Size the per-MU results by the MU count the module reports, with room
+       for the spare counts of a checkpoint */
+    if ((0 == Total_MU) ||
+        (smd_arena_init(&arena, smd_mu_table_size(Total_MU) +
+                                Total_MU * sizeof(unsigned short)) < 0) ||
+        (smd_mu_table_alloc(&arena, Total_MU, &mu_table) < 0)) {
+        printf("sg_read_SM3252_Erase_Flash: no usable MU geometry, can't read the MUs\n");
+        close(sg_fd);
+        return 1;
+    }
+    Current_BadBlock   = mu_table.current_badblock;
+    Initial_BadBlock   = mu_table.initial_badblock;
+    Total_DataBlock    = mu_table.total_datablock;
+    Initial_SpareBlock = mu_table.initial_spareblock;
+    Current_SpareBlock = mu_table.current_spareblock;
+
     /* 5. Prepare READ_10 command to get Initial and Current BadBlock numbers for each MU  0xF0 */
     /**************************************************************************************/
 {
@@ -387,19 +951,15 @@ int main(int argc, char * argv[])
     io_hdr.dxfer_len = READBB_REPLY_LEN;
     io_hdr.dxferp = inBuffBB;
 
+    /* The firmware picks the profile until the first system block does */
+    profile = smp_default(ProductRevision);
     /* Loop through each MU */
     for (mu=0; mu<Total_MU; mu++)
     {
         /* Loop through each FBlk */
-        for (FBlk=0x3FF; FBlk>=0; FBlk--)
+        for (FBlk=profile->fblk_top; FBlk>=0; FBlk--)
         {
-            TwoBytes[0] = (FBlk >> 8) & 0x03;
-            TwoBytes[1] = FBlk & 0xFF;
-            ptr2Buffer = &r10CmdBlk[init_and_current_badblocks][2];
-            memcpy( ptr2Buffer, TwoBytes, 2);
-            TwoBytes[0] = ((unsigned short)mu) & 0xFF;
-            ptr2Buffer = &r10CmdBlk[init_and_current_badblocks][6];
-            memcpy( ptr2Buffer, TwoBytes, 1);
+            smc_bad_block_probe(r10CmdBlk[init_and_current_badblocks], FBlk, mu);
             io_hdr.cmdp = r10CmdBlk[init_and_current_badblocks];
 #ifdef DEBUG_FLAG
             printf("Cmd buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F\n");
@@ -409,26 +969,15 @@ int main(int argc, char * argv[])
                printf("%02X ", r10CmdBlk[init_and_current_badblocks][j]);
             printf("\n");
 #endif
-            if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+            if (smd_io(&dev, &io_hdr) < 0) {
                perror("sg_read_SM325: Inquiry SG_IO ioctl error");
                close(sg_fd);
             return 1;
             }
 
-            /* now for the error processing */
-            ok = 0;
-            switch (sg_err_category3(&io_hdr)) {
-               case SG_LIB_CAT_CLEAN:
-                  ok = 1;
-                  break;
-               case SG_LIB_CAT_RECOVERED:
-                  printf("Recovered error on READ_10, continuing\n");
-                  ok = 1;
-                  break;
-               default: /* won't bother decoding other categories */
-                  sg_chk_n_print3("READ_10 command error", &io_hdr, 1);
-                  break;
-            }
+            /* A probe of a block without a system block may fail; those are
+               counted in dev.errors and summed up at the end, not printed */
+            ok = smd_status_ok(&dev.last);
 
             if (ok) { /* output result if it is available */
                printf("\n   PROCESSING MU NUMBER: %d\n", mu);
@@ -436,8 +985,6 @@ int main(int argc, char * argv[])
                    io_hdr.duration, io_hdr.resid, (int)io_hdr.msg_status);
 
                /* Check the result to see if this MU has any BadBlock */
-               memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-               memcpy( inBuffBB, io_hdr.dxferp, sizeof(inBuffBB));
 
 #ifdef DEBUG_FLAG
                /* Print out io_hdr.deferp Reply Buffer */
@@ -451,25 +998,17 @@ int main(int argc, char * argv[])
                }
                printf("\n");
 #endif
-               ptr2Buffer = &inBuffBB[0x114];
-               if ((inBuffBB[0x114] == 0x53) &&  /* "S" */
-                   (inBuffBB[0x115] == 0x4D) &&  /* "M" */
-                   (inBuffBB[0x116] == 0x33) &&  /* "3" */
-                   (inBuffBB[0x117] == 0x32) &&  /* "2" */
-                   (inBuffBB[0x118] == 0x35) &&  /* "5" */
-                   (inBuffBB[0x200] == 0xE1) &&
-                   ((inBuffBB[0x210] & 0x48) == 0))
+               if (smp_sysblk_match(inBuffBB))
                {
-                  TwoBytes[0] = inBuffBB[0x101];
-                  TwoBytes[1] = inBuffBB[0x100];
-                  Current_BadBlock[mu] = *(unsigned short *)TwoBytes;
-                  TwoBytes[0] = inBuffBB[0x105];
-                  TwoBytes[1] = inBuffBB[0x104];
-                  Initial_BadBlock[mu] = Current_BadBlock[mu] - (*(unsigned short *)TwoBytes);
-                  TwoBytes[0] = inBuffBB[0x113];
-                  TwoBytes[1] = inBuffBB[0x112];
-                  Total_DataBlock[mu] = *(unsigned short *)TwoBytes;
-                  memcpy( SMIChip, ptr2Buffer, sizeof(SMIChip));
+                  Current_BadBlock[mu] = smv_sysblk_current_badblock(sb);
+                  Initial_BadBlock[mu] = smv_sysblk_initial_badblock(sb);
+                  Total_DataBlock[mu] = smv_sysblk_datablock(sb);
+                  if (NULL == matched)
+                  {
+                     matched = smp_match(inBuffBB, ProductRevision);
+                     if (matched)
+                        profile = matched;
+                  }
 
                   printf("Current MU = %d\n", mu);
                   printf("Current_BadBlock   = %d (0x%04X)\n", Current_BadBlock[mu], Current_BadBlock[mu]);
@@ -483,14 +1022,8 @@ int main(int argc, char * argv[])
 
         /* 5+. Calculate Initial Spare Numbers for each MU */
         /**************************************************/
-        if (mu == 0)
-        {
-           Initial_SpareBlock[mu] = 1014 - Total_DataBlock[mu] - Initial_BadBlock[mu];
-        }
-        else
-        {
-           Initial_SpareBlock[mu] = 1020 - Total_DataBlock[mu] - Initial_BadBlock[mu];
-        }
+        Initial_SpareBlock[mu] = smp_initial_spare(profile, mu, Total_DataBlock[mu],
+                                                   Initial_BadBlock[mu]);
 
     }  /* end of for loop each mu */
 }
@@ -507,12 +1040,7 @@ int main(int argc, char * argv[])
     {
         SLBA = (LBA_per_MU * mu) + HalfLBA_per_MU;
 
-        FourBytes[0] = (SLBA >> 24) & 0xFF;
-        FourBytes[1] = (SLBA >> 16) & 0xFF;
-        FourBytes[2] = (SLBA >> 8) & 0xFF;
-        FourBytes[3] = SLBA & 0xFF;
-        ptr2Buffer = &r10CmdBlk[current_spare_blocks_1][2];
-        memcpy( ptr2Buffer, FourBytes, 4);
+        smc_read10_lba(r10CmdBlk[current_spare_blocks_1], SLBA);
         io_hdr.cmdp = r10CmdBlk[current_spare_blocks_1];
         printf("Cmd buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F\n");
         printf("            -----------------------------------------------\n");
@@ -521,7 +1049,7 @@ int main(int argc, char * argv[])
            printf("%02X ", r10CmdBlk[current_spare_blocks_1][j]);
         printf("\n");
 
-        if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+        if (smd_io(&dev, &io_hdr) < 0) {
            perror("sg_read_SM325: Inquiry SG_IO ioctl error");
            close(sg_fd);
         return 1;
@@ -548,8 +1076,6 @@ int main(int argc, char * argv[])
                io_hdr.duration, io_hdr.resid, (int)io_hdr.msg_status);
 
            /* Check the result to see if this MU has any BadBlock */
-           memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-           memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
 
 #ifdef DEBUG_FLAG
            /* Print out io_hdr.deferp Reply Buffer */
@@ -563,7 +1089,8 @@ int main(int argc, char * argv[])
            }
            printf("\n");
 #endif
-           Current_SpareBlock[mu] = inBuff[0x65];
+           Current_SpareBlock[mu] = smv_spare_count(smv_spare_view(inBuff),
+                                                    profile->spare_offset);
 
            printf("Current MU = %d\n", mu);
            printf("Current_SpareBlock   = %d (0x%02X)\n", Current_SpareBlock[mu], Current_SpareBlock[mu]);
@@ -579,7 +1106,7 @@ int main(int argc, char * argv[])
            printf("%02X ", r10CmdBlk[current_spare_blocks_2][j]);
         printf("\n");
 #endif
-        if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+        if (smd_io(&dev, &io_hdr) < 0) {
            perror("sg_read_SM325: Inquiry SG_IO ioctl error");
            close(sg_fd);
         return 1;
@@ -606,8 +1133,6 @@ int main(int argc, char * argv[])
                io_hdr.duration, io_hdr.resid, (int)io_hdr.msg_status);
 
            /* Check the result to see if this MU has any BadBlock */
-           memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-           memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
 
 #ifdef DEBUG_FLAG
            /* Print out io_hdr.deferp Reply Buffer */
@@ -621,7 +1146,8 @@ int main(int argc, char * argv[])
            }
            printf("\n");
 #endif
-           Current_SpareBlock[mu] = inBuff[0x65];
+           Current_SpareBlock[mu] = smv_spare_count(smv_spare_view(inBuff),
+                                                    profile->spare_offset);
 
            printf("Current MU = %d\n", mu);
            printf("Current_SpareBlock   = %d (0x%02X)\n", Current_SpareBlock[mu], Current_SpareBlock[mu]);
@@ -658,7 +1184,7 @@ int main(int argc, char * argv[])
            printf("%02X ", r10CmdBlk[write_10][j]);
 //        printf("\n");
 
-        if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+        if (smd_io(&dev, &io_hdr) < 0) {
            perror("sg_read_SM325: Inquiry SG_IO ioctl error");
            close(sg_fd);
         return 1;
@@ -685,8 +1211,6 @@ int main(int argc, char * argv[])
                io_hdr.duration, io_hdr.resid, (int)io_hdr.msg_status);
 
            // Check the result to see if this MU has any BadBlock
-           memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-           memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
 
 #ifdef DEBUG_FLAG
            // Print out io_hdr.deferp Reply Buffer
@@ -700,7 +1224,8 @@ int main(int argc, char * argv[])
            }
            printf("\n");
 #endif
-           Current_SpareBlock[mu] = inBuff[0x65];
+           Current_SpareBlock[mu] = smv_spare_count(smv_spare_view(inBuff),
+                                                    profile->spare_offset);
 
            if ((lba % 100) == 0)
            {
@@ -723,7 +1248,7 @@ int main(int argc, char * argv[])
         printf("\n");
 #endif
 
-        if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+        if (smd_io(&dev, &io_hdr) < 0) {
            perror("sg_read_SM325: Inquiry SG_IO ioctl error");
            close(sg_fd);
         return 1;
@@ -752,8 +1277,6 @@ int main(int argc, char * argv[])
 #endif
 
            // Check the result to see if this MU has any BadBlock
-           memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-           memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
 
 #ifdef DEBUG_FLAG
            // Print out io_hdr.deferp Reply Buffer
@@ -767,7 +1290,8 @@ int main(int argc, char * argv[])
            }
            printf("\n");
 #endif
-           Current_SpareBlock[mu] = inBuff[0x65];
+           Current_SpareBlock[mu] = smv_spare_count(smv_spare_view(inBuff),
+                                                    profile->spare_offset);
 
 #ifdef DEBUG_FLAG
            printf("Current MU = %d\n", mu);
@@ -779,29 +1303,123 @@ int main(int argc, char * argv[])
     }
 */
 
+    /* 6+-. Pick the LBA range and access pattern of the sweep */
+    /***********************************************************/
+    pattern_parse(pattern_spec, &sweep);
+    if (0 == strcmp(range_spec, "all"))
+    {
+        range_start = 0;
+        range_len = Total_LBA;
+    }
+    else
+    {
+        mu = (unsigned int)atoi(range_spec);
+        if (mu >= Total_MU)
+        {
+            printf("sg_read_SM3252_Erase_Flash: MU %u out of range, device has %u MUs\n", mu, Total_MU);
+            close(sg_fd);
+            return 1;
+        }
+        range_start = LBA_per_MU * mu;
+        range_len = LBA_per_MU;
+    }
+    printf("Sweep range lba %u - %u, pattern %s\n", range_start,
+           range_len ? range_start + range_len - 1 : range_start, pattern_spec);
+
     /* 6+. Write (16) command for each MU  0x8A */
     /********************************************/
+    if (!do_verify && !do_erase)
     {
         printf("\n  STEP 6+: WRITE (16) COMMAND FOR EACH MU 0x8A\n");
     io_hdr.cmd_len = sizeof(r10CmdBlk[write_10]);
     io_hdr.dxferp = inBuff;
     io_hdr.iovec_count = 0;   // memset should take care of this
 
-    for (loop=1; loop<=10; loop++)
+    /* Checkpoint is keyed by the unit serial number (blanks stripped) */
+    memset(&ckpt, 0, sizeof(ckpt));
+    for (i=0, j=0; (i<16) && (j<(int)sizeof(ckpt.serial)-1); i++)
+    {
+        if ((UnitSerialNumber[i] > ' ') && (UnitSerialNumber[i] < 0x7F))
+            ckpt.serial[j++] = UnitSerialNumber[i];
+    }
+    ckpt.mu_count = Total_MU;
+    ckpt.spare = Current_SpareBlock;
+    snprintf(ckpt.pattern, sizeof(ckpt.pattern), "%s", pattern_spec);
+    snprintf(ckpt.range, sizeof(ckpt.range), "%s", range_spec);
+    pattern_init(&sweep, range_len);
+    if (0 == ckpt_name)
+    {
+        snprintf(ckpt_default, sizeof(ckpt_default), "%s.ckpt",
+                 ckpt.serial[0] ? ckpt.serial : "sweep");
+        ckpt_name = ckpt_default;
+    }
+
+    if (do_resume)
+    {
+        struct sweep_ckpt saved;
+
+        saved.spare = smd_arena_alloc(&arena, Total_MU * sizeof(unsigned short));
+        if (read_checkpoint(ckpt_name, &saved, Total_MU) < 0)
+        {
+            printf("No usable checkpoint in %s, starting the sweep from lba 0\n", ckpt_name);
+        }
+        else if (strcmp(saved.serial, ckpt.serial) != 0)
+        {
+            printf("Checkpoint %s belongs to serial %s, not %s\n",
+                   ckpt_name, saved.serial, ckpt.serial);
+            close(sg_fd);
+            return 1;
+        }
+        else if ((strcmp(saved.pattern, ckpt.pattern) != 0) ||
+                 (strcmp(saved.range, ckpt.range) != 0))
+        {
+            printf("Checkpoint %s was taken with '-p %s -m %s', rerun with those\n",
+                   ckpt_name, saved.pattern, saved.range);
+            close(sg_fd);
+            return 1;
+        }
+        else if ((saved.pass >= 1) && (saved.pass <= SWEEP_PASSES) &&
+                 (saved.done <= sweep.n))
+        {
+            start_loop = saved.pass;
+            start_pos  = saved.done;
+            printf("Resuming sweep at loop %d, position %u\n", start_loop, start_pos);
+            for (mu=0; (mu<saved.mu_count) && (mu<Total_MU); mu++)
+                printf("   MU %u spare blocks at checkpoint = %d, now = %d\n",
+                       mu, saved.spare[mu], Current_SpareBlock[mu]);
+        }
+    }
+
+    trend = calloc(Total_MU ? Total_MU : 1, sizeof(struct spare_trend));
+    if (NULL == trend)
+    {
+        printf("sg_read_SM3252_Erase_Flash: out of memory for spare trend\n");
+        close(sg_fd);
+        return 1;
+    }
+
+    for (loop=start_loop; (loop<=SWEEP_PASSES) && !burnin_abort; loop++)
     {
     /* Write to all LBA */
-    for (lba=0; lba<LBA_per_MU; lba++)
+    for (pos=((loop == start_loop) ? start_pos : 0); pos<sweep.n; pos++)
 //    for (lba=0; lba<10; lba++)
     {
+        lba = range_start + pattern_unit(&sweep, pos);
         SLBA = lba;
+        mu = SLBA / LBA_per_MU;
+        if (mu >= Total_MU)     /* LBAs past Total_MU * LBA_per_MU */
+            mu = Total_MU - 1;
 
-        FourBytes[0] = (SLBA >> 24) & 0xFF;
-        FourBytes[1] = (SLBA >> 16) & 0xFF;
-        FourBytes[2] = (SLBA >> 8) & 0xFF;
-        FourBytes[3] = SLBA & 0xFF;
-        ptr2Buffer = &r10CmdBlk[write_10][6];
+        /* Flush progress every CKPT_INTERVAL LBAs */
+        if ((pos % CKPT_INTERVAL) == 0)
+        {
+            ckpt.pass = loop;
+            ckpt.done = pos;
+            if (write_checkpoint(ckpt_name, &ckpt) < 0)
+                perror("sg_read_SM3252_Erase_Flash: checkpoint write error");
+        }
 
-        memcpy( ptr2Buffer, FourBytes, 4);
+        smc_rw16_lba(r10CmdBlk[write_10], SLBA);
         io_hdr.dxfer_len = READ10_CMD_LEN;
         io_hdr.dxfer_direction = SG_DXFER_TO_DEV;
         io_hdr.cmdp = r10CmdBlk[write_10];
@@ -810,31 +1428,22 @@ int main(int argc, char * argv[])
            printf("%02X ", r10CmdBlk[write_10][j]);
 //        printf("\n");
 
-        if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+        if (smd_io(&dev, &io_hdr) < 0) {
            perror("sg_read_SM325: Inquiry SG_IO ioctl error");
+           /* Record exactly where we stopped so '-r' can pick up from here */
+           ckpt.pass = loop;
+           ckpt.done = pos;
+           write_checkpoint(ckpt_name, &ckpt);
            close(sg_fd);
         return 1;
         }
 
         /* now for the error processing */
-        ok = 0;
-        switch (sg_err_category3(&io_hdr)) {
-           case SG_LIB_CAT_CLEAN:
-              ok = 1;
-              break;
-           case SG_LIB_CAT_RECOVERED:
-              printf("Recovered error on WRITE_16, continuing\n");
-              ok = 1;
-              break;
-           default: // won't bother decoding other categories, unless it's a DID_ERROR
-              if (io_hdr.host_status == 0x07) { // DID_ERROR is ok
-                ok = 1;
-              }
-              else {
-                sg_chk_n_print3("WRITE_16 command error", &io_hdr, 1);
-                break;
-              }
-        }
+        /* Recovered errors are only counted in dev.errors; DID_ERROR is ok */
+        ok = smd_status_ok(&dev.last) || (io_hdr.host_status == SMD_DID_ERROR);
+        if (!ok)
+            fprintf(stderr, "WRITE_16 command error: %s\n",
+                    smd_status_str(&dev.last, status_text, sizeof(status_text)));
 
         if (ok) { /* output result if it is available */
 //           printf("\n   PROCESSING MU NUMBER: %d\n", mu);
@@ -842,8 +1451,6 @@ int main(int argc, char * argv[])
                io_hdr.duration, io_hdr.resid, (int)io_hdr.msg_status);
 
            /* Check the result to see if this MU has any BadBlock */
-           memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-           memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
 
 #ifdef DEBUG_FLAG
            /* Print out io_hdr.deferp Reply Buffer */
@@ -857,11 +1464,12 @@ int main(int argc, char * argv[])
            }
            printf("\n");
 #endif
-           Current_SpareBlock[mu] = inBuff[0x65];
+           Current_SpareBlock[mu] = smv_spare_count(smv_spare_view(inBuff),
+                                                    profile->spare_offset);
 
-           if ((lba % 100) == 0)
+           if ((pos % 100) == 0)
            {
-               printf("Current lba = %d of loop number %d\n", lba, loop);
+               printf("Current lba = %d (position %u) of loop number %d\n", lba, pos, loop);
            }
 #ifdef DEBUG_FLAG
            printf("Current MU = %d\n", mu);
@@ -881,26 +1489,17 @@ int main(int argc, char * argv[])
         printf("\n");
 #endif
 
-        if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+        if (smd_io(&dev, &io_hdr) < 0) {
            perror("sg_read_SM325: Inquiry SG_IO ioctl error");
            close(sg_fd);
         return 1;
         }
 
         /* now for the error processing */
-        ok = 0;
-        switch (sg_err_category3(&io_hdr)) {
-           case SG_LIB_CAT_CLEAN:
-              ok = 1;
-              break;
-           case SG_LIB_CAT_RECOVERED:
-              printf("Recovered error on READ_10, continuing\n");
-              ok = 1;
-              break;
-           default: /* won't bother decoding other categories */
-              sg_chk_n_print3("READ_10 command error", &io_hdr, 1);
-              break;
-        }
+        ok = smd_status_ok(&dev.last);
+        if (!ok)
+            fprintf(stderr, "READ_10 command error: %s\n",
+                    smd_status_str(&dev.last, status_text, sizeof(status_text)));
 
         if (ok) { /* output result if it is available */
 #ifdef DEBUG_FLAG
@@ -910,8 +1509,6 @@ int main(int argc, char * argv[])
 #endif
 
            /* Check the result to see if this MU has any BadBlock */
-           memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-           memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
 
 #ifdef DEBUG_FLAG
            /* Print out io_hdr.deferp Reply Buffer */
@@ -925,18 +1522,224 @@ int main(int argc, char * argv[])
            }
            printf("\n");
 #endif
-           Current_SpareBlock[mu] = inBuff[0x65];
+           Current_SpareBlock[mu] = smv_spare_count(smv_spare_view(inBuff),
+                                                    profile->spare_offset);
 
 #ifdef DEBUG_FLAG
            printf("Current MU = %d\n", mu);
            printf("Current_SpareBlock   = %d (0x%02X)\n", Current_SpareBlock[mu], Current_SpareBlock[mu]);
 #endif
+           /* Track the spare trend of this MU and stop early on a bad module */
+           spare_trend_add(&trend[mu], Current_SpareBlock[mu]);
+           rate = spare_trend_rate(&trend[mu], LBA_per_MU);
+           if (Current_SpareBlock[mu] < spare_min)
+           {
+               snprintf(abort_reason, sizeof(abort_reason),
+                        "MU %u spare blocks %d below %u", mu, Current_SpareBlock[mu], spare_min);
+               burnin_abort = 1;
+           }
+           else if ((max_rate > 0.0) &&
+                    (trend[mu].written >= LBA_per_MU / RATE_MIN_FRACTION) &&
+                    (rate > max_rate))
+           {
+               snprintf(abort_reason, sizeof(abort_reason),
+                        "MU %u losing %.2f spare blocks per pass", mu, rate);
+               burnin_abort = 1;
+           }
+           if (burnin_abort)
+           {
+               printf("ABORT burn-in at lba %u of loop %d - %s\n", lba, loop, abort_reason);
+               /* Keep where the sweep stopped, '-r' re-tests from there */
+               ckpt.pass = loop;
+               ckpt.done = pos + 1;
+               if (write_checkpoint(ckpt_name, &ckpt) < 0)
+                   perror("sg_read_SM3252_Erase_Flash: checkpoint write error");
+               break;
+           }
         }
 
     }  /* end of for loop each mu */
     }  // loop for 10 times
+
+    /* Save the spare block time series of this run for later analysis */
+    snprintf(ebuff, EBUFF_SZ, "%s_spare.csv", ckpt.serial[0] ? ckpt.serial : "sweep");
+    trendFile = fopen(ebuff, "w");
+    if (trendFile == NULL)
+    {
+        printf("Error opening spare trend file %s.\n", ebuff);
+    }
+    else
+    {
+        fprintf(trendFile, "mu,lba_written,spare\n");
+        for (mu=0; mu<Total_MU; mu++)
+        {
+            for (k=0; k<(int)trend[mu].n_samples; k++)
+                fprintf(trendFile, "%u,%u,%u\n", mu, trend[mu].sample[k].written,
+                        trend[mu].sample[k].spare);
+        }
+        fclose(trendFile);
+    }
+    for (mu=0; mu<Total_MU; mu++)
+    {
+        if (trend[mu].n_samples > 0)
+            printf("MU %u spare blocks %u -> %u, %.2f per pass\n", mu,
+                   trend[mu].sample[0].spare,
+                   trend[mu].sample[trend[mu].n_samples - 1].spare,
+                   spare_trend_rate(&trend[mu], LBA_per_MU));
+    }
+    free(trend);
+
+    /* The sweep is complete, nothing left to resume */
+    if (burnin_abort)
+        printf("Checkpoint kept in %s, '-r' resumes the sweep after lba %u\n", ckpt_name, lba);
+    else
+        unlink(ckpt_name);
+    }
+
+    /* 6++. Write (16) a pattern and read (16) it back for verification  0x8A 0x88 */
+    /********************************************************************************/
+    if (do_verify)
+    {
+        printf("\n  STEP 6++: WRITE (16) / READ (16) VERIFY SWEEP 0x8A 0x88\n");
+    if (BlockSize == 0)
+        BlockSize = READ10_REPLY_LEN;
+    words_per_blk = BlockSize / sizeof(uint64_t);
+    verifyBuff = malloc((size_t)chunk_blocks * BlockSize);
+    if (NULL == verifyBuff)
+    {
+        printf("sg_read_SM3252_Erase_Flash: out of memory for %u block chunks\n", chunk_blocks);
+        close(sg_fd);
+        return 1;
+    }
+    memset(&mc, 0, sizeof(mc));
+    /* In verify mode the pattern orders whole chunks */
+    n_units = (range_len + chunk_blocks - 1) / chunk_blocks;
+    pattern_init(&sweep, n_units);
+
+    for (loop=1; loop<=SWEEP_PASSES; loop++)
+    {
+        /* Write the whole range first so the read back cannot be served
+           from the controller's write cache */
+        clock_gettime(CLOCK_MONOTONIC, &t_start);
+        blocks_moved = 0;
+        for (pos=0; pos<n_units; pos++)
+        {
+            lba = pattern_unit(&sweep, pos) * chunk_blocks;
+            nblk = ((range_len - lba) < chunk_blocks) ? (range_len - lba) : chunk_blocks;
+            lba += range_start;
+            blocks_moved += nblk;
+            fill_pattern(verifyBuff, lba, nblk, words_per_blk, loop);
+            smc_rw16(r10CmdBlk[write_10], lba, nblk);
+            if (sweep_io(&dev, r10CmdBlk[write_10], SG_DXFER_TO_DEV, verifyBuff,
+                         nblk * BlockSize, 20000, "WRITE_16 command error", 0) < 0)
+            {
+                free(verifyBuff);
+                close(sg_fd);
+                return 1;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t_end);
+        secs_write = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+
+        clock_gettime(CLOCK_MONOTONIC, &t_start);
+        for (pos=0; pos<n_units; pos++)
+        {
+            lba = pattern_unit(&sweep, pos) * chunk_blocks;
+            nblk = ((range_len - lba) < chunk_blocks) ? (range_len - lba) : chunk_blocks;
+            lba += range_start;
+            smc_rw16(r10CmdBlk[read_16], lba, nblk);
+            ok = sweep_io(&dev, r10CmdBlk[read_16], SG_DXFER_FROM_DEV, verifyBuff,
+                          nblk * BlockSize, 20000, "READ_16 command error", 0);
+            if (ok < 0)
+            {
+                free(verifyBuff);
+                close(sg_fd);
+                return 1;
+            }
+            if (ok)
+                check_pattern(verifyBuff, lba, nblk, words_per_blk, loop, &mc);
+            else
+            {
+                /* An unreadable chunk counts as miscompared */
+                memset(verifyBuff, 0, (size_t)nblk * BlockSize);
+                check_pattern(verifyBuff, lba, nblk, words_per_blk, loop, &mc);
+            }
+        }
+        miscompare_flush(&mc, loop);
+        clock_gettime(CLOCK_MONOTONIC, &t_end);
+        secs_read = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+
+        printf("Verify loop %d: write %.2f MB/s, read+check %.2f MB/s, %u bad blocks so far\n", loop,
+               secs_write > 0 ? (double)blocks_moved * BlockSize / BYTES_IN_MB / secs_write : 0.0,
+               secs_read > 0 ? (double)blocks_moved * BlockSize / BYTES_IN_MB / secs_read : 0.0,
+               mc.bad_blocks);
+    }
+    free(verifyBuff);
+
+    if (mc.bad_blocks > 0)
+    {
+        snprintf(abort_reason, sizeof(abort_reason),
+                 "%u blocks in %u ranges failed read-back verify", mc.bad_blocks, mc.n_ranges);
+        verify_failed = 1;
+    }
+    }
+
+    /* 6+++. Fast erase each MU  0x93 or 0x8A (0xF0 0x0C with -E), checked with 0x88 */
+    /****************************************************************************/
+    if (do_erase)
+    {
+        printf("\n  STEP 6+++: FAST ERASE OF EACH MU\n");
+    if (BlockSize == 0)
+        BlockSize = READ10_REPLY_LEN;
+    verifyBuff = calloc(smo_erase_chunk(BlockSize), BlockSize);
+    if (NULL == verifyBuff)
+    {
+        printf("sg_read_SM3252_Erase_Flash: out of memory for the erase buffer\n");
+        close(sg_fd);
+        return 1;
+    }
+    if (0 == strcmp(range_spec, "all"))
+    {
+        mu_first = 0;
+        mu_last  = Total_MU - 1;
+    }
+    else
+        mu_first = mu_last = range_start / LBA_per_MU;
+
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    for (mu=mu_first; (Total_MU > 0) && (mu<=mu_last); mu++)
+    {
+        mu_lba = LBA_per_MU * mu;
+        mu_len = (mu == Total_MU - 1) ? Total_LBA - mu_lba : LBA_per_MU;
+
+        /* The same erase as sg_SM3252 erase, see sg_SM3252_ops.h */
+        ok = smo_erase_blocks(&dev, stdout, &erase_method, mu, mu_lba, mu_len,
+                              BlockSize, (unsigned char *)verifyBuff);
+        if (ok < 0)
+        {
+            free(verifyBuff);
+            close(sg_fd);
+            return 1;
+        }
+        erase_bad += ok;
     }
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    secs_erase = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+    printf("Erase took %.2f seconds, %u of the sampled blocks not erased\n", secs_erase, erase_bad);
+    free(verifyBuff);
 
+    if (erase_bad > 0)
+    {
+        snprintf(abort_reason, sizeof(abort_reason),
+                 "%u sampled blocks not erased", erase_bad);
+        erase_failed = 1;
+    }
+    }
+
+    /* 7.-11. only on a drive that passed: the CID table of a drive going
+       to RMA is left as it is */
+    if (!burnin_abort && !verify_failed && !erase_failed)
+    {
     /* 7. Prepare READ_10 command for reading LED setting information  0xF0 */
     /************************************************************/
     {
@@ -956,7 +1759,7 @@ int main(int argc, char * argv[])
     /* io_hdr.pack_id = 0; */
     /* io_hdr.usr_ptr = NULL; */
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
 	   perror("sg_read_SM325: Inquiry SG_IO ioctl error");
 	   close(sg_fd);
 	   return 1;
@@ -978,14 +1781,11 @@ int main(int argc, char * argv[])
     }
 
     if (ok) { /* output result if it is available */
-	    memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-
 #ifdef DEBUG_FLAG
 	    printf("\n  STEP 2: READ LED SETTING INFORMATION\n");
 	    /* Print out io_hdr.deferp */
 	    printf("   reply buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-	    memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
 	    for (i=0; i<32; i++)  /* 32 rows */
 	    {
 	      printf("       %3d-%3d = ", i*j, (i*j)+15);
@@ -1005,7 +1805,7 @@ int main(int argc, char * argv[])
 #endif
         for (i=0; i<18; i++)
         {
-	        UnitProductNumber[i] = inBuff[86+(i*2)];
+	        UnitProductNumber[i] = smv_cid_product_char(smv_cid_view(inBuff), i);
         }
         
         strcpy(filename, UnitProductNumber);
@@ -1017,15 +1817,15 @@ int main(int argc, char * argv[])
             printf("Error opening log file.\n");
         }
     
-        if (strncmp(Viking, VendorID, 2) != 0)
+        if (strncmp(Viking, (const char *)VendorID, 2) != 0)
         {
             printf("NO RECONFIG - Not a Viking drive.\n");
-            fprintf(pFile, "%s, %s, %s, %s", UnitProductNumber, UnitSerialNumber, VendorID, asctime(timeinfo));
+            fprintf(pFile, "%s, %.16s, %.8s, %s", UnitProductNumber, UnitSerialNumber, VendorID, asctime(timeinfo));
             fclose(pFile);
             return 0;
         }
         
-        LED_Status_Byte = inBuff[0x187];
+        LED_Status_Byte = inBuff[profile->led_offset];
         LED_Ready       = (LED_Status_Byte & 0x06) >> 1;
         LED_Busy        = (LED_Status_Byte & 0x60) >> 5;
 
@@ -1038,171 +1838,30 @@ int main(int argc, char * argv[])
     }
     }
 
-    /* 8. Prepare READ_10 command for writing LED setting information  0xF1 */
+    /* 8.-9. Write the LED setting  0xF1, and read it back  0xF0 */
     /************************************************************/
     {
     printf("8. READ Bad Block command 0xF1 for writing LED setting information\n");
-#ifdef DEBUG_FLAG
-	printf("\n  STEP 3: WRITE LED SETTING INFORMATION\n");
-#endif
-    if (inBuff[0x187] == 0x82)
-    {
-        LED_result = 0;
-//        printf("Already configured ");
-    }
-    else if (inBuff[0x187] == 0x80)
-    {
-        inBuff[0x187] = 0x82;
-#ifdef DEBUG_FLAG
-        printf("Updating the CID table...\n");
-#endif
-    }
-    
-    memset(&io_hdr, 0, sizeof(sg_io_hdr_t));
-    io_hdr.interface_id = 'S';
-    io_hdr.cmd_len = sizeof(r10CmdBlk[write_LED]);
-    /* io_hdr.iovec_count = 0; */  /* memset takes care of this */
-    io_hdr.mx_sb_len = sizeof(sense_buffer);
-    io_hdr.dxfer_direction = SG_DXFER_TO_DEV;
-    io_hdr.dxfer_len = READ10_REPLY_LEN;
-    io_hdr.dxferp = inBuff;
-    io_hdr.cmdp = r10CmdBlk[write_LED];
-    io_hdr.sbp = sense_buffer;
-    io_hdr.timeout = 20000;     /* 20000 millisecs == 20 seconds */
-    /* io_hdr.flags = 0; */     /* take defaults: indirect IO, etc */
-    /* io_hdr.pack_id = 0; */
-    /* io_hdr.usr_ptr = NULL; */
-
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
-	   perror("sg_read_SM325: Inquiry SG_IO ioctl error");
-	   close(sg_fd);
-	   return 1;
-    }
-
-    /* now for the error processing */
-    ok = 0;
-    switch (sg_err_category3(&io_hdr)) {
-       case SG_LIB_CAT_CLEAN:
-	      ok = 1;
-	      break;
-       case SG_LIB_CAT_RECOVERED:
-	      printf("Recovered error on READ_10, continuing\n");
-	      ok = 1;
-	      break;
-       default: /* won't bother decoding other categories */
-	      sg_chk_n_print3("READ_10 command error", &io_hdr, 1);
-	      break;
-    }
-
-    if (ok) { /* output result if it is available */
-	    memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-
-#ifdef DEBUG_FLAG
-	    /* Print out io_hdr.deferp */
-	    printf("   reply buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
-	    printf("                 -----------------------------------------------------------------------------------------------\n");
-	    memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
-	    for (i=0; i<16; i++)  /* 16 rows */
-	    {
-	      printf("       %3d-%3d = ", i*j, (i*j)+31);
-
-	      for (j=0; j<32; j++)
-	         printf("%02X ", inBuff[(i*32)+j]);
-	   
-	      printf("\n");
-	    }
-        printf("\n");
-#endif
-        LED_Status_Byte = inBuff[0x187];
-        LED_Ready       = (LED_Status_Byte & 0x06) >> 1;
-        LED_Busy        = (LED_Status_Byte & 0x60) >> 5;
-
-#ifdef DEBUG_FLAG
-        printf("LED_Status_Byte = 0x%X\n", LED_Status_Byte);
-        printf("LED_Ready       = %d\n", LED_Ready);
-        printf("LED_Busy        = %d\n", LED_Busy);
-        printf("Done\n");
-#endif
-    }
-    }
-
-    /* 9. Prepare READ_10 command for reading LED setting information  0xF0 */
-    /************************************************************/
-    {
     printf("9. READ Bad Block command 0xF0 for reading LED setting information\n");
-    memset(&io_hdr, 0, sizeof(sg_io_hdr_t));
-    io_hdr.interface_id = 'S';
-    io_hdr.cmd_len = sizeof(r10CmdBlk[read_LED]);
-    /* io_hdr.iovec_count = 0; */  /* memset takes care of this */
-    io_hdr.mx_sb_len = sizeof(sense_buffer);
-    io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
-    io_hdr.dxfer_len = READ10_REPLY_LEN;
-    io_hdr.dxferp = inBuff;
-    io_hdr.cmdp = r10CmdBlk[read_LED];
-    io_hdr.sbp = sense_buffer;
-    io_hdr.timeout = 20000;     /* 20000 millisecs == 20 seconds */
-    /* io_hdr.flags = 0; */     /* take defaults: indirect IO, etc */
-    /* io_hdr.pack_id = 0; */
-    /* io_hdr.usr_ptr = NULL; */
-
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
-	   perror("sg_read_SM325: Inquiry SG_IO ioctl error");
-	   close(sg_fd);
-	   return 1;
-    }
-
-    /* now for the error processing */
-    ok = 0;
-    switch (sg_err_category3(&io_hdr)) {
-       case SG_LIB_CAT_CLEAN:
-	      ok = 1;
-	      break;
-       case SG_LIB_CAT_RECOVERED:
-	      printf("Recovered error on READ_10, continuing\n");
-	      ok = 1;
-	      break;
-       default: /* won't bother decoding other categories */
-	      sg_chk_n_print3("READ_10 command error", &io_hdr, 1);
-	      break;
+    /* The same LED patch as sg_SM3252 led, see sg_SM3252_ops.h */
+    ok = smo_led_write(&dev, stdout, inBuff, profile->led_offset);
+    if (ok < 0) {
+       close(sg_fd);
+       return 1;
     }
-
-    if (ok) { /* output result if it is available */
-	    memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
+    LED_result = (smo_led_done == ok) ? 0 : (smo_led_passed == ok) ? 1 : 2;
+    if ((2 == LED_result) && (pFile != NULL))
+        fprintf(pFile, "%s, %.16s, FAILED, %s", UnitProductNumber, UnitSerialNumber, asctime(timeinfo));
+    LED_Status_Byte = inBuff[profile->led_offset];
+    LED_Ready       = (LED_Status_Byte & 0x06) >> 1;
+    LED_Busy        = (LED_Status_Byte & 0x60) >> 5;
 
 #ifdef DEBUG_FLAG
-	    printf("\n  STEP 4: READ LED SETTING INFORMATION AFTER A WRITE\n");
-	    /* Print out io_hdr.deferp */
-	    printf("   reply buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
-	    printf("                 -----------------------------------------------------------------------------------------------\n");
-	    memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
-	    for (i=0; i<16; i++)  /* 16 rows */
-	    {
-	      printf("       %3d-%3d = ", i*j, (i*j)+31);
-
-	      for (j=0; j<32; j++)
-	         printf("%02X ", inBuff[(i*32)+j]);
-	   
-	      printf("\n");
-	    }
-        printf("\n");
+    printf("LED_Status_Byte = 0x%X\n", LED_Status_Byte);
+    printf("LED_Ready       = %d\n", LED_Ready);
+    printf("LED_Busy        = %d\n", LED_Busy);
+    printf("Done\n");
 #endif
-        LED_Status_Byte = inBuff[0x187];
-        LED_Ready       = (LED_Status_Byte & 0x06) >> 1;
-        LED_Busy        = (LED_Status_Byte & 0x60) >> 5;
-
-        if (inBuff[0x187] == 0x82)
-        {
-            LED_result = 1;
-//            printf("PASSED.\n");
-//            fprintf(pFile, "%s, %s, PASSED, %s", UnitProductNumber, UnitSerialNumber, asctime(timeinfo));
-        }
-        else 
-        {
-            LED_result = 2;
-            printf("FAILED - Re-test or reject.\n");
-            fprintf(pFile, "%s, %s, FAILED, %s", UnitProductNumber, UnitSerialNumber, asctime(timeinfo));
-        }
-    }
     }
     
     /* 10. Prepare READ_10 command for reset the drive  0xF0 */
@@ -1227,7 +1886,7 @@ int main(int argc, char * argv[])
     /* io_hdr.pack_id = 0; */
     /* io_hdr.usr_ptr = NULL; */
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
 	   perror("sg_read_SM325: Inquiry SG_IO ioctl error");
 	   close(sg_fd);
 	   return 1;
@@ -1248,13 +1907,10 @@ int main(int argc, char * argv[])
     }
 
     if (ok) { /* output result if it is available */
-	    memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-
 //#ifdef DEBUG_FLAG
 	    /* Print out io_hdr.deferp */
 	    printf("   reply buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-	    memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
 	    for (i=0; i<16; i++)  /* 16 rows */
 	    {
 	      printf("       %3d-%3d = ", i*j, (i*j)+31);
@@ -1289,7 +1945,7 @@ int main(int argc, char * argv[])
     /* io_hdr.pack_id = 0; */
     /* io_hdr.usr_ptr = NULL; */
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
        perror("sg_read_SM325: Inquiry SG_IO ioctl error");
        close(sg_fd);
        return 1;
@@ -1311,14 +1967,11 @@ int main(int argc, char * argv[])
     }
 
     if (ok) { /* output result if it is available */
-        memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-
 #ifdef DEBUG_FLAG
         printf("\n  STEP 2: READ LED SETTING INFORMATION\n");
         /* Print out io_hdr.deferp */
         printf("   reply buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
         printf("                 -----------------------------------------------------------------------------------------------\n");
-        memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
         for (i=0; i<32; i++)  /* 32 rows */
         {
           printf("       %3d-%3d = ", i*j, (i*j)+15);
@@ -1338,7 +1991,7 @@ int main(int argc, char * argv[])
 #endif
         for (i=0; i<18; i++)
         {
-            UnitProductNumber[i] = inBuff[86+(i*2)];
+            UnitProductNumber[i] = smv_cid_product_char(smv_cid_view(inBuff), i);
         }
 
         strcpy(filename, UnitProductNumber);
@@ -1350,15 +2003,15 @@ int main(int argc, char * argv[])
             printf("Error opening log file.\n");
         }
 
-        if (strncmp(Viking, VendorID, 2) != 0)
+        if (strncmp(Viking, (const char *)VendorID, 2) != 0)
         {
             printf("NO RECONFIG - Not a Viking drive.\n");
-            fprintf(pFile, "%s, %s, %s, %s", UnitProductNumber, UnitSerialNumber, VendorID, asctime(timeinfo));
+            fprintf(pFile, "%s, %.16s, %.8s, %s", UnitProductNumber, UnitSerialNumber, VendorID, asctime(timeinfo));
             fclose(pFile);
             return 0;
         }
 
-        LED_Status_Byte = inBuff[0x187];
+        LED_Status_Byte = inBuff[profile->led_offset];
         LED_Ready       = (LED_Status_Byte & 0x06) >> 1;
         LED_Busy        = (LED_Status_Byte & 0x60) >> 5;
 
@@ -1370,7 +2023,28 @@ int main(int argc, char * argv[])
 #endif
     }
     }
+    }
+
 
+    if (burnin_abort || verify_failed || erase_failed)
+    {
+        LED_result = burnin_abort ? 3 : verify_failed ? 4 : 5;
+        /* Steps 7.-11. were skipped: read the CID table for the product
+           number that names the log */
+        memset(UnitProductNumber, 0, sizeof(UnitProductNumber));
+        if (sweep_io(&dev, r10CmdBlk[read_LED], SG_DXFER_FROM_DEV, inBuff,
+                     READ10_REPLY_LEN, 20000, "READ_10 command error", 0) > 0)
+        {
+            for (i=0; i<(int)sizeof(UnitProductNumber)-1; i++)
+                UnitProductNumber[i] = smv_cid_product_char(smv_cid_view(inBuff), i);
+            snprintf((char *)filename, sizeof(filename), "%s.txt", UnitProductNumber);
+            pFile = fopen((const char *)filename, "a");
+            if (pFile == NULL)
+                printf("Error opening log file.\n");
+        }
+        if (pFile != NULL)
+            fprintf(pFile, "%s, %.16s, RMA - %s, %s", UnitProductNumber, UnitSerialNumber, abort_reason, asctime(timeinfo));
+    }
 
     /******************************/
     /*    Print out the results   */
@@ -1400,8 +2074,25 @@ int main(int argc, char * argv[])
           break;
     }
 #endif
+    /* The RMA verdict whatever the debug flags */
+    if (3 == LED_result)
+        printf("RMA - burn-in aborted: %s\n", abort_reason);
+    else if (4 == LED_result)
+        printf("RMA - verify failed: %s\n", abort_reason);
+    else if (5 == LED_result)
+        printf("RMA - erase failed: %s\n", abort_reason);
     
-    fclose(pFile);
+    if (profile_name[0]) {
+        smd_lat_print(&dev);
+        if (smd_lat_save(&dev, profile_name) < 0)
+            perror("sg_read_SM3252_Erase_Flash: error saving timeout profile");
+    }
+    smd_print_stats(&dev, "sg_read_SM3252_Erase_Flash");
+    smd_print_errors(&dev, "sg_read_SM3252_Erase_Flash");
+    if (pFile != NULL)
+        fclose(pFile);
+    smd_arena_release(&arena);
+    smd_dev_release(&dev);
     close(sg_fd);
-    return 0;
+    return (LED_result >= 3) ? 1 : 0;
 }
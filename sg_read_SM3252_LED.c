@@ -10,6 +10,12 @@
 #include <sys/stat.h>
 #include "sg_lib.h"
 #include "sg_io_linux.h"
+#include "sg_SM3252_dev.h"
+#include "sg_SM3252_cdb.h"
+#include "sg_SM3252_view.h"
+#include "sg_SM3252_prof.h"
+#include "sg_SM3252_trace.h"
+#include "sg_SM3252_ops.h"
 
 /* This program performs a similar READ_10 command as scsi mid-level support
    16 byte commands from lk 2.4.15 to read basic information from SM325 chip
@@ -20,7 +26,11 @@
 *  the Free Software Foundation; either version 2, or (at your option)
 *  any later version.
 
-   Invocation: sg_read_SM3252_LED <scsi_device>
+   Invocation: sg_read_SM3252_LED [-C <controller_file>] <scsi_device>
+
+   The LED byte is found in the CID table where the controller profile of
+   the firmware says (see sg_SM3252_prof.h); -C loads the profiles from
+   <controller_file> instead of the built in ones.
 
    Version 1.02 (20020206)
 
@@ -42,7 +52,6 @@
 #define INQ_CMD_LEN       6
 
 #define EBUFF_SZ 256
-#define MAX_MU   256
 
 enum read_steps {basic_info, init_and_current_badblocks, current_spare_blocks_1, current_spare_blocks_2, read_LED, write_LED, reset_drive}; 
 enum inq_read_steps {inq_basic_info, inq_unit_serial_number}; 
@@ -54,10 +63,17 @@ int main(int argc, char * argv[])
     struct tm * timeinfo;
     int sg_fd, k, ok, i, j;
     sg_io_hdr_t io_hdr;
+    struct smd_dev dev;
+    int max_retries = -1;
+    char * profile_dir = 0;
+    char * trace_file = 0;
+    char * controller_file = 0;
+    const struct smp_profile * profile;
+    unsigned int line;
+    char profile_name[EBUFF_SZ] = "";
     char * file_name = 0;
     char ebuff[EBUFF_SZ];
     unsigned char sense_buffer[32];
-    unsigned char FourBytes[4];
     unsigned char Viking[] = "VT";
     unsigned char filename[22];
 
@@ -69,13 +85,20 @@ int main(int argc, char * argv[])
                {0xF0, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0},
                {0xF1, 0x03, 0, 0, 0, 0, 0, 0, 0x20, 0, 0, 1, 0, 0, 0, 0},
                {0xF0, 0x2C, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0} };
-    unsigned char inBuff[READ10_REPLY_LEN], saveBuff[READ10_REPLY_LEN];
-    unsigned int Total_MU=0, Total_LBA=0, LBA_per_MU=0, HalfLBA_per_MU=0, LED_result=0;
+    unsigned char inBuff[READ10_REPLY_LEN];
+    unsigned int LED_result=0;
+    struct smd_geometry geom;
     
     unsigned char inqCmdBlk [2][INQ_CMD_LEN] =
              { {0x12, 0, 0, 0, INQ_REPLY_LEN, 0}, {0x12, 0, 0x80, 0, INQ_REPLY_LEN, 0} };
-    unsigned char inqBuff[INQ_REPLY_LEN];
-    unsigned char VendorID[8], ProductID[16], ProductRevision[4], UnitSerialNumber[18], UnitProductNumber[18];
+    /* Each INQUIRY gets its own buffer; the fields are read in place */
+    unsigned char inqBuff[INQ_REPLY_LEN], snBuff[INQ_REPLY_LEN];
+    struct smv_inquiry inq = smv_inquiry_view(inqBuff);
+    const unsigned char * VendorID = smv_inq_vendor(inq);
+    const unsigned char * ProductID = smv_inq_product(inq);
+    const unsigned char * ProductRevision = smv_inq_revision(inq);
+    const unsigned char * UnitSerialNumber = smv_serial_number(smv_serial_view(snBuff));
+    unsigned char UnitProductNumber[18];
 
     unsigned char capCmdBlk [READCAP_CMD_LEN] =
               {0x25, 0, 0, 0, 0, 0, 0, 0, 0, 0};
@@ -87,7 +110,15 @@ int main(int argc, char * argv[])
     timeinfo = localtime( &rawtime );
     
     for (k = 1; k < argc; ++k) {
-        if (*argv[k] == '-') {
+        if ((0 == strcmp("-C", argv[k])) && (k + 1 < argc))
+            controller_file = argv[++k];
+        else if ((0 == strcmp("-R", argv[k])) && (k + 1 < argc))
+            max_retries = atoi(argv[++k]);
+        else if ((0 == strcmp("-T", argv[k])) && (k + 1 < argc))
+            profile_dir = argv[++k];
+        else if ((0 == strcmp("-t", argv[k])) && (k + 1 < argc))
+            trace_file = argv[++k];
+        else if (*argv[k] == '-') {
             printf("Unrecognized switch: %s\n", argv[k]);
             file_name = 0;
             break;
@@ -101,7 +132,27 @@ int main(int argc, char * argv[])
         }
     }
     if (0 == file_name) {
-        printf("Usage: 'sg_read_SM3252_LED <sg_device>'\n");
+        printf("Usage: 'sg_read_SM3252_LED [-C <controller_file>] [-R <retries>] [-T <profile_dir>] [-t <trace_file>] <sg_device>'\n");
+        printf("  -C    controller profiles from <controller_file> instead of the built in ones\n");
+        printf("  -R    retries of a failed SG_IO command (default: depends on the command)\n");
+        printf("  -T    learn command timeouts from observed latencies, kept per product\n");
+        printf("        and firmware in <profile_dir>\n");
+        printf("  -t    write every SG_IO command to <trace_file> as a Chrome trace\n");
+        printf("        (chrome://tracing, ui.perfetto.dev)\n");
+        return 1;
+    }
+    if (controller_file && (smp_load(controller_file, &line) < 0)) {
+        if ((EINVAL == errno) && line)
+            printf("sg_read_SM3252_LED: %s line %u is not a controller profile\n",
+                   controller_file, line);
+        else if (EINVAL == errno)
+            printf("sg_read_SM3252_LED: no controller profile in %s\n",
+                   controller_file);
+        else {
+            snprintf(ebuff, EBUFF_SZ, "sg_read_SM3252_LED: error reading %s",
+                     controller_file);
+            perror(ebuff);
+        }
         return 1;
     }
 
@@ -118,6 +169,15 @@ int main(int argc, char * argv[])
         close(sg_fd);
         return 1;
     }
+    smd_dev_init(&dev, sg_fd);
+    dev.max_retries = max_retries;
+    if (trace_file) {
+        smtr_start_file(trace_file);
+        smtr_name(sg_fd, file_name);
+    }
+    /* What a failed INQUIRY leaves out prints as blanks */
+    memset(inqBuff, 0, sizeof(inqBuff));
+    memset(snBuff, 0, sizeof(snBuff));
 
     /* 1. Prepare INQUIRY command for Vendor ID, Product ID, Product Revision */
     /**************************************************************************/
@@ -136,7 +196,7 @@ int main(int argc, char * argv[])
     /* io_hdr.pack_id = 0; */
     /* io_hdr.usr_ptr = NULL; */
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
         perror("sg_simple1: Inquiry SG_IO ioctl error");
         close(sg_fd);
         return 1;
@@ -163,7 +223,6 @@ int main(int argc, char * argv[])
 #ifdef DEBUG_FLAG
 	    printf(" inquiry buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-   		memcpy( inqBuff, io_hdr.dxferp, sizeof(inqBuff));
 	    for (i=0; i<16; i++)  /* 16 rows */
 	    {
 	      printf("       %3d-%3d = ", i*j, (i*j)+31);
@@ -175,17 +234,26 @@ int main(int argc, char * argv[])
 	    }
         printf("\n");
 #endif
-   		memcpy( VendorID, p + 8, sizeof(VendorID));
-   		memcpy( ProductID, p + 16, sizeof(ProductID));
-   		memcpy( ProductRevision, p + 32, sizeof(ProductRevision));
+    }
+
+    /* The firmware says where the LED byte is in the CID table */
+    profile = smp_default(ProductRevision);
+
+    /* Timeouts learned on earlier runs with this product and firmware */
+    if (ok && profile_dir &&
+        (smd_lat_profile_name(profile_dir, VendorID, ProductID, ProductRevision,
+                              profile_name, sizeof(profile_name)) == 0)) {
+        smd_lat_load(&dev, profile_name);
+        dev.adaptive = 1;
     }
 
     /* 2. Prepare INQUIRY command for Unit Serial Number */
     /*****************************************************/
     io_hdr.cmd_len = sizeof(inqCmdBlk[inq_unit_serial_number]);
     io_hdr.cmdp = inqCmdBlk[inq_unit_serial_number];
+    io_hdr.dxferp = snBuff;
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
         perror("sg_simple1: Inquiry SG_IO ioctl error");
         close(sg_fd);
         return 1;
@@ -207,25 +275,23 @@ int main(int argc, char * argv[])
     }
 
     if (ok) { /* output result if it is available */
-        char * p = (char *)inqBuff;
+        char * p = (char *)snBuff;
         int f = (int)*(p + 7);
 #ifdef DEBUG_FLAG
         printf("Unit Serial Number: %.16s \n", p + 4);
 	    printf(" inquiry buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-   		memcpy( inqBuff, io_hdr.dxferp, sizeof(inqBuff));
 	    for (i=0; i<16; i++)  /* 16 rows */
 	    {
 	      printf("       %3d-%3d = ", i*j, (i*j)+31);
 
 	      for (j=0; j<32; j++)
-	         printf("%02X ", inqBuff[(i*32)+j]);
+	         printf("%02X ", snBuff[(i*32)+j]);
 	   
 	      printf("\n");
 	    }
         printf("\n");
 #endif
-   		memcpy( UnitSerialNumber, p + 4, sizeof(UnitSerialNumber));
     }
 
     /* 3. Prepare READ CAPACITY command for Block Size and Disk Size */
@@ -235,7 +301,7 @@ int main(int argc, char * argv[])
     io_hdr.dxferp = capBuff;
     io_hdr.cmdp = capCmdBlk;
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
         perror("sg_simple1: READ CAPACITY SG_IO ioctl error");
         close(sg_fd);
         return 1;
@@ -260,22 +326,13 @@ int main(int argc, char * argv[])
 #ifdef DEBUG_FLAG
 	    printf(" readcap buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-   		memcpy( capBuff, io_hdr.dxferp, sizeof(capBuff));
         printf("                 ");
         for (j=0; j<8; j++)
 	        printf("%02X ", capBuff[j]);
 	    printf("\n");
 #endif
-        FourBytes[0] = capBuff[7];
-        FourBytes[1] = capBuff[6];
-        FourBytes[2] = capBuff[5];
-        FourBytes[3] = capBuff[4];
-        BlockSize  = *(int *)FourBytes;
-        FourBytes[0] = capBuff[3];
-        FourBytes[1] = capBuff[2];
-        FourBytes[2] = capBuff[1];
-        FourBytes[3] = capBuff[0];
-        DiskSize  = ((*(int *)FourBytes) + 1) * BlockSize;
+        BlockSize  = smc_readcap_block_size(capBuff);
+        DiskSize  = (smc_readcap_last_lba(capBuff) + 1) * BlockSize;
     }
 
     /* 1. Prepare READ_10 command for reading basic information */
@@ -295,7 +352,7 @@ int main(int argc, char * argv[])
     /* io_hdr.pack_id = 0; */
     /* io_hdr.usr_ptr = NULL; */
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
 	   perror("sg_read_SM325: Inquiry SG_IO ioctl error");
 	   close(sg_fd);
 	   return 1;
@@ -317,14 +374,11 @@ int main(int argc, char * argv[])
     }
 
     if (ok) { /* output result if it is available */
-	    memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-
 #ifdef DEBUG_FLAG
 	    printf("\n  STEP 1: READ BASIC INFORMATION\n");
 	    /* Print out io_hdr.deferp */
 	    printf("   reply buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-	    memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
 	    for (i=0; i<8; i++)  /* 8 rows */
 	    {
 	      printf("       %3d-%3d = ", i*j, (i*j)+31);
@@ -336,20 +390,15 @@ int main(int argc, char * argv[])
 	    }
         printf("\n");
 #endif
-        Total_MU   = inBuff[1];
-        FourBytes[0] = inBuff[0x17];
-        FourBytes[1] = inBuff[0x16];
-        FourBytes[2] = inBuff[0x15];
-        FourBytes[3] = inBuff[0x14];
-        Total_LBA  = *(int *)FourBytes;
-        LBA_per_MU = Total_LBA / Total_MU;
-        HalfLBA_per_MU = LBA_per_MU / 2;
+        if (smd_geometry_decode(inBuff, &geom) < 0)
+            printf("Invalid geometry: Total MU = %d, Total LBA = 0x%02X%02X%02X%02X\n",
+                   inBuff[1], inBuff[0x14], inBuff[0x15], inBuff[0x16], inBuff[0x17]);
 
 #ifdef DEBUG_FLAG
-        printf("Total MU       = %d\n", Total_MU);
-        printf("Total LBA      = %d (0x%X)\n", Total_LBA, Total_LBA);
-        printf("LBA per MU     = %d\n", LBA_per_MU);
-        printf("HalfLBA per MU = %d\n\n", HalfLBA_per_MU);
+        printf("Total MU       = %d\n", geom.total_mu);
+        printf("Total LBA      = %d (0x%X)\n", geom.total_lba, geom.total_lba);
+        printf("LBA per MU     = %d\n", geom.lba_per_mu);
+        printf("HalfLBA per MU = %d\n\n", geom.half_lba_per_mu);
         printf("Done\n");
 #endif
     }
@@ -371,7 +420,7 @@ int main(int argc, char * argv[])
     /* io_hdr.pack_id = 0; */
     /* io_hdr.usr_ptr = NULL; */
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
 	   perror("sg_read_SM325: Inquiry SG_IO ioctl error");
 	   close(sg_fd);
 	   return 1;
@@ -393,11 +442,6 @@ int main(int argc, char * argv[])
     }
 
     if (ok) { /* output result if it is available */
-	    memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-	    memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
-
-	    /* Save a back up buffer to compare it later to saveBuff */
-	    memcpy( saveBuff, io_hdr.dxferp, sizeof(saveBuff));
 
 #ifdef DEBUG_FLAG1
 	    printf("\n  STEP 2: READ LED SETTING INFORMATION\n");
@@ -423,7 +467,7 @@ int main(int argc, char * argv[])
 #endif
         for (i=0; i<18; i++)
         {
-	        UnitProductNumber[i] = inBuff[86+(i*2)];
+	        UnitProductNumber[i] = smv_cid_product_char(smv_cid_view(inBuff), i);
         }
         
         strcpy(filename, UnitProductNumber);
@@ -435,15 +479,15 @@ int main(int argc, char * argv[])
             printf("Error opening log file.\n");
         }
     
-        if (strncmp(Viking, VendorID, 2) != 0)
+        if (strncmp(Viking, (const char *)VendorID, 2) != 0)
         {
             printf("NO RECONFIG - Not a Viking drive.\n");
-            fprintf(pFile, "%s, %s, %s, %s", UnitProductNumber, UnitSerialNumber, VendorID, asctime(timeinfo));
+            fprintf(pFile, "%s, %.16s, %.8s, %s", UnitProductNumber, UnitSerialNumber, VendorID, asctime(timeinfo));
             fclose(pFile);
             return 0;
         }
         
-        LED_Status_Byte = inBuff[0x187];
+        LED_Status_Byte = inBuff[profile->led_offset];
         LED_Ready       = (LED_Status_Byte & 0x06) >> 1;
         LED_Busy        = (LED_Status_Byte & 0x60) >> 5;
 
@@ -455,192 +499,20 @@ int main(int argc, char * argv[])
 #endif
     }
 
-    /* 3. Prepare READ_10 command for writing LED setting information */
+    /* 3.-4. Write the LED setting and read it back */
     /************************************************************/
 #ifdef DEBUG_FLAG
 	printf("\n  STEP 3: WRITE LED SETTING INFORMATION\n");
 #endif
-    if (inBuff[0x187] == 0x82)
-    {
-        LED_result = 0;
-        printf("Already configured ");
-    }
-    else if (inBuff[0x187] == 0x80)
-    {
-        inBuff[0x187] = 0x82;
-#ifdef DEBUG_FLAG
-        printf("Updating the CID table...\n");
-#endif
-    }
-    
-    memset(&io_hdr, 0, sizeof(sg_io_hdr_t));
-    io_hdr.interface_id = 'S';
-    io_hdr.cmd_len = sizeof(r10CmdBlk[write_LED]);
-    /* io_hdr.iovec_count = 0; */  /* memset takes care of this */
-    io_hdr.mx_sb_len = sizeof(sense_buffer);
-    io_hdr.dxfer_direction = SG_DXFER_TO_DEV;
-    io_hdr.dxfer_len = READ10_REPLY_LEN;
-    io_hdr.dxferp = inBuff;
-    io_hdr.cmdp = r10CmdBlk[write_LED];
-    io_hdr.sbp = sense_buffer;
-    io_hdr.timeout = 20000;     /* 20000 millisecs == 20 seconds */
-    /* io_hdr.flags = 0; */     /* take defaults: indirect IO, etc */
-    /* io_hdr.pack_id = 0; */
-    /* io_hdr.usr_ptr = NULL; */
-
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
-	   perror("sg_read_SM325: Inquiry SG_IO ioctl error");
+    /* The same LED patch as sg_SM3252 led, see sg_SM3252_ops.h */
+    ok = smo_led_write(&dev, stdout, inBuff, profile->led_offset);
+    if (ok < 0) {
 	   close(sg_fd);
 	   return 1;
     }
-
-    /* now for the error processing */
-    ok = 0;
-    switch (sg_err_category3(&io_hdr)) {
-       case SG_LIB_CAT_CLEAN:
-	      ok = 1;
-	      break;
-       case SG_LIB_CAT_RECOVERED:
-	      printf("Recovered error on READ_10, continuing\n");
-	      ok = 1;
-	      break;
-       default: /* won't bother decoding other categories */
-	      sg_chk_n_print3("READ_10 command error", &io_hdr, 1);
-	      break;
-    }
-
-    if (ok) { /* output result if it is available */
-	    memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-
-#ifdef DEBUG_FLAG1
-	    /* Print out io_hdr.deferp */
-	    printf("   reply buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
-	    printf("                 -----------------------------------------------------------------------------------------------\n");
-	    memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
-	    for (i=0; i<16; i++)  /* 16 rows */
-	    {
-	      printf("       %3d-%3d = ", i*j, (i*j)+31);
-
-	      for (j=0; j<32; j++)
-	      {
-	         printf("%02X ", inBuff[(i*32)+j]);
-	         
-	         if (inBuff[(i*32)+j] != saveBuff[(i*32)+j])
-	         {
-   	            printf("<* ");
-	         }
-	      }
-	   
-	      printf("\n");
-	    }
-        printf("\n");
-#endif
-        LED_Status_Byte = inBuff[0x187];
-        LED_Ready       = (LED_Status_Byte & 0x06) >> 1;
-        LED_Busy        = (LED_Status_Byte & 0x60) >> 5;
-
-#ifdef DEBUG_FLAG
-        printf("LED_Status_Byte = 0x%X\n", LED_Status_Byte);
-        printf("LED_Ready       = %d\n", LED_Ready);
-        printf("LED_Busy        = %d\n", LED_Busy);
-        printf("Done\n");
-#endif
-    }
-
-    /* 4. Prepare READ_10 command for reading LED setting information */
-    /************************************************************/
-    memset(&io_hdr, 0, sizeof(sg_io_hdr_t));
-    io_hdr.interface_id = 'S';
-    io_hdr.cmd_len = sizeof(r10CmdBlk[read_LED]);
-    /* io_hdr.iovec_count = 0; */  /* memset takes care of this */
-    io_hdr.mx_sb_len = sizeof(sense_buffer);
-    io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
-    io_hdr.dxfer_len = READ10_REPLY_LEN;
-    io_hdr.dxferp = inBuff;
-    io_hdr.cmdp = r10CmdBlk[read_LED];
-    io_hdr.sbp = sense_buffer;
-    io_hdr.timeout = 20000;     /* 20000 millisecs == 20 seconds */
-    /* io_hdr.flags = 0; */     /* take defaults: indirect IO, etc */
-    /* io_hdr.pack_id = 0; */
-    /* io_hdr.usr_ptr = NULL; */
-
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
-	   perror("sg_read_SM325: Inquiry SG_IO ioctl error");
-	   close(sg_fd);
-	   return 1;
-    }
-
-    /* now for the error processing */
-    ok = 0;
-    switch (sg_err_category3(&io_hdr)) {
-       case SG_LIB_CAT_CLEAN:
-	      ok = 1;
-	      break;
-       case SG_LIB_CAT_RECOVERED:
-	      printf("Recovered error on READ_10, continuing\n");
-	      ok = 1;
-	      break;
-       default: /* won't bother decoding other categories */
-	      sg_chk_n_print3("READ_10 command error", &io_hdr, 1);
-	      break;
-    }
-
-    if (ok) { /* output result if it is available */
-	    memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-
-#ifdef DEBUG_FLAG
-	    printf("\n  STEP 4: READ LED SETTING INFORMATION AFTER A WRITE\n");
-	    /* Print out io_hdr.deferp */
-	    printf("   reply buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
-	    printf("                 -----------------------------------------------------------------------------------------------\n");
-	    memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
-	    for (i=0; i<16; i++)  /* 16 rows */
-	    {
-	      printf("       %3d-%3d = ", i*j, (i*j)+31);
-
-	      for (j=0; j<32; j++)
-	         printf("%02X ", inBuff[(i*32)+j]);
-	   
-	      printf("\n");
-	    }
-        printf("\n");
-#endif
-
-        /* Compare the back up buffer against the newly read buffer to ensure no changes */
-        for (i=0; i<sizeof(inBuff); i++)
-        {
-            if (inBuff[i] != saveBuff[i])
-            {
-                if (i == 0x187) /* LED Byte */
-                {
-                    continue;
-                }
-                else
-                {
-                    LED_result = 2;
-                    printf("FAILED - Buffer comparison failed.\n");
-                    fprintf(pFile, "%s, %s, FAILED Buffer Comparison, %s", UnitProductNumber, UnitSerialNumber, asctime(timeinfo));
-                }
-            }
-        }
-        
-        LED_Status_Byte = inBuff[0x187];
-        LED_Ready       = (LED_Status_Byte & 0x06) >> 1;
-        LED_Busy        = (LED_Status_Byte & 0x60) >> 5;
-
-        if (inBuff[0x187] == 0x82)
-        {
-            LED_result = 1;
-            printf("PASSED.\n");
-            fprintf(pFile, "%s, %s, PASSED, %s", UnitProductNumber, UnitSerialNumber, asctime(timeinfo));
-        }
-        else 
-        {
-            LED_result = 2;
-            printf("FAILED - Re-test or reject.\n");
-            fprintf(pFile, "%s, %s, FAILED, %s", UnitProductNumber, UnitSerialNumber, asctime(timeinfo));
-        }
-    }
+    LED_result = (smo_led_done == ok) ? 0 : (smo_led_passed == ok) ? 1 : 2;
+    fprintf(pFile, "%s, %.16s, %s, %s", UnitProductNumber, UnitSerialNumber,
+            (2 == LED_result) ? "FAILED" : "PASSED", asctime(timeinfo));
     
     /* 5. Prepare READ_10 command for reset the drive */
     /************************************************************/
@@ -662,7 +534,7 @@ int main(int argc, char * argv[])
     /* io_hdr.pack_id = 0; */
     /* io_hdr.usr_ptr = NULL; */
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
 	   perror("sg_read_SM325: Inquiry SG_IO ioctl error");
 	   close(sg_fd);
 	   return 1;
@@ -683,13 +555,10 @@ int main(int argc, char * argv[])
     }
 
     if (ok) { /* output result if it is available */
-	    memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-
 #ifdef DEBUG_FLAG
 	    /* Print out io_hdr.deferp */
 	    printf("   reply buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-	    memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
 	    for (i=0; i<16; i++)  /* 16 rows */
 	    {
 	      printf("       %3d-%3d = ", i*j, (i*j)+31);
@@ -731,7 +600,16 @@ int main(int argc, char * argv[])
     }
 #endif
     
+    if (profile_name[0]) {
+        smd_lat_print(&dev);
+        if (smd_lat_save(&dev, profile_name) < 0)
+            perror("sg_read_SM3252_LED: error saving timeout profile");
+    }
+    if (dev.stats.retries || dev.stats.fatal)
+        smd_print_stats(&dev, "sg_read_SM3252_LED");
+    smd_print_errors(&dev, "sg_read_SM3252_LED");
     fclose(pFile);
+    smd_dev_release(&dev);
     close(sg_fd);
     return 0;
 }
@@ -10,6 +10,11 @@
 #include <sys/stat.h>
 #include "sg_lib.h"
 #include "sg_io_linux.h"
+#include "sg_SM3252_dev.h"
+#include "sg_SM3252_cdb.h"
+#include "sg_SM3252_view.h"
+#include "sg_SM3252_prof.h"
+#include "sg_SM3252_trace.h"
 
 /* This program performs a similar READ_10 command as scsi mid-level support
    16 byte commands from lk 2.4.15 to read basic information from SM325 chip
@@ -22,6 +27,10 @@
 
    Invocation: sg_read_SM3252_LED <scsi_device>
 
+   The LED byte is read from the CID table where the controller profile
+   of the firmware says (see sg_SM3252_prof.h); -C <controller_file>
+   loads the profiles from a file instead of the built in ones.
+
    Version 1.02 (20020206)
 
    Updated by Philip Ton  on 03/21/2016
@@ -42,7 +51,6 @@
 #define INQ_CMD_LEN       6
 
 #define EBUFF_SZ 256
-#define MAX_MU   256
 
 enum read_steps {basic_info, init_and_current_badblocks, current_spare_blocks_1, current_spare_blocks_2, read_LED, write_LED, reset_drive}; 
 enum inq_read_steps {inq_basic_info, inq_unit_serial_number}; 
@@ -54,10 +62,17 @@ int main(int argc, char * argv[])
     struct tm * timeinfo;
     int sg_fd, k, ok, i, j;
     sg_io_hdr_t io_hdr;
+    struct smd_dev dev;
+    int max_retries = -1;
+    char * profile_dir = 0;
+    char * trace_file = 0;
+    char * controller_file = 0;
+    const struct smp_profile * profile;
+    unsigned int line;
+    char profile_name[EBUFF_SZ] = "";
     char * file_name = 0;
     char ebuff[EBUFF_SZ];
     unsigned char sense_buffer[32];
-    unsigned char FourBytes[4], TwoBytes[2];
     unsigned char Viking[] = "VT";
     unsigned char filename[22];
 
@@ -70,12 +85,18 @@ int main(int argc, char * argv[])
                {0xF1, 0x03, 0, 0, 0, 0, 0, 0, 0x20, 0, 0, 1, 0, 0, 0, 0},
                {0xF0, 0x2C, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0} };
     unsigned char inBuff[READ10_REPLY_LEN], saveBuff[READ10_REPLY_LEN];
-    unsigned int Total_MU=0, Total_LBA=0, LBA_per_MU=0, HalfLBA_per_MU=0;
+    struct smd_geometry geom;
     
     unsigned char inqCmdBlk [2][INQ_CMD_LEN] =
              { {0x12, 0, 0, 0, INQ_REPLY_LEN, 0}, {0x12, 0, 0x80, 0, INQ_REPLY_LEN, 0} };
-    unsigned char inqBuff[INQ_REPLY_LEN];
-    unsigned char VendorID[8], ProductID[16], ProductRevision[4], UnitSerialNumber[18], UnitProductNumber[18];
+    /* Each INQUIRY gets its own buffer; the fields are read in place */
+    unsigned char inqBuff[INQ_REPLY_LEN], snBuff[INQ_REPLY_LEN];
+    struct smv_inquiry inq = smv_inquiry_view(inqBuff);
+    const unsigned char * VendorID = smv_inq_vendor(inq);
+    const unsigned char * ProductID = smv_inq_product(inq);
+    const unsigned char * ProductRevision = smv_inq_revision(inq);
+    const unsigned char * UnitSerialNumber = smv_serial_number(smv_serial_view(snBuff));
+    unsigned char UnitProductNumber[18];
 
     unsigned char capCmdBlk [READCAP_CMD_LEN] =
               {0x25, 0, 0, 0, 0, 0, 0, 0, 0, 0};
@@ -88,7 +109,15 @@ int main(int argc, char * argv[])
     timeinfo = localtime( &rawtime );
     
     for (k = 1; k < argc; ++k) {
-        if (*argv[k] == '-') {
+        if ((0 == strcmp("-C", argv[k])) && (k + 1 < argc))
+            controller_file = argv[++k];
+        else if ((0 == strcmp("-R", argv[k])) && (k + 1 < argc))
+            max_retries = atoi(argv[++k]);
+        else if ((0 == strcmp("-T", argv[k])) && (k + 1 < argc))
+            profile_dir = argv[++k];
+        else if ((0 == strcmp("-t", argv[k])) && (k + 1 < argc))
+            trace_file = argv[++k];
+        else if (*argv[k] == '-') {
             printf("Unrecognized switch: %s\n", argv[k]);
             file_name = 0;
             break;
@@ -102,7 +131,27 @@ int main(int argc, char * argv[])
         }
     }
     if (0 == file_name) {
-        printf("Usage: 'sg_read_SM3252_LED <sg_device>'\n");
+        printf("Usage: 'sg_read_SM3252_Print_Buffer [-C <controller_file>] [-R <retries>] [-T <profile_dir>] [-t <trace_file>] <sg_device>'\n");
+        printf("  -C    controller profiles from <controller_file> instead of the built in ones\n");
+        printf("  -R    retries of a failed SG_IO command (default: depends on the command)\n");
+        printf("  -T    learn command timeouts from observed latencies, kept per product\n");
+        printf("        and firmware in <profile_dir>\n");
+        printf("  -t    write every SG_IO command to <trace_file> as a Chrome trace\n");
+        printf("        (chrome://tracing, ui.perfetto.dev)\n");
+        return 1;
+    }
+    if (controller_file && (smp_load(controller_file, &line) < 0)) {
+        if ((EINVAL == errno) && line)
+            printf("sg_read_SM3252_Print_Buffer: %s line %u is not a controller profile\n",
+                   controller_file, line);
+        else if (EINVAL == errno)
+            printf("sg_read_SM3252_Print_Buffer: no controller profile in %s\n",
+                   controller_file);
+        else {
+            snprintf(ebuff, EBUFF_SZ, "sg_read_SM3252_Print_Buffer: error reading %s",
+                     controller_file);
+            perror(ebuff);
+        }
         return 1;
     }
 
@@ -119,6 +168,15 @@ int main(int argc, char * argv[])
         close(sg_fd);
         return 1;
     }
+    smd_dev_init(&dev, sg_fd);
+    dev.max_retries = max_retries;
+    if (trace_file) {
+        smtr_start_file(trace_file);
+        smtr_name(sg_fd, file_name);
+    }
+    /* What a failed INQUIRY leaves out prints as blanks */
+    memset(inqBuff, 0, sizeof(inqBuff));
+    memset(snBuff, 0, sizeof(snBuff));
 
     /* 1. Prepare INQUIRY command for Vendor ID, Product ID, Product Revision */
     /**************************************************************************/
@@ -137,7 +195,7 @@ int main(int argc, char * argv[])
     /* io_hdr.pack_id = 0; */
     /* io_hdr.usr_ptr = NULL; */
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
         perror("sg_simple1: Inquiry SG_IO ioctl error");
         close(sg_fd);
         return 1;
@@ -165,7 +223,6 @@ int main(int argc, char * argv[])
         printf(" Buffer from INQUIRY command:\n");
         printf(" inquiry buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F\n");
         printf("                 -----------------------------------------------\n");
-   		memcpy( inqBuff, io_hdr.dxferp, sizeof(inqBuff));
         for (i=0; i<32; i++)  /* 32 rows */
         {
           printf("       %3d-%3d = ", i*j, (i*j)+15);
@@ -183,17 +240,26 @@ int main(int argc, char * argv[])
         }
         printf("\n");
 #endif
-   		memcpy( VendorID, p + 8, sizeof(VendorID));
-   		memcpy( ProductID, p + 16, sizeof(ProductID));
-   		memcpy( ProductRevision, p + 32, sizeof(ProductRevision));
+    }
+
+    /* The firmware says where the LED byte is in the CID table */
+    profile = smp_default(ProductRevision);
+
+    /* Timeouts learned on earlier runs with this product and firmware */
+    if (ok && profile_dir &&
+        (smd_lat_profile_name(profile_dir, VendorID, ProductID, ProductRevision,
+                              profile_name, sizeof(profile_name)) == 0)) {
+        smd_lat_load(&dev, profile_name);
+        dev.adaptive = 1;
     }
 
     /* 2. Prepare INQUIRY command for Unit Serial Number */
     /*****************************************************/
     io_hdr.cmd_len = sizeof(inqCmdBlk[inq_unit_serial_number]);
     io_hdr.cmdp = inqCmdBlk[inq_unit_serial_number];
+    io_hdr.dxferp = snBuff;
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
         perror("sg_simple1: Inquiry SG_IO ioctl error");
         close(sg_fd);
         return 1;
@@ -215,25 +281,23 @@ int main(int argc, char * argv[])
     }
 
     if (ok) { /* output result if it is available */
-        char * p = (char *)inqBuff;
+        char * p = (char *)snBuff;
         int f = (int)*(p + 7);
 #ifdef DEBUG_FLAG
         printf("Unit Serial Number: %.16s \n", p + 4);
 	    printf(" inquiry buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-   		memcpy( inqBuff, io_hdr.dxferp, sizeof(inqBuff));
 	    for (i=0; i<16; i++)  /* 16 rows */
 	    {
 	      printf("       %3d-%3d = ", i*j, (i*j)+31);
 
 	      for (j=0; j<32; j++)
-	         printf("%02X ", inqBuff[(i*32)+j]);
+	         printf("%02X ", snBuff[(i*32)+j]);
 	   
 	      printf("\n");
 	    }
         printf("\n");
 #endif
-   		memcpy( UnitSerialNumber, p + 4, sizeof(UnitSerialNumber));
     }
 
     /* 3. Prepare READ CAPACITY command for Block Size and Disk Size */
@@ -243,7 +307,7 @@ int main(int argc, char * argv[])
     io_hdr.dxferp = capBuff;
     io_hdr.cmdp = capCmdBlk;
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
         perror("sg_simple1: READ CAPACITY SG_IO ioctl error");
         close(sg_fd);
         return 1;
@@ -268,22 +332,13 @@ int main(int argc, char * argv[])
 #ifdef DEBUG_FLAG
 	    printf(" readcap buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-   		memcpy( capBuff, io_hdr.dxferp, sizeof(capBuff));
         printf("                 ");
         for (j=0; j<8; j++)
 	        printf("%02X ", capBuff[j]);
 	    printf("\n");
 #endif
-        FourBytes[0] = capBuff[7];
-        FourBytes[1] = capBuff[6];
-        FourBytes[2] = capBuff[5];
-        FourBytes[3] = capBuff[4];
-        BlockSize  = *(int *)FourBytes;
-        FourBytes[0] = capBuff[3];
-        FourBytes[1] = capBuff[2];
-        FourBytes[2] = capBuff[1];
-        FourBytes[3] = capBuff[0];
-        DiskSize  = ((*(int *)FourBytes) + 1) * BlockSize;
+        BlockSize  = smc_readcap_block_size(capBuff);
+        DiskSize  = (smc_readcap_last_lba(capBuff) + 1) * BlockSize;
     }
 
     /* 1. Prepare READ_10 command for reading basic information */
@@ -303,7 +358,7 @@ int main(int argc, char * argv[])
     /* io_hdr.pack_id = 0; */
     /* io_hdr.usr_ptr = NULL; */
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
 	   perror("sg_read_SM325: Inquiry SG_IO ioctl error");
 	   close(sg_fd);
 	   return 1;
@@ -325,14 +380,11 @@ int main(int argc, char * argv[])
     }
 
     if (ok) { /* output result if it is available */
-	    memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-
 #ifdef DEBUG_FLAG
 	    printf("\n  STEP 1: READ BASIC INFORMATION\n");
 	    /* Print out io_hdr.deferp */
 	    printf("   reply buffer  00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F\n");
 	    printf("                 -----------------------------------------------------------------------------------------------\n");
-	    memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
 	    for (i=0; i<8; i++)  /* 8 rows */
 	    {
 	      printf("       %3d-%3d = ", i*j, (i*j)+31);
@@ -344,20 +396,15 @@ int main(int argc, char * argv[])
 	    }
         printf("\n");
 #endif
-        Total_MU   = inBuff[1];
-        FourBytes[0] = inBuff[0x17];
-        FourBytes[1] = inBuff[0x16];
-        FourBytes[2] = inBuff[0x15];
-        FourBytes[3] = inBuff[0x14];
-        Total_LBA  = *(int *)FourBytes;
-        LBA_per_MU = Total_LBA / Total_MU;
-        HalfLBA_per_MU = LBA_per_MU / 2;
+        if (smd_geometry_decode(inBuff, &geom) < 0)
+            printf("Invalid geometry: Total MU = %d, Total LBA = 0x%02X%02X%02X%02X\n",
+                   inBuff[1], inBuff[0x14], inBuff[0x15], inBuff[0x16], inBuff[0x17]);
 
 #ifdef DEBUG_FLAG
-        printf("Total MU       = %d\n", Total_MU);
-        printf("Total LBA      = %d (0x%X)\n", Total_LBA, Total_LBA);
-        printf("LBA per MU     = %d\n", LBA_per_MU);
-        printf("HalfLBA per MU = %d\n\n", HalfLBA_per_MU);
+        printf("Total MU       = %d\n", geom.total_mu);
+        printf("Total LBA      = %d (0x%X)\n", geom.total_lba, geom.total_lba);
+        printf("LBA per MU     = %d\n", geom.lba_per_mu);
+        printf("HalfLBA per MU = %d\n\n", geom.half_lba_per_mu);
         printf("Done\n");
 #endif
     }
@@ -379,7 +426,7 @@ int main(int argc, char * argv[])
     /* io_hdr.pack_id = 0; */
     /* io_hdr.usr_ptr = NULL; */
 
-    if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
+    if (smd_io(&dev, &io_hdr) < 0) {
 	   perror("sg_read_SM325: Inquiry SG_IO ioctl error");
 	   close(sg_fd);
 	   return 1;
@@ -401,9 +448,6 @@ int main(int argc, char * argv[])
     }
 
     if (ok) { /* output result if it is available */
-	    memcpy( sense_buffer, io_hdr.sbp, sizeof(sense_buffer));
-	    memcpy( inBuff, io_hdr.dxferp, sizeof(inBuff));
-
 	    /* Save a back up buffer to compare it later to saveBuff */
 	    memcpy( saveBuff, io_hdr.dxferp, sizeof(saveBuff));
 
@@ -431,7 +475,7 @@ int main(int argc, char * argv[])
 #endif
         for (i=0; i<18; i++)
         {
-	        UnitProductNumber[i] = inBuff[86+(i*2)];
+	        UnitProductNumber[i] = smv_cid_product_char(smv_cid_view(inBuff), i);
         }
         
         strcpy(filename, UnitProductNumber);
@@ -443,22 +487,18 @@ int main(int argc, char * argv[])
             printf("Error opening log file.\n");
         }
     
-        if (strncmp(Viking, VendorID, 2) != 0)
+        if (strncmp(Viking, (const char *)VendorID, 2) != 0)
         {
             printf("NO RECONFIG - Not a Viking drive.\n");
-            fprintf(pFile, "%s, %s, %s, %s", UnitProductNumber, UnitSerialNumber, VendorID, asctime(timeinfo));
+            fprintf(pFile, "%s, %.16s, %.8s, %s", UnitProductNumber, UnitSerialNumber, VendorID, asctime(timeinfo));
             fclose(pFile);
             return 0;
         }
         
-        TwoBytes[0] = inBuff[0x08];
-        TwoBytes[1] = inBuff[0x09];
-        VID  = *(ushort *)TwoBytes;
-        TwoBytes[0] = inBuff[0x0A];
-        TwoBytes[1] = inBuff[0x0B];
-        PID  = *(ushort *)TwoBytes;
-
-        LED_Status_Byte = inBuff[0x187];
+        VID  = smc_get_le16(&inBuff[0x08]);
+        PID  = smc_get_le16(&inBuff[0x0A]);
+
+        LED_Status_Byte = inBuff[profile->led_offset];
         LED_Ready       = (LED_Status_Byte & 0x06) >> 1;
         LED_Busy        = (LED_Status_Byte & 0x60) >> 5;
 
@@ -487,7 +527,16 @@ int main(int argc, char * argv[])
 
 #endif
     
+    if (profile_name[0]) {
+        smd_lat_print(&dev);
+        if (smd_lat_save(&dev, profile_name) < 0)
+            perror("sg_read_SM3252_Print_Buffer: error saving timeout profile");
+    }
+    if (dev.stats.retries || dev.stats.fatal)
+        smd_print_stats(&dev, "sg_read_SM3252_Print_Buffer");
+    smd_print_errors(&dev, "sg_read_SM3252_Print_Buffer");
     fclose(pFile);
+    smd_dev_release(&dev);
     close(sg_fd);
     return 0;
 }